@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "kaleidoscope/engine.h"
+#include "kaleidoscope/codegen.h"
+#include "program_generator.h"
+
+// COMPILE THROUGHPUT => generates programs of growing size and times every compiler phase on them
+// => ./compile_throughput --sizes=100,200,400,800,1600 --depth=4 > throughput.csv
+// every size runs in a fresh child process so the peak RSS belongs to that size alone,
+// and at the end the growth of each phase between consecutive sizes is checked for superlinear behavior
+
+struct Measurement {
+    unsigned Functions = 0;
+    size_t Bytes = 0;
+    size_t Tokens = 0;
+    double LexMs = 0, ParseMs = 0, CodegenMs = 0, JITMs = 0;
+    long PeakRSSKb = 0;
+    unsigned Errors = 0;
+
+    double totalMs() const { return LexMs + ParseMs + CodegenMs + JITMs; }
+};
+
+static double MillisecondsSince(std::chrono::steady_clock::time_point Start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+}
+
+// runs the phases one after another over the whole program (MainLoop interleaves them per definition)
+static Measurement Measure(const std::string& Source) {
+    Measurement M;
+    M.Bytes = Source.size();
+    kaleidoscope::Engine Engine; // llvm, the jit and the builtin operators
+    unsigned ErrorsBefore = NumErrors;
+
+    // lexing alone
+    std::istringstream LexStream(Source);
+    input = &LexStream;
+    ResetLexer();
+    auto Start = std::chrono::steady_clock::now();
+    while (gettok() != tok_eof) {
+        M.Tokens++;
+    }
+    M.LexMs = MillisecondsSince(Start);
+
+    // lexing + parsing (lexing is subtracted again below)
+    std::istringstream ParseStream(Source);
+    input = &ParseStream;
+    ResetLexer();
+    std::vector<std::unique_ptr<FunctionAST>> Units;
+    Start = std::chrono::steady_clock::now();
+    getNextToken();
+    while (CurTok != tok_eof) {
+        if (CurTok == ';') {
+            getNextToken();
+            continue;
+        }
+        std::unique_ptr<FunctionAST> Unit = CurTok == tok_def ? ParseDefinition() : ParseTopLevelExpr("__bench_expr." + std::to_string(Units.size()));
+        if (!Unit) {
+            getNextToken(); // skip the bad token, like MainLoop does
+            continue;
+        }
+        if (Unit->getProto().isBinaryOp()) { // codegen normally registers the precedence, but later definitions already need it to parse
+            BinOpPrecedence[Unit->getProto().getOperatorName()] = Unit->getProto().getBinaryPrecedence();
+        }
+        Units.push_back(std::move(Unit));
+    }
+    M.ParseMs = std::max(0.0, MillisecondsSince(Start) - M.LexMs);
+    input = nullptr;
+
+    // codegen (including the function passes) and handing every unit to the jit in its own module, like HandleDefinition
+    std::vector<std::string> Names;
+    for (auto &Unit : Units) {
+        Start = std::chrono::steady_clock::now();
+        llvm::Function* FnIR = Unit->codegen();
+        M.CodegenMs += MillisecondsSince(Start);
+        if (!FnIR) {
+            continue;
+        }
+
+        Start = std::chrono::steady_clock::now();
+        ExitOnErr(TheJIT->addModule(llvm::orc::ThreadSafeModule(std::move(TheModule), TheTSC)));
+        InitializeModule();
+        M.JITMs += MillisecondsSince(Start);
+
+        std::string Name = Unit->getProto().getName();
+        Names.push_back(Name);
+        FunctionDefs[Name] = std::move(Unit); // later units expand operators from here
+    }
+
+    // the jit only compiles on lookup => look up everything to get it all to machine code
+    Start = std::chrono::steady_clock::now();
+    for (auto &Name : Names) {
+        ExitOnErr(TheJIT->lookup(Name));
+    }
+    M.JITMs += MillisecondsSince(Start);
+
+    M.Errors = NumErrors - ErrorsBefore;
+    return M;
+}
+
+static bool ReadSizes(const std::string& List, std::vector<unsigned>& Sizes) {
+    std::stringstream Stream(List);
+    std::string Item;
+    while (std::getline(Stream, Item, ',')) {
+        if (Item.empty()) {
+            return false;
+        }
+        Sizes.push_back(std::stoul(Item));
+    }
+    return !Sizes.empty();
+}
+
+// measures one size in a child process (so every size starts with a fresh heap and its own peak RSS)
+static bool MeasureSize(const ProgramShape& Shape, Measurement& Result) {
+    std::string Source = GenerateProgram(Shape);
+#ifdef _WIN32
+    Result = Measure(Source); // no fork => peak RSS is not reported
+    Result.Functions = Shape.Functions;
+    return true;
+#else
+    int Pipe[2];
+    if (pipe(Pipe) != 0) {
+        return false;
+    }
+
+    pid_t Child = fork();
+    if (Child == 0) {
+        close(Pipe[0]);
+        Measurement M = Measure(Source);
+        M.Functions = Shape.Functions;
+        struct rusage Usage;
+        getrusage(RUSAGE_SELF, &Usage);
+        M.PeakRSSKb = Usage.ru_maxrss; // kilobytes on linux (bytes on macOS)
+#ifdef __APPLE__
+        M.PeakRSSKb /= 1024;
+#endif
+        write(Pipe[1], &M, sizeof(M));
+        _exit(0);
+    }
+
+    close(Pipe[1]);
+    bool Ok = Child > 0 && read(Pipe[0], &Result, sizeof(Result)) == sizeof(Result);
+    close(Pipe[0]);
+    if (Child > 0) {
+        waitpid(Child, nullptr, 0);
+    }
+    return Ok;
+#endif
+}
+
+int main(int argc, char** argv) {
+    ProgramShape Shape;
+    std::vector<unsigned> Sizes = { 100, 200, 400, 800, 1600 };
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i];
+        if (Arg.rfind("--sizes=", 0) == 0) { // function counts to measure
+            Sizes.clear();
+            if (!ReadSizes(Arg.substr(8), Sizes)) {
+                fprintf(stderr, "Expected a comma separated list of function counts after --sizes=.\n");
+                return 1;
+            }
+        } else if (!ParseShapeOption(Arg, Shape)) {
+            fprintf(stderr, "Unknown option '%s'. Options:\n  --sizes=N,N,...\n%s", Arg.c_str(), ShapeOptionsHelp);
+            return 1;
+        }
+    }
+
+    std::vector<Measurement> Results;
+    printf("functions,bytes,tokens,lex_ms,parse_ms,codegen_ms,jit_ms,total_ms,peak_rss_kb,errors\n");
+    for (unsigned Size : Sizes) {
+        Shape.Functions = Size;
+        Measurement M;
+        if (!MeasureSize(Shape, M)) {
+            fprintf(stderr, "Measuring %u functions failed.\n", Size);
+            return 1;
+        }
+        printf("%u,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%ld,%u\n", M.Functions, M.Bytes, M.Tokens, M.LexMs, M.ParseMs, M.CodegenMs, M.JITMs, M.totalMs(), M.PeakRSSKb, M.Errors);
+        fflush(stdout);
+        Results.push_back(M);
+    }
+
+    // growth exponent between consecutive sizes => ~1 is linear, clearly above that means something is superlinear
+    const double Threshold = 1.3;
+    for (size_t i = 1; i < Results.size(); ++i) {
+        const Measurement &A = Results[i - 1], &B = Results[i];
+        double SizeRatio = std::log((double)B.Bytes / A.Bytes);
+        auto Check = [&](const char* Phase, double TA, double TB) {
+            if (TA < 1.0 || SizeRatio <= 0) { // too short to say anything
+                return;
+            }
+            double Exponent = std::log(TB / TA) / SizeRatio;
+            if (Exponent > Threshold) {
+                fprintf(stderr, "Warning: %s grows superlinearly between %u and %u functions (exponent %.2f).\n", Phase, A.Functions, B.Functions, Exponent);
+            }
+        };
+        Check("lexing", A.LexMs, B.LexMs);
+        Check("parsing", A.ParseMs, B.ParseMs);
+        Check("codegen", A.CodegenMs, B.CodegenMs);
+        Check("jit", A.JITMs, B.JITMs);
+        Check("peak rss", A.PeakRSSKb / 1024.0, B.PeakRSSKb / 1024.0);
+    }
+    return 0;
+}
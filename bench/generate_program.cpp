@@ -0,0 +1,19 @@
+#include <cstdio>
+#include <string>
+
+#include "program_generator.h"
+
+// writes one synthetic kaleidoscope program to stdout => ./generate_program --functions=1000 --depth=5 > big.k
+int main(int argc, char** argv) {
+    ProgramShape Shape;
+    for (int i = 1; i < argc; ++i) {
+        if (!ParseShapeOption(argv[i], Shape)) {
+            fprintf(stderr, "Unknown option '%s'. Options:\n%s", argv[i], ShapeOptionsHelp);
+            return 1;
+        }
+    }
+
+    std::string Program = GenerateProgram(Shape);
+    fwrite(Program.data(), 1, Program.size(), stdout);
+    return 0;
+}
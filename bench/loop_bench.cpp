@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "kaleidoscope/engine.h"
+#include "kaleidoscope/codegen.h"
+#include "kaleidoscope/expression_handler.h"
+
+#include "llvm/IR/DiagnosticHandler.h"
+#include "llvm/IR/DiagnosticInfo.h"
+
+// LOOP BENCH => what the counted lowering of 'for' and loop hints buy => ./loop_bench ../tests/loops.k [--n=N] [--repeats=R]
+//     [--baseline=sumto] [--hinted=sumto4,sumtounrolled] > loops.csv
+// every definition of the script with one parameter is a kernel => the script is compiled once with counted loops and once with every
+// loop lowered the general way, each kernel is called with n (best of R calls), and the loop vectorizer's "vectorized loop" remarks
+// are counted per kernel => one csv row per kernel and lowering, and the speedup and vectorization hit rate on stderr
+// the hinted kernels compute what the baseline does with unroll/vectorize/interleave hints => their speedup over it is reported too
+
+static const char* const Lowerings[] = { "counted", "general" };
+
+struct KernelResult {
+    double Ms = 0;
+    unsigned Vectorized = 0; // loops the vectorizer vectorized in the kernel
+};
+
+// counts the remarks of loops that were vectorized, per function
+struct VectorizeRemarks : llvm::DiagnosticHandler {
+    std::map<std::string, unsigned>& Counts;
+    explicit VectorizeRemarks(std::map<std::string, unsigned>& Counts) : Counts(Counts) {}
+    bool isPassedOptRemarkEnabled(llvm::StringRef PassName) const override { return PassName == "loop-vectorize"; }
+    bool isAnyRemarkEnabled() const override { return true; }
+    bool handleDiagnostics(const llvm::DiagnosticInfo& DI) override {
+        auto* Remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&DI);
+        if (!Remark) {
+            return false; // errors and warnings still go to the default handler
+        }
+        if (Remark->isPassed() && Remark->getPassName() == "loop-vectorize") {
+            Counts[Remark->getFunction().getName().str()]++;
+        }
+        return true;
+    }
+};
+
+// the engine reports every definition on stderr => silenced while compiling, so only our summary shows up
+struct QuietStderr {
+#ifndef _WIN32
+    int Saved = dup(STDERR_FILENO);
+    QuietStderr() {
+        int Null = open("/dev/null", O_WRONLY);
+        dup2(Null, STDERR_FILENO);
+        close(Null);
+    }
+    ~QuietStderr() {
+        dup2(Saved, STDERR_FILENO);
+        close(Saved);
+    }
+#endif
+};
+
+// compiles the definitions of the script (its top level expressions are parsed and dropped) and times every kernel
+static bool MeasureLowering(const std::string& Path, bool Counted, double N, unsigned Repeats, std::map<std::string, KernelResult>& Results) {
+    std::ifstream File(Path);
+    if (!File) {
+        return false;
+    }
+
+    kaleidoscope::Engine Engine;
+    CountedLoops = Counted;
+    std::map<std::string, unsigned> Remarks;
+    TheContext->setDiagnosticHandler(std::make_unique<VectorizeRemarks>(Remarks));
+    {
+        QuietStderr Quiet;
+        input = &File;
+        ResetLexer();
+        getNextToken();
+        while (CurTok != tok_eof) {
+            if (CurTok == ';') {
+                getNextToken();
+            } else if (CurTok == tok_def) {
+                HandleDefinition();
+            } else if (CurTok == tok_decl) {
+                HandleDecl();
+            } else if (CurTok == tok_record) {
+                HandleRecord();
+            } else if (CurTok == tok_import) {
+                HandleImport();
+            } else if (!ParseTopLevelExpr(TopLevelExpressionName())) { // the kernels are called from here instead
+                getNextToken();
+            }
+        }
+        input = nullptr;
+    }
+
+    for (auto &Definition : FunctionDefs) {
+        const PrototypeAST& P = Definition.second->getProto();
+        if (P.isUnaryOp() || P.isBinaryOp() || P.getArgs().size() != 1 || P.hasRecords()) {
+            continue;
+        }
+        auto Kernel = Engine.lookup<double (*)(double)>(Definition.first);
+        if (!Kernel) {
+            continue;
+        }
+        KernelResult& Result = Results[Definition.first];
+        Result.Ms = -1;
+        for (unsigned i = 0; i != Repeats; ++i) {
+            auto Start = std::chrono::steady_clock::now();
+            volatile double Sink = Kernel(N); // keeps the call from being dropped
+            (void)Sink;
+            double Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+            Result.Ms = Result.Ms < 0 ? Ms : std::min(Result.Ms, Ms);
+        }
+        Result.Vectorized = Remarks[Definition.first];
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const char* Path = nullptr;
+    double N = 10000000;
+    unsigned Repeats = 5;
+    std::string Baseline = "sumto";
+    std::vector<std::string> Hinted = { "sumto4", "sumtounrolled" };
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i];
+        if (Arg.rfind("--n=", 0) == 0) {
+            N = std::stod(Arg.substr(4));
+        } else if (Arg.rfind("--repeats=", 0) == 0) {
+            Repeats = std::max(1ul, std::stoul(Arg.substr(10)));
+        } else if (Arg.rfind("--baseline=", 0) == 0) {
+            Baseline = Arg.substr(11);
+        } else if (Arg.rfind("--hinted=", 0) == 0) {
+            Hinted.clear();
+            std::string List = Arg.substr(9);
+            for (size_t Start = 0, End; Start <= List.size(); Start = End + 1) {
+                End = std::min(List.find(',', Start), List.size());
+                if (End != Start) {
+                    Hinted.push_back(List.substr(Start, End - Start));
+                }
+            }
+        } else if (Arg.rfind("--", 0) != 0 && !Path) {
+            Path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: ./loop_bench script.k [--n=N] [--repeats=R] [--baseline=name] [--hinted=name,...]\n");
+            return 1;
+        }
+    }
+    if (!Path) {
+        fprintf(stderr, "Usage: ./loop_bench script.k [--n=N] [--repeats=R] [--baseline=name] [--hinted=name,...]\n");
+        return 1;
+    }
+
+    std::map<std::string, KernelResult> Results[2]; // [counted, general] => kernel => result
+    for (int l = 0; l != 2; ++l) {
+        if (!MeasureLowering(Path, l == 0, N, Repeats, Results[l])) {
+            fprintf(stderr, "Could not open '%s'.\n", Path);
+            return 1;
+        }
+    }
+
+    printf("kernel,lowering,n,ms,vectorized_loops\n");
+    unsigned Hits[2] = { 0, 0 };
+    for (auto &Entry : Results[0]) {
+        const KernelResult& Counted = Entry.second;
+        const KernelResult& General = Results[1][Entry.first];
+        printf("%s,%s,%.0f,%.4f,%u\n", Entry.first.c_str(), Lowerings[0], N, Counted.Ms, Counted.Vectorized);
+        printf("%s,%s,%.0f,%.4f,%u\n", Entry.first.c_str(), Lowerings[1], N, General.Ms, General.Vectorized);
+        Hits[0] += Counted.Vectorized > 0;
+        Hits[1] += General.Vectorized > 0;
+        fprintf(stderr, "%-16s counted %10.4f ms (%u vectorized)  general %10.4f ms (%u vectorized)  speedup %6.2fx\n", Entry.first.c_str(),
+                Counted.Ms, Counted.Vectorized, General.Ms, General.Vectorized, Counted.Ms > 0 ? General.Ms / Counted.Ms : 0.0);
+    }
+    fprintf(stderr, "vectorized kernels => counted %u of %zu, general %u of %zu\n", Hits[0], Results[0].size(), Hits[1], Results[0].size());
+
+    // hinted vs unhinted => baseline ms / hinted ms under each lowering
+    for (const std::string& Name : Hinted) {
+        if (!Results[0].count(Baseline) || !Results[0].count(Name)) {
+            fprintf(stderr, "hints => no kernel '%s' or '%s' in %s\n", Baseline.c_str(), Name.c_str(), Path);
+            continue;
+        }
+        fprintf(stderr, "hints => %s vs %s:", Name.c_str(), Baseline.c_str());
+        for (int l = 0; l != 2; ++l) {
+            double Hint = Results[l][Name].Ms, Plain = Results[l][Baseline].Ms;
+            fprintf(stderr, "  %s %6.2fx (%u vs %u vectorized)", Lowerings[l], Hint > 0 ? Plain / Hint : 0.0, Results[l][Name].Vectorized,
+                    Results[l][Baseline].Vectorized);
+        }
+        fprintf(stderr, "\n");
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "program_generator.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static const char OperatorChars[] = "|&^%$@~?!>:"; // characters nothing else in the language uses
+
+// builds the source text of one program => every function only calls functions defined before it, so nothing recurses
+class Generator {
+public:
+    Generator(const ProgramShape& Shape) : Shape(Shape), Random(Shape.Seed) {}
+
+    std::string run() {
+        unsigned NumOperators = std::min<unsigned>(Shape.Operators, sizeof(OperatorChars) - 1);
+        for (unsigned i = 0; i != NumOperators; ++i) {
+            Operators.push_back(OperatorChars[i]);
+            Out += "def binary ";
+            Out += OperatorChars[i];
+            Out += " " + std::to_string(5 + 4 * i) + " (a, b) a * 0.5 + b;\n";
+        }
+        Out += "\n";
+
+        for (unsigned F = 0; F != Shape.Functions; ++F) {
+            function(F);
+        }
+
+        for (unsigned i = 0; i != Shape.TopLevel && Shape.Functions; ++i) {
+            Out += "f" + std::to_string(pick(Shape.Functions)) + "(1, 2);\n";
+        }
+        return std::move(Out);
+    }
+
+private:
+    unsigned pick(unsigned N) { return std::uniform_int_distribution<unsigned>(0, N - 1)(Random); }
+
+    void function(unsigned F) {
+        Callable = F; // f0 .. f(F-1) exist by now
+        std::vector<std::string> Scope = { "x", "y" };
+        Out += "def f" + std::to_string(F) + "(x, y)\n";
+
+        std::vector<std::string> Vars;
+        if (Shape.Variables) {
+            Out += "    spawn ";
+            for (unsigned V = 0; V != Shape.Variables; ++V) {
+                std::string Name = "v" + std::to_string(V);
+                Out += (V ? ", " : "") + Name + " = " + expression(Shape.Depth, Scope);
+                Scope.push_back(Name); // later initializers may use earlier variables
+                Vars.push_back(Name);
+            }
+            Out += " endspawn\n";
+        }
+
+        std::vector<std::string> OuterScope = Scope; // the iterators are gone again after the loop
+        if (Shape.ForNesting) {
+            Out += "    (";
+            for (unsigned L = 0; L != Shape.ForNesting; ++L) {
+                std::string Iterator = "i" + std::to_string(L);
+                Out += "for " + Iterator + " = 0, " + Iterator + " < 3 in\n" + std::string(8 + 4 * L, ' ');
+                Scope.push_back(Iterator);
+            }
+            std::string Body = expression(Shape.Depth, Scope);
+            Out += Vars.empty() ? Body : Vars[0] + " = " + Vars[0] + " + " + Body; // accumulate into a variable when there is one
+            Out += ") + ";
+        } else {
+            Out += "    ";
+        }
+        Out += expression(Shape.Depth, OuterScope) + ";\n\n";
+    }
+
+    std::string expression(unsigned Depth, const std::vector<std::string>& Scope) {
+        if (Depth == 0) {
+            if (pick(3) == 0) {
+                return std::to_string(pick(100)) + ".5";
+            }
+            return Scope[pick(Scope.size())];
+        }
+
+        unsigned Kind = pick(10);
+        if (Kind == 7) {
+            return "(if " + expression(Depth - 1, Scope) + " < " + expression(Depth - 1, Scope) + " then " + expression(Depth - 1, Scope) + " else " + expression(Depth - 1, Scope) + ")";
+        }
+        if (Kind >= 8 && Callable) {
+            return "f" + std::to_string(pick(Callable)) + "(" + expression(Depth - 1, Scope) + ", " + expression(Depth - 1, Scope) + ")";
+        }
+
+        std::string Op;
+        if ((Kind == 5 || Kind == 6) && !Operators.empty()) {
+            Op = Operators[pick(Operators.size())];
+        } else {
+            Op = "+-*"[pick(3)];
+        }
+        return "(" + expression(Depth - 1, Scope) + " " + Op + " " + expression(Depth - 1, Scope) + ")";
+    }
+
+    ProgramShape Shape;
+    std::mt19937 Random;
+    std::string Out;
+    std::vector<char> Operators;
+    unsigned Callable = 0;
+};
+
+std::string GenerateProgram(const ProgramShape& Shape) {
+    return Generator(Shape).run();
+}
+
+const char* ShapeOptionsHelp = "  --functions=N --depth=N --operators=N --variables=N --for-nesting=N --top-level=N --seed=N\n";
+
+bool ParseShapeOption(const std::string& Arg, ProgramShape& Shape) {
+    static const std::pair<const char*, unsigned ProgramShape::*> Options[] = {
+        { "--functions=", &ProgramShape::Functions },
+        { "--depth=", &ProgramShape::Depth },
+        { "--operators=", &ProgramShape::Operators },
+        { "--variables=", &ProgramShape::Variables },
+        { "--for-nesting=", &ProgramShape::ForNesting },
+        { "--top-level=", &ProgramShape::TopLevel },
+        { "--seed=", &ProgramShape::Seed },
+    };
+    for (auto &Option : Options) {
+        std::string Prefix = Option.first;
+        if (Arg.rfind(Prefix, 0) == 0) {
+            Shape.*Option.second = std::stoul(Arg.substr(Prefix.size()));
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,23 @@
+#ifndef PROGRAM_GENERATOR_H
+#define PROGRAM_GENERATOR_H
+
+#include <string>
+
+// SYNTHETIC PROGRAMS => deterministic (seeded) kaleidoscope source of a chosen size and shape
+// used by generate_program (writes one out) and compile_throughput (pushes a series of them through the compiler)
+
+struct ProgramShape {
+    unsigned Functions = 100; // number of 'def's (each one calls some of the earlier ones)
+    unsigned Depth = 4; // depth of the expression trees in function bodies
+    unsigned Operators = 4; // user defined binary operators, defined up front and used inside the expressions (at most 11)
+    unsigned Variables = 2; // 'spawn' variables per function
+    unsigned ForNesting = 1; // how deeply the for loop in every function body is nested (0 => no loops)
+    unsigned TopLevel = 4; // top level calls at the end
+    unsigned Seed = 1;
+};
+
+extern std::string GenerateProgram(const ProgramShape& Shape);
+extern bool ParseShapeOption(const std::string& Arg, ProgramShape& Shape); // --functions=N, --depth=N, --operators=N, --variables=N, --for-nesting=N, --top-level=N, --seed=N
+extern const char* ShapeOptionsHelp;
+
+#endif
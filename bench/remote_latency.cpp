@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "kaleidoscope/engine.h"
+
+// REMOTE LATENCY => what running jitted code in an executor process (--executors) costs compared to running it in process
+// => ./remote_latency [--executor-path=../kaleidoscope_executor] [--repeats=N] > remote.csv (per case medians on stderr)
+// per top level expression: a fresh one (compile, link into the executor, run), a repeated one (cached code => only the call crosses over)
+// and a repeated one printing 64 characters (its output travels back with the result); then a --parallel batch of independent
+// expressions spread over 1, 2 and 4 executors against the same batch on in process worker threads
+
+static const char* const Definitions =
+    "def twice(x) x * 2;"
+    "def shout() (for i = 0, i < 64 in putchard(65)) * 0;"
+    "def spin(n) var s = 0 in (for i = 0, i < n in s = s + i * 0.5) * 0 + s;";
+
+static std::vector<double> Samples[2][3]; // [in process, executor][fresh, repeat, print] => microseconds
+
+static double Percentile(std::vector<double> Values, double P) {
+    std::sort(Values.begin(), Values.end());
+    return Values.empty() ? 0 : Values[std::min(Values.size() - 1, (size_t)(P / 100 * Values.size()))];
+}
+
+// the engine reports every expression on stderr => silenced while measuring, so only our summary shows up
+struct QuietStderr {
+#ifndef _WIN32
+    int Saved = dup(STDERR_FILENO);
+    QuietStderr() {
+        int Null = open("/dev/null", O_WRONLY);
+        dup2(Null, STDERR_FILENO);
+        close(Null);
+    }
+    ~QuietStderr() {
+        dup2(Saved, STDERR_FILENO);
+        close(Saved);
+    }
+#endif
+};
+
+static double TimeLoad(kaleidoscope::Engine& Engine, const std::string& Source) {
+    auto Start = std::chrono::steady_clock::now();
+    Engine.loadSource(Source);
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - Start).count();
+}
+
+static void MeasureExpressions(unsigned Executors, const std::string& ExecutorPath, unsigned Repeats) {
+    kaleidoscope::EngineOptions Options;
+    Options.Executors = Executors;
+    Options.ExecutorPath = ExecutorPath;
+    Options.Tier = "jit"; // the interpreter would skip the jit (and the executor) for the fresh expressions
+    Options.Output = "stdout"; // shout()'s output => silenced with stderr
+    kaleidoscope::Engine Engine(Options);
+
+    QuietStderr Quiet;
+    Engine.loadSource(Definitions);
+    Engine.loadSource("twice(0); shout();"); // compiles the definitions (lazily, on first call) and warms the caches
+    for (unsigned i = 0; i != Repeats; ++i) {
+        Samples[Executors > 0][0].push_back(TimeLoad(Engine, "twice(" + std::to_string(i + 1) + ");")); // a new constant => a cache miss
+        Samples[Executors > 0][1].push_back(TimeLoad(Engine, "twice(0);"));
+        Samples[Executors > 0][2].push_back(TimeLoad(Engine, "shout();"));
+    }
+}
+
+// milliseconds for a --parallel script of independent spin() expressions
+static double MeasureBatch(unsigned Executors, const std::string& ExecutorPath) {
+    kaleidoscope::EngineOptions Options;
+    Options.Executors = Executors;
+    Options.ExecutorPath = ExecutorPath;
+    Options.ParallelThreads = std::max(1u, std::thread::hardware_concurrency());
+    kaleidoscope::Engine Engine(Options);
+
+    QuietStderr Quiet;
+    Engine.loadSource(Definitions);
+    std::string Batch;
+    for (int i = 0; i != 64; ++i) {
+        Batch += "spin(" + std::to_string(2000000 + i) + ");";
+    }
+    return TimeLoad(Engine, Batch) / 1000;
+}
+
+int main(int argc, char** argv) {
+    std::string ExecutorPath = "../kaleidoscope_executor";
+    unsigned Repeats = 200;
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i];
+        if (Arg.rfind("--executor-path=", 0) == 0) {
+            ExecutorPath = Arg.substr(16);
+        } else if (Arg.rfind("--repeats=", 0) == 0) {
+            Repeats = std::max(1ul, std::stoul(Arg.substr(10)));
+        } else {
+            fprintf(stderr, "Usage: ./remote_latency [--executor-path=../kaleidoscope_executor] [--repeats=N]\n");
+            return 1;
+        }
+    }
+
+    MeasureExpressions(0, ExecutorPath, Repeats);
+    MeasureExpressions(1, ExecutorPath, Repeats);
+
+    static const char* const Cases[] = { "fresh", "repeat", "print" };
+    printf("where,case,median_us,p90_us,p99_us\n");
+    for (int Where = 0; Where != 2; ++Where) {
+        for (int Case = 0; Case != 3; ++Case) {
+            printf("%s,%s,%.2f,%.2f,%.2f\n", Where ? "executor" : "in_process", Cases[Case], Percentile(Samples[Where][Case], 50),
+                   Percentile(Samples[Where][Case], 90), Percentile(Samples[Where][Case], 99));
+        }
+    }
+    for (int Case = 0; Case != 3; ++Case) {
+        double Local = Percentile(Samples[0][Case], 50), Remote = Percentile(Samples[1][Case], 50);
+        fprintf(stderr, "%-7s in process %9.2f us  executor %9.2f us  => the boundary adds %9.2f us\n", Cases[Case], Local, Remote, Remote - Local);
+    }
+
+    printf("\nexecutors,batch_ms\n");
+    for (unsigned Executors : { 0u, 1u, 2u, 4u }) {
+        double Ms = MeasureBatch(Executors, ExecutorPath);
+        printf("%u,%.2f\n", Executors, Ms);
+        fprintf(stderr, "64 parallel expressions on %u executor(s)%s: %.2f ms\n", Executors, Executors ? "" : " (in process)", Ms);
+    }
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "kaleidoscope/engine.h"
+#include "kaleidoscope/expression_handler.h"
+
+// REPL LATENCY => how long every entry of a script takes from its first token to "Evaluated to ..." under each tier
+// => ./repl_latency ../tests/*.k > latency.csv (one row per entry, plus a median/mean/max summary per script and tier on stderr)
+// every script and tier runs in a fresh child process with the script's own output (and the compiler's ir dumps) sent to /dev/null
+
+struct Entry {
+    int Line = 0;
+    char Kind = 0; // 'd' def, 'e' top level expression, 'o' anything else (decl, import)
+    double Ms = 0;
+};
+
+static const char* const Tiers[] = { "jit", "auto", "interp" };
+
+// runs the statements of a script one by one like MainLoop does, timing each one
+static std::vector<Entry> RunScript(const std::string& Path, const std::string& Tier) {
+    std::vector<Entry> Entries;
+    std::ifstream File(Path);
+    if (!File) {
+        return Entries;
+    }
+
+    kaleidoscope::EngineOptions Options;
+    Options.Tier = Tier;
+    Options.CacheExpressions = false; // every entry pays for itself
+    kaleidoscope::Engine Engine(Options);
+
+    input = &File;
+    ResetLexer();
+    getNextToken();
+    while (CurTok != tok_eof) {
+        if (CurTok == ';') {
+            getNextToken();
+            continue;
+        }
+        Entry E;
+        E.Line = CurLoc.Line;
+        auto Start = std::chrono::steady_clock::now();
+        if (CurTok == tok_def) {
+            E.Kind = 'd';
+            HandleDefinition();
+        } else if (CurTok == tok_decl) {
+            E.Kind = 'o';
+            HandleDecl();
+        } else if (CurTok == tok_import) {
+            E.Kind = 'o';
+            HandleImport();
+        } else {
+            E.Kind = 'e';
+            HandleTopLevelExpression();
+        }
+        E.Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+        Entries.push_back(E);
+    }
+    input = nullptr;
+    return Entries;
+}
+
+// runs one script under one tier in a child process => a fresh engine, and its output can go to /dev/null without touching ours
+static bool MeasureScript(const std::string& Path, const std::string& Tier, std::vector<Entry>& Entries) {
+#ifdef _WIN32
+    Entries = RunScript(Path, Tier);
+    return !Entries.empty();
+#else
+    int Pipe[2];
+    if (pipe(Pipe) != 0) {
+        return false;
+    }
+
+    pid_t Child = fork();
+    if (Child == 0) {
+        close(Pipe[0]);
+        int Null = open("/dev/null", O_WRONLY);
+        dup2(Null, STDOUT_FILENO);
+        dup2(Null, STDERR_FILENO);
+        std::vector<Entry> Measured = RunScript(Path, Tier);
+        size_t Count = Measured.size();
+        write(Pipe[1], &Count, sizeof(Count));
+        write(Pipe[1], Measured.data(), Count * sizeof(Entry));
+        _exit(0);
+    }
+
+    close(Pipe[1]);
+    bool Ok = false;
+    size_t Count = 0;
+    if (Child > 0 && read(Pipe[0], &Count, sizeof(Count)) == sizeof(Count)) {
+        Entries.resize(Count);
+        size_t Bytes = Count * sizeof(Entry), Done = 0;
+        while (Done < Bytes) { // large scripts don't fit in one pipe buffer
+            ssize_t Read = read(Pipe[0], reinterpret_cast<char*>(Entries.data()) + Done, Bytes - Done);
+            if (Read <= 0) {
+                break;
+            }
+            Done += Read;
+        }
+        Ok = Done == Bytes;
+    }
+    close(Pipe[0]);
+    if (Child > 0) {
+        waitpid(Child, nullptr, 0);
+    }
+    return Ok;
+#endif
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: ./repl_latency script.k ...\n");
+        return 1;
+    }
+
+    printf("script,tier,line,kind,ms\n");
+    for (int i = 1; i < argc; ++i) {
+        std::string Path = argv[i];
+        std::map<std::string, double> Medians; // tier => median expression time, for the interp vs jit line
+        for (const char* Tier : Tiers) {
+            std::vector<Entry> Entries;
+            if (!MeasureScript(Path, Tier, Entries)) {
+                fprintf(stderr, "Running '%s' failed.\n", Path.c_str());
+                break;
+            }
+
+            std::vector<double> Expressions;
+            for (auto &E : Entries) {
+                printf("%s,%s,%d,%c,%.4f\n", Path.c_str(), Tier, E.Line, E.Kind, E.Ms);
+                if (E.Kind == 'e') {
+                    Expressions.push_back(E.Ms);
+                }
+            }
+            fflush(stdout);
+            if (Expressions.empty()) {
+                continue;
+            }
+
+            std::sort(Expressions.begin(), Expressions.end());
+            double Sum = 0;
+            for (double Ms : Expressions) {
+                Sum += Ms;
+            }
+            fprintf(stderr, "%-28s %-5s %3zu expressions  median %9.4f ms  mean %9.4f ms  max %9.4f ms\n", Path.c_str(), Tier, Expressions.size(),
+                    Expressions[Expressions.size() / 2], Sum / Expressions.size(), Expressions.back());
+            Medians[Tier] = Expressions[Expressions.size() / 2];
+        }
+        if (Medians.count("jit") && Medians.count("interp") && Medians["interp"] > 0) { // the number the interpreter tier exists for
+            fprintf(stderr, "%-28s interp vs jit: median %.4f ms vs %.4f ms per expression (%.1fx)\n", Path.c_str(), Medians["interp"], Medians["jit"],
+                    Medians["jit"] / Medians["interp"]);
+        }
+    }
+    return 0;
+}
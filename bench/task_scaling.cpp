@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "kaleidoscope/engine.h"
+
+// TASK SCALING => how async/await scales with the workers of the scheduler (--workers)
+// => ./task_scaling [--n=38] [--max-workers=N] [--repeats=R] > scaling.csv (speedups on stderr)
+// the pfib of tests/async.k (fib split into tasks until x < 25) runs in a fresh engine for every worker count from 1 to N
+// (one per core by default), best of R calls each => time and speedup over one worker per count
+
+static const char* const Definitions =
+    "def fib(x) if x < 3 then 1 else fib(x-1) + fib(x-2);"
+    "def pfib(x) if x < 25 then fib(x) else spawn a = async pfib(x-1), b = async pfib(x-2) endspawn await a + await b;";
+
+// the engine reports every definition on stderr => silenced while compiling, so only our summary shows up
+struct QuietStderr {
+#ifndef _WIN32
+    int Saved = dup(STDERR_FILENO);
+    QuietStderr() {
+        int Null = open("/dev/null", O_WRONLY);
+        dup2(Null, STDERR_FILENO);
+        close(Null);
+    }
+    ~QuietStderr() {
+        dup2(Saved, STDERR_FILENO);
+        close(Saved);
+    }
+#endif
+};
+
+// best time of R calls of pfib(n) on that many workers => -1 if the engine could not be set up
+static double MeasureWorkers(unsigned Workers, double N, unsigned Repeats) {
+    kaleidoscope::EngineOptions Options;
+    Options.TaskWorkers = Workers;
+    Options.Tier = "jit";
+    kaleidoscope::Engine Engine(Options);
+    {
+        QuietStderr Quiet;
+        if (!Engine.ok() || !Engine.loadSource(Definitions)) {
+            return -1;
+        }
+    }
+    auto PFib = Engine.lookup<double (*)(double)>("pfib");
+    if (!PFib) {
+        return -1;
+    }
+
+    PFib(26); // starts the workers, so the timed calls don't pay for their threads
+    double Best = -1;
+    for (unsigned i = 0; i != Repeats; ++i) {
+        auto Start = std::chrono::steady_clock::now();
+        volatile double Sink = PFib(N); // keeps the call from being dropped
+        (void)Sink;
+        double Ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+        Best = Best < 0 ? Ms : std::min(Best, Ms);
+    }
+    return Best;
+}
+
+int main(int argc, char** argv) {
+    double N = 38;
+    unsigned MaxWorkers = std::max(1u, std::thread::hardware_concurrency());
+    unsigned Repeats = 3;
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i];
+        if (Arg.rfind("--n=", 0) == 0) {
+            N = std::stod(Arg.substr(4));
+        } else if (Arg.rfind("--max-workers=", 0) == 0) {
+            MaxWorkers = std::max(1ul, std::stoul(Arg.substr(14)));
+        } else if (Arg.rfind("--repeats=", 0) == 0) {
+            Repeats = std::max(1ul, std::stoul(Arg.substr(10)));
+        } else {
+            fprintf(stderr, "Usage: ./task_scaling [--n=38] [--max-workers=N] [--repeats=R]\n");
+            return 1;
+        }
+    }
+
+    printf("workers,n,ms,speedup\n");
+    double Single = 0;
+    for (unsigned Workers = 1; Workers <= MaxWorkers; ++Workers) {
+        double Ms = MeasureWorkers(Workers, N, Repeats);
+        if (Ms < 0) {
+            fprintf(stderr, "Could not compile pfib.\n");
+            return 1;
+        }
+        if (Workers == 1) {
+            Single = Ms;
+        }
+        double Speedup = Ms > 0 ? Single / Ms : 0;
+        printf("%u,%.0f,%.3f,%.3f\n", Workers, N, Ms, Speedup);
+        fprintf(stderr, "%3u workers  %10.3f ms  speedup %6.2fx  (efficiency %5.1f%%)\n", Workers, Ms, Speedup, 100 * Speedup / Workers);
+    }
+    return 0;
+}
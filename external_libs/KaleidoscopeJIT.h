@@ -17,6 +17,7 @@
 #include "llvm/ExecutionEngine/JITSymbol.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/EPCGenericRTDyldMemoryManager.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
@@ -26,6 +27,7 @@
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
+#include "../include/kaleidoscope/jit_memory.h"
 #include <memory>
 
 namespace llvm {
@@ -38,23 +40,47 @@ private:
   DataLayout DL;
   MangleAndInterner Mangle;
 
+  // Shared by the memory managers of all objects, so it must outlive the
+  // object layer.
+  std::shared_ptr<JITMemoryPool> MemoryPool;
+
+  // The code lives in another process (an executor), so objects are
+  // allocated and finalized there through the executor's memory manager.
+  bool Remote;
+
   RTDyldObjectLinkingLayer ObjectLayer;
   IRCompileLayer CompileLayer;
 
   JITDylib &MainJD;
 
+  // Native symbols (runtime builtins, host callbacks and functions bound
+  // from --load libraries). MainJD links against it, so a Kaleidoscope
+  // definition with the same name shadows the native one.
+  JITDylib &NativeJD;
+
 public:
   KaleidoscopeJIT(std::unique_ptr<ExecutionSession> ES,
-                  JITTargetMachineBuilder JTMB, DataLayout DL)
+                  JITTargetMachineBuilder JTMB, DataLayout DL,
+                  bool Remote = false)
       : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
+        MemoryPool(std::make_shared<JITMemoryPool>()), Remote(Remote),
         ObjectLayer(*this->ES,
-                    []() { return std::make_unique<SectionMemoryManager>(); }),
+                    [this]() -> std::unique_ptr<RuntimeDyld::MemoryManager> {
+                      if (this->Remote)
+                        // The executor registers the memory manager service
+                        // at startup, so its bootstrap symbols are there.
+                        return cantFail(EPCGenericRTDyldMemoryManager::
+                                            CreateWithDefaultBootstrapSymbols(
+                                                this->ES->getExecutorProcessControl()));
+                      return std::make_unique<SlabMemoryManager>(MemoryPool);
+                    }),
         CompileLayer(*this->ES, ObjectLayer,
                      std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
-        MainJD(this->ES->createBareJITDylib("<main>")) {
-    MainJD.addGenerator(
-        cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
-            DL.getGlobalPrefix())));
+        MainJD(this->ES->createBareJITDylib("<main>")),
+        NativeJD(this->ES->createBareJITDylib("<native>")) {
+    // No search of the whole process: every native symbol is defined
+    // explicitly in NativeJD.
+    MainJD.addToLinkOrder(NativeJD);
     if (JTMB.getTargetTriple().isOSBinFormatCOFF()) {
       ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
       ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
@@ -70,32 +96,70 @@ public:
     auto EPC = SelfExecutorProcessControl::Create();
     if (!EPC)
       return EPC.takeError();
+    return Create(std::move(*EPC), false);
+  }
 
-    auto ES = std::make_unique<ExecutionSession>(std::move(*EPC));
+  // A JIT whose code runs wherever EPC executes it (e.g. a SimpleRemoteEPC
+  // connected to an executor process on this host).
+  static Expected<std::unique_ptr<KaleidoscopeJIT>>
+  Create(std::unique_ptr<ExecutorProcessControl> EPC, bool Remote) {
+    auto ES = std::make_unique<ExecutionSession>(std::move(EPC));
 
-    JITTargetMachineBuilder JTMB(
-        ES->getExecutorProcessControl().getTargetTriple());
+    // Target the host CPU (not a generic one) so vectorized code can use the
+    // full width of the host's vector registers.
+    auto JTMB = JITTargetMachineBuilder::detectHost();
+    if (!JTMB)
+      return JTMB.takeError();
 
-    auto DL = JTMB.getDefaultDataLayoutForTarget();
+    auto DL = JTMB->getDefaultDataLayoutForTarget();
     if (!DL)
       return DL.takeError();
 
-    return std::make_unique<KaleidoscopeJIT>(std::move(ES), std::move(JTMB),
-                                             std::move(*DL));
+    return std::make_unique<KaleidoscopeJIT>(std::move(ES), std::move(*JTMB),
+                                             std::move(*DL), Remote);
   }
 
   const DataLayout &getDataLayout() const { return DL; }
 
+  bool isRemote() const { return Remote; }
+
+  ExecutorProcessControl &getExecutorProcessControl() {
+    return ES->getExecutorProcessControl();
+  }
+
+  SymbolStringPtr mangle(StringRef Name) { return Mangle(Name.str()); }
+
   JITDylib &getMainJITDylib() { return MainJD; }
 
+  JITMemoryUsage getMemoryUsage() const { return MemoryPool->getUsage(); }
+
+  // Tells L about every object the JIT loads or frees (used by the sampling
+  // profiler to name JIT'd code).
+  void registerEventListener(JITEventListener &L) {
+    ObjectLayer.registerJITEventListener(L);
+  }
+
   Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
     if (!RT)
       RT = MainJD.getDefaultResourceTracker();
     return CompileLayer.add(RT, std::move(TSM));
   }
 
+  Error defineAbsolute(StringRef Name, ExecutorAddr Addr) {
+    return MainJD.define(absoluteSymbols(
+        {{Mangle(Name.str()),
+          {Addr, JITSymbolFlags::Exported | JITSymbolFlags::Callable}}}));
+  }
+
+  Error defineNative(StringRef Name, ExecutorAddr Addr) {
+    return NativeJD.define(absoluteSymbols(
+        {{Mangle(Name.str()),
+          {Addr, JITSymbolFlags::Exported | JITSymbolFlags::Callable}}}));
+  }
+
   Expected<ExecutorSymbolDef> lookup(StringRef Name) {
-    return ES->lookup({&MainJD}, Mangle(Name.str()));
+    JITDylib *SearchOrder[] = {&MainJD, &NativeJD};
+    return ES->lookup(SearchOrder, Mangle(Name.str()));
   }
 };
 
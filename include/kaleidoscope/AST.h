@@ -1,8 +1,12 @@
 #ifndef AST_H
 #define AST_H
 
+#include <algorithm>
 #include <string>
 #include <memory>
+#include <set>
+
+#include "lexer.h"
 
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
@@ -28,14 +32,35 @@
 #include "llvm/Transforms/Scalar/SimplifyCFG.h"
 #include "llvm/Transforms/Utils.h"
 
+struct InterpreterCheck; // interpreter.h
+struct InterpreterFrame;
+
 // EXPRESSIONS => combination of literals, identifiers, operators, etc...
 class ExprAST { // BASE CLASS FOR ALL EXPRESSION TYPES
+    SourceLocation Loc; // where the expression starts in the source
+
 public: // TODO => ADD A TYPE PARAMATER TO THIS
+    ExprAST(SourceLocation Loc = CurLoc) : Loc(Loc) {} // defaults to the token the parser is currently looking at
     virtual ~ExprAST() = default; // destructor that should be overwritten by derived classes...
+
+    const SourceLocation &getLoc() const { return Loc; } // where the expression starts (used to key profile counters)
    
     // returns an LLVM value object => represents a Static Single Assignment (SSA) => no way to change SSA values (immutable)
     // EACH VARIBALE ASSIGNED EXACTLY ONCE
     virtual llvm::Value *codegen() = 0; // llvm ir generation functions (GENERATE IR FOR THE AST NODE AND EVERYTHING IT DEPENDS ON!!!)
+
+    // adds the name of every function this expression calls directly (user operators show up as binary<op> / unary<op>)
+    virtual void collectCallees(std::set<std::string> &Callees) const = 0;
+
+    // appends a canonical text form of the expression (no whitespace or comments, exact numbers) => equal trees give equal strings
+    virtual void canonicalize(std::string &Out) const = 0;
+
+    // adds the name of every variable this expression assigns with '=' (used to prove a loop bound can't change while the loop runs)
+    virtual void collectAssigned(std::set<std::string> &Names) const = 0;
+
+    // whether the interpreter tier can evaluate this (see interpreter.h) => no for async/await, and for anything codegen would report as an error
+    virtual bool interpretable(InterpreterCheck &Check) const = 0;
+    virtual double interpret(InterpreterFrame &Frame) const = 0; // evaluates the tree directly (only after interpretable() said yes)
 };
 
 // Numeric only expressions (A LITERAL)
@@ -44,7 +69,13 @@ class NumberExprAST : public ExprAST {
     double Value; // the actual value held by the expression
 public:
     NumberExprAST(double Value) : Value(Value) {} // construction of a NumberExpr in our AST that gets passed a double
+    double getValue() const { return Value; }
     llvm::Value *codegen() override; // overrides the generic llvm ir codegen function
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
 };
 
 // Identifier names (considered an expression)
@@ -53,20 +84,32 @@ class VariableExprAST : public ExprAST {
 public:
     VariableExprAST(const std::string &Name) : Name(Name) {} // constructor that takes a reference to an identifier name (String), and holds it
     llvm::Value *codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
     const std::string &getName() const { return Name; }
 };
 
 // local variable declaration AST nodes
 class VarExprAST : public ExprAST {
     std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames; // supports multiple delcarations...
+    std::vector<std::string> VarTypes; // 'spawn z: complex' => the record of each variable (empty => whatever the initial value is, a number without one)
     std::unique_ptr<ExprAST> Body; // holds a pointer to the body of an expression
 public:
-    VarExprAST(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames, std::unique_ptr<ExprAST> Body) :
+    VarExprAST(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames, std::unique_ptr<ExprAST> Body, std::vector<std::string> VarTypes = {}) :
     VarNames(std::move(VarNames)),
+    VarTypes(std::move(VarTypes)),
     Body(std::move(Body))
     {}
 
     llvm::Value* codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
 };
  
 // binary expressions with an intermediate operator => NEST OTHER EXPRESSIONS!!!
@@ -79,7 +122,15 @@ public:
         LHS(std::move(LHS) /* transfers ownership of the LHS expression to the LHS attribute of BinaryExprAST */), 
         RHS(std::move(RHS)/* equivalent to the prior constructor, but for the expr to the right of the operator*/) 
         {}
+    char getOp() const { return Op; }
+    ExprAST* getLHS() const { return LHS.get(); }
+    ExprAST* getRHS() const { return RHS.get(); }
     llvm::Value *codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
 };
 
 // calling expressions (FUNCTION CALLS)
@@ -88,11 +139,117 @@ class CallExprAST : public ExprAST {
     std::vector<std::unique_ptr<ExprAST>> Args; // a collection of pointers to expressions that represent the argument list for the function itself
 
 public:
-    CallExprAST(const std::string &Callee, std::vector<std::unique_ptr<ExprAST>> Args) : // takes a string with the function name being called, as well as a collection of pointers to arguments (other expressions)
+    CallExprAST(SourceLocation Loc, const std::string &Callee, std::vector<std::unique_ptr<ExprAST>> Args) : // takes a string with the function name being called, as well as a collection of pointers to arguments (other expressions)
+        ExprAST(Loc), // where the call starts (the callee name)
         Callee(Callee), // passes a const reference to the name of the function being called
         Args(std::move(Args)) // transfers ownership of the arguments (expressions) to the Args attribute of CallExprAST
         {}
     llvm::Value *codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
+
+    const std::string& getCallee() const { return Callee; }
+    const std::vector<std::unique_ptr<ExprAST>>& getArgs() const { return Args; }
+};
+
+// field access => z.re, p.pos.x (on a record value), ps.size (the length of a soa collection)
+class FieldExprAST : public ExprAST {
+    std::unique_ptr<ExprAST> Base; // the record (or collection)
+    std::string Field;
+
+public:
+    FieldExprAST(SourceLocation Loc, std::unique_ptr<ExprAST> Base, const std::string &Field) :
+        ExprAST(Loc),
+        Base(std::move(Base)),
+        Field(Field)
+        {}
+    llvm::Value *codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
+
+    ExprAST* getBase() const { return Base.get(); }
+    const std::string& getField() const { return Field; }
+};
+
+// an element of a soa collection => ps[i] (a whole record, or one column with a field access after it)
+class IndexExprAST : public ExprAST {
+    std::unique_ptr<ExprAST> Collection;
+    std::unique_ptr<ExprAST> Index; // truncated to an integer
+
+public:
+    IndexExprAST(SourceLocation Loc, std::unique_ptr<ExprAST> Collection, std::unique_ptr<ExprAST> Index) :
+        ExprAST(Loc),
+        Collection(std::move(Collection)),
+        Index(std::move(Index))
+        {}
+    llvm::Value *codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
+
+    ExprAST* getCollection() const { return Collection.get(); }
+    ExprAST* getIndex() const { return Index.get(); }
+};
+
+// soa particle(n) => a new collection of n zeroed records (only as the initial value of a 'spawn' variable, which owns it)
+class SoaExprAST : public ExprAST {
+    std::string Record;
+    std::unique_ptr<ExprAST> Size;
+
+public:
+    SoaExprAST(SourceLocation Loc, const std::string &Record, std::unique_ptr<ExprAST> Size) :
+        ExprAST(Loc),
+        Record(Record),
+        Size(std::move(Size))
+        {}
+    llvm::Value *codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
+};
+
+// async calls => the arguments are evaluated right away, the call itself is queued on the task runtime and a handle comes back
+class AsyncExprAST : public ExprAST {
+    std::unique_ptr<CallExprAST> Call; // the call to run in the background
+
+public:
+    AsyncExprAST(SourceLocation Loc, std::unique_ptr<CallExprAST> Call) :
+        ExprAST(Loc),
+        Call(std::move(Call))
+        {}
+    llvm::Value *codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
+};
+
+// waits for an async call to finish and evaluates to its result
+class AwaitExprAST : public ExprAST {
+    std::unique_ptr<ExprAST> Handle; // evaluates to a handle returned by async
+
+public:
+    AwaitExprAST(SourceLocation Loc, std::unique_ptr<ExprAST> Handle) :
+        ExprAST(Loc),
+        Handle(std::move(Handle))
+        {}
+    llvm::Value *codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
 };
 
 
@@ -102,13 +259,17 @@ class PrototypeAST {
     std::vector<std::string> Args;
     bool IsOperator; // if the porototype is a user defined operator...
     unsigned Precedence; // precedence if it is a binary operator
+    std::vector<std::string> ArgTypes; // 'def f(z: complex, ps: soa particle)' => the type of each parameter (empty => all numbers, see records.h)
+    std::string ReturnType; // 'def f(...): complex' => the record it returns (empty => a number)
 
 public:
-    PrototypeAST(const std::string &Name, std::vector<std::string> Args, bool IsOperator = false, unsigned Prec = 0) : // takes a string with the name of the function prototype being stored, as well as a collection of pointers to arguments (other expressions)
+    PrototypeAST(const std::string &Name, std::vector<std::string> Args, bool IsOperator = false, unsigned Prec = 0, std::vector<std::string> ArgTypes = {}, std::string ReturnType = "") : // takes a string with the name of the function prototype being stored, as well as a collection of pointers to arguments (other expressions)
         Name(Name), // passes a const reference to the name of the function in the declaration
         Args(std::move(Args)), // transfers ownership of the argument parameter names
         IsOperator(IsOperator), // sets the default of IsOperator to false...
-        Precedence(Prec) // sets the defaul precedence value to 0
+        Precedence(Prec), // sets the defaul precedence value to 0
+        ArgTypes(std::move(ArgTypes)),
+        ReturnType(std::move(ReturnType))
         {}
     
     llvm::Function *codegen();
@@ -123,6 +284,13 @@ public:
     }
 
     unsigned getBinaryPrecedence() const { return Precedence; } // returns the operator precedence (ONLY USE IF BINARY EXPR)
+
+    const std::vector<std::string> &getArgs() const { return Args; } // returns the names of the parameters in declaration order
+    const std::string &getArgType(size_t i) const { static const std::string Number; return ArgTypes.empty() ? Number : ArgTypes[i]; }
+    const std::string &getReturnType() const { return ReturnType; }
+    bool hasRecords() const { // anything but numbers in the signature => only other definitions can call it
+        return !ReturnType.empty() || std::any_of(ArgTypes.begin(), ArgTypes.end(), [](const std::string& Type) { return !Type.empty(); });
+    }
 }; 
 
 
@@ -138,6 +306,8 @@ public:
         {}
     llvm::Function *codegen();
 
+    const PrototypeAST &getProto() const { return *Proto; } // the prototype stays with the definition so the body can be re-expanded later
+    ExprAST *getBody() const { return Body.get(); } // returns the root expression of the function body (used for inline expansion)
 };
 
 class IfExprAST : public ExprAST {
@@ -147,16 +317,33 @@ class IfExprAST : public ExprAST {
 
 public: // constructor transfers ownership of the pointers to the subexpressions into the IfExprAST node
     IfExprAST( 
+        SourceLocation Loc,
         std::unique_ptr<ExprAST> Condition,
         std::unique_ptr<ExprAST> Then,
         std::unique_ptr<ExprAST> Else
     ) :
+    ExprAST(Loc),
     Condition(std::move(Condition)),
     Then(std::move(Then)),
     Else(std::move(Else))
     {}
 
     llvm::Value* codegen() override; // defines a codegen function that we implement elsewhere
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
+};
+
+// optional hints written between the loop header and 'in' => for i = 0, i < n, 1 unroll(8) vectorize(4) interleave(2) in ...
+// they end up as llvm.loop metadata on the latch branch (0 => no hint)
+struct LoopHints {
+    unsigned Unroll = 0; // unroll count (1 => don't unroll)
+    unsigned VectorizeWidth = 0; // vector width (1 => don't vectorize)
+    unsigned Interleave = 0; // interleave count
+
+    bool empty() const { return !Unroll && !VectorizeWidth && !Interleave; }
 };
 
 class ForExprAST : public ExprAST {
@@ -165,23 +352,37 @@ class ForExprAST : public ExprAST {
     std::unique_ptr<ExprAST> End; // end condition of the for loop
     std::unique_ptr<ExprAST> Step; // the for loop step
     std::unique_ptr<ExprAST> Body; // the body of the for loop itself
+    LoopHints Hints; // what the programmer asked the loop optimizers to do
+
+    bool isCountedLoop(double &StartValue, double &StepValue) const; // for i = <integer>, i < <invariant bound>, <positive integer> in ...
+    llvm::Value* codegenCounted(double StartValue, double StepValue); // lowering with an integer induction variable and a trip count llvm can compute
+    llvm::Value* codegenGeneral(); // lowering with a double iterator that tests the condition after every trip (any 'for')
 
 public:
     ForExprAST( // basic constructor that transfers ownership of all of the pointers to important loop constituents to the AST Node
+        SourceLocation Loc,
         const std::string &VarName,
         std::unique_ptr<ExprAST> Start,
         std::unique_ptr<ExprAST> End,
         std::unique_ptr<ExprAST> Step,
-        std::unique_ptr<ExprAST> Body
+        std::unique_ptr<ExprAST> Body,
+        LoopHints Hints = LoopHints()
     ) :
+    ExprAST(Loc),
     VarName(VarName),
     Start(std::move(Start)),
     End(std::move(End)),
     Step(std::move(Step)),
-    Body(std::move(Body))
+    Body(std::move(Body)),
+    Hints(Hints)
     {}
 
     llvm::Value* codegen() override; 
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
 };
 
 class UnaryExprAST : public ExprAST {
@@ -195,6 +396,11 @@ public:
     {}
 
     llvm::Value* codegen() override;
+    void collectCallees(std::set<std::string> &Callees) const override;
+    void canonicalize(std::string &Out) const override;
+    void collectAssigned(std::set<std::string> &Names) const override;
+    bool interpretable(InterpreterCheck &Check) const override;
+    double interpret(InterpreterFrame &Frame) const override;
 };
 
 
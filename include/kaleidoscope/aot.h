@@ -0,0 +1,31 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <memory>
+#include <string>
+
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Module.h"
+
+// AHEAD OF TIME OUTPUT
+// --emit-obj=file.o collects every definition of the script into one module instead of handing them to the jit, then writes it out as an object file
+// --target=<triple> (the host by default), --cpu=<name> and --features=+a,-b pick the machine the object is for => the same codegen output
+// becomes an x86-64 or an AArch64 object, and the function passes already run with that target's costs (vector width, unroll budgets, ...)
+// top level expressions are not evaluated in this mode (they may not even run on this machine), and the object links against a runtime that provides
+// putchard/printd/flushd and kaleidoscope_async/kaleidoscope_await (the kaleidoscope library does)
+// --emit-bc=lib.bc collects the module the same way, but writes it as a bitcode library for 'import' (see library.h)
+
+extern std::string ObjectOutputPath; // empty => jit as usual
+extern std::string BitcodeOutputPath; // empty => no bitcode library
+extern std::string TargetTriple; // empty => the host
+extern std::string TargetCPU; // empty => the host cpu for the host triple, "generic" otherwise
+extern std::string TargetFeatures; // comma separated, e.g. "+neon,-fp-armv8" (added to the host features for the host triple)
+
+inline bool EmittingObject() { return !ObjectOutputPath.empty() || !BitcodeOutputPath.empty(); } // definitions go into one output module instead of the jit
+inline bool EmittingBitcode() { return !BitcodeOutputPath.empty(); }
+
+extern void InitializeObjectTargets(); // registers every backend we link (x86-64, plus AArch64 when llvm was built with it)
+extern llvm::Expected<llvm::orc::JITTargetMachineBuilder> ObjectTargetBuilder(); // describes the machine picked by the options above
+extern bool EmitObjectFile(llvm::Module& M, const std::string& Path); // runs the backend of TheTM over M => false (error reported) on failure
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <cstdint>
+#include <string>
+
+// BATCH EVALUATION => run one compiled function over whole columns of inputs
+// instead of calling the function once per element, the jit builds a wrapper that loops over the arrays,
+// inlines the function body into the loop and lets the loop vectorizer work across elements
+// (in instrumented runs, --profile-generate or --instrument-calls, the loop calls the compiled function instead => every element is counted once)
+
+typedef void (*BatchFunction)(const double* const* Columns, double* Out, uint64_t Count); // Out[i] = F(Columns[0][i], Columns[1][i], ...)
+
+extern BatchFunction GetBatchFunction(const std::string& Name); // jit (or reuse) the batch wrapper for a defined function => nullptr on error
+extern bool CallNative(void* Function, const double* Args, unsigned NumArgs, double& Result); // call a compiled function with a runtime argument count (up to 8 arguments)
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef CALL_STATS_H
+#define CALL_STATS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// CALL INSTRUMENTATION => exact call counts and time per function, for kernels too short or too recursive for the sampler to resolve
+// with --instrument-calls every compiled definition calls kaleidoscope_enter(id) on entry and kaleidoscope_exit(id) before it returns
+// the hooks keep a per thread shadow stack and per thread counters (no atomics shared between threads) of calls,
+// inclusive ticks (outermost activation only, so recursion isn't counted twice) and exclusive ticks (minus the time spent in callees)
+// ticks come from the cycle counter (rdtsc / cntvct_el0) or clock_gettime elsewhere, and are converted to nanoseconds for the report
+// a thread's counters are folded into the totals when it exits, and live threads are summed in on every query
+// => 'stats' at the prompt prints the table, and --instrument-calls=out.json writes it as json at exit
+
+constexpr unsigned MaxInstrumentedFunctions = 4096; // definitions beyond this aren't instrumented (every thread has a counter slot per function)
+
+extern bool InstrumentCalls; // read by codegen
+
+extern void StartCallStats(); // zeroes everything and starts the tick calibration
+extern int CallStatsId(const std::string& Name); // the counter slot for a function (a redefinition keeps its slot) => -1 when out of slots
+
+extern "C" void kaleidoscope_enter(int32_t Id); // called by instrumented code
+extern "C" void kaleidoscope_exit(int32_t Id);
+
+extern void PrintCallStats(FILE* Out); // table sorted by exclusive time
+extern void ShowCallStats(); // what 'stats' does => the table on stderr after the script's output (or a hint when instrumentation is off)
+extern bool WriteCallStatsJSON(const std::string& Path);
+
+#endif
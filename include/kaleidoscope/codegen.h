@@ -1,13 +1,20 @@
 #ifndef CODE_GEN_H
 #define CODE_GEN_H
 
+#include <cmath>
 #include <memory>
 #include <map>
+#include <set>
 #include <string>
 
 #include "parser.h"
 #include "AST.h"
 #include "expression_handler.h"
+#include "profile.h"
+#include "call_stats.h"
+#include "sampler.h"
+#include "tasks.h"
+#include "records.h"
 
 #include "../../external_libs/KaleidoscopeJIT.h"
 
@@ -38,18 +45,27 @@
 #include "llvm/Transforms/Scalar/SimplifyCFG.h"
 #include "llvm/Transforms/Utils.h"
 
-extern std::unique_ptr<llvm::LLVMContext> TheContext; // contains lots of LLVM core structures such as the type and constant tables, etc...
+extern llvm::orc::ThreadSafeContext TheTSC; // owns the context for the whole session (shared with the jit through every module we hand over)
+extern llvm::LLVMContext* TheContext; // contains lots of LLVM core structures such as the type and constant tables, etc...
 extern std::unique_ptr<llvm::IRBuilder<>> Builder; // the actual llvm ir builder (codegenerator)
 extern std::unique_ptr<llvm::Module> TheModule; // top level llvm structure that holds functions and global variables (owns all of the ir (memory-wise))
 extern std::map<std::string, llvm::AllocaInst*> NamedValues; // keeps track of values defined in the current scope...
 // NOTE => THE BUILDER IS ASSUMED TO BE SETUP TO GENERATE CODE INTO SOMETHING => explore further builder configuration options...
 
 extern std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+extern std::map<std::string, std::unique_ptr<FunctionAST>> FunctionDefs; // every successfully compiled definition, kept as an AST template (user defined operators are expanded from here)
 
 llvm::Value *LogErrorV(const char* Str); // error reporting during LLVM code generation
 
 extern llvm::Function* getFunction(std::string Name); // pass back an llvm function pointer based on a name
 
-extern llvm::AllocaInst* CreateEntryBlockAllocation(llvm::Function* TheFunction, llvm::StringRef VarName);
+extern llvm::AllocaInst* CreateEntryBlockAllocation(llvm::Function* TheFunction, llvm::StringRef VarName, llvm::Type* Type = nullptr); // a double unless a type is given (records, collections)
+
+extern bool isMathBuiltin(const std::string& Name); // true if calls to Name lower to an llvm intrinsic (and the user hasn't defined their own)
+
+extern FunctionAST* getInlinableOperator(const std::string& Name); // returns the definition of a user defined operator if its body can be expanded in place
+extern bool CountedLoops; // off => every 'for' takes the general lowering (bench/loop_bench.cpp measures the difference)
+extern void ResetCodegenState(); // forget operators mid expansion and counted loop iterators (a codegen that errored out can leave them behind)
+extern llvm::Value* InlineOperator(FunctionAST& Operator, llvm::ArrayRef<llvm::Value*> Operands); // expands an operator body at the current insertion point
 
 #endif
\ No newline at end of file
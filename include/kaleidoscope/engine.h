@@ -0,0 +1,122 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <cstddef>
+#include <istream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// EMBEDDING API => lets a C++ program host kaleidoscope in process instead of forking ./main for every script
+// create the engine once, load source into it as often as needed, then call the compiled functions directly
+// NOTE => the compiler state is still process wide, so only one Engine may be alive at a time (creating a second one throws std::logic_error)
+
+namespace kaleidoscope {
+
+// options that used to be command line flags of ./main
+struct EngineOptions {
+    std::string Output = "stderr"; // where putchard/printd output goes => "stdout", "stderr" or a file path
+    std::string ProfileGeneratePath; // instrument codegen and write the profile here when the engine is destroyed
+    std::string ProfileUsePath; // optimize with a profile from an earlier instrumented run
+    unsigned ParallelThreads = 0; // when loading scripts, run independent top level expressions on this many worker threads (0 => one after another)
+    unsigned TaskWorkers = 0; // worker threads for async calls (0 => one per core)
+    std::string Tier = "auto"; // how top level expressions run => "auto" (cheap ones are interpreted), "interp" (interpret whatever can be) or "jit" (always compile)
+    bool CacheExpressions = true; // reuse the compiled code of a top level expression that was already evaluated (until something it calls is redefined)
+    bool Specialize = true; // compile a copy of a definition for calls with constant arguments (see specialize.h)
+    bool CheckBounds = true; // check every ps[i] against the size of the soa collection (see records.h)
+    std::string ObjectPath; // compile definitions ahead of time into this object file instead of jitting them (see emitObject)
+    std::string BitcodePath; // collect definitions like ObjectPath does, but write them as a bitcode library for 'import' (see emitBitcode)
+    std::string TargetTriple; // the object's target, e.g. "aarch64-linux-gnu" (empty => the host)
+    std::string TargetCPU; // e.g. "cortex-a72" or "skylake" (empty => host cpu for the host, "generic" when cross compiling)
+    std::string TargetFeatures; // e.g. "+neon" or "+avx2,-fma"
+    bool SampleProfile = false; // sample where the cpu time goes and print a flat profile of the jitted functions when the engine is destroyed
+    std::string SampleStacksPath; // also write the samples there as collapsed stacks (flamegraph.pl input)
+    unsigned SamplesPerSecond = 1000;
+    bool InstrumentCalls = false; // count calls and time every function exactly (entry/exit hooks in every definition), printed when the engine is destroyed
+    std::string CallStatsPath; // also write those numbers as json there
+    std::vector<std::string> Libraries; // shared libraries 'decl' binds native functions from (searched in this order after the builtins)
+    unsigned Executors = 0; // run the jitted code in this many kaleidoscope_executor processes (0 => in this process, see remote.h)
+    std::string ExecutorPath = "kaleidoscope_executor"; // the executor binary
+};
+
+// how much memory the jit's code lives in => live and peak bytes for code, read only data and writable data
+struct JITMemoryStats {
+    size_t LiveCode = 0, PeakCode = 0;
+    size_t LiveROData = 0, PeakROData = 0;
+    size_t LiveRWData = 0, PeakRWData = 0;
+    size_t Mapped = 0; // total size of the slabs mapped from the os
+    size_t NumSlabs = 0;
+};
+
+// every kaleidoscope value is a double, so a usable function pointer type is double(*)(double, ...)
+template <typename FnT> struct KaleidoscopeSignature {
+    static constexpr bool Valid = false;
+};
+
+template <typename... ArgTs> struct KaleidoscopeSignature<double (*)(ArgTs...)> {
+    static constexpr bool Valid = (std::is_same<ArgTs, double>::value && ...);
+    static constexpr unsigned NumArgs = sizeof...(ArgTs);
+};
+
+class Engine {
+public:
+    explicit Engine(const EngineOptions& Options = EngineOptions()); // initializes llvm, the jit and the builtin operators
+    ~Engine(); // flushes output, writes the profile (if instrumenting) and tears the jit down
+
+    bool ok() const { return Ok; } // false if an option couldn't be applied (an output that can't be opened, an unknown tier, an unreadable profile)
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    bool loadSource(const std::string& Source); // compile (and run the top level expressions of) a chunk of kaleidoscope => false if any errors were reported
+    bool loadFile(const std::string& Path); // same, but read from a file
+    bool loadStream(std::istream& Stream); // same, but read until the end of a stream (std::cin gives the interactive prompt)
+    bool watchFile(const std::string& Path); // load a file, then reload only what changed every time it is saved, until Ctrl-C
+
+    // look up a compiled function as a typed function pointer => lookup<double (*)(double, double)>("foo")
+    // returns nullptr if the function does not exist or takes a different number of arguments (or lives in an executor)
+    template <typename FnT> FnT lookup(const std::string& Name) {
+        static_assert(KaleidoscopeSignature<FnT>::Valid, "kaleidoscope functions only take and return doubles");
+        return reinterpret_cast<FnT>(lookupAddress(Name, KaleidoscopeSignature<FnT>::NumArgs));
+    }
+
+    // make a host function callable from kaleidoscope under Name (no 'decl' needed in the script)
+    template <typename FnT> bool registerCallback(const std::string& Name, FnT Callback) {
+        static_assert(KaleidoscopeSignature<FnT>::Valid, "callbacks must take and return doubles");
+        return registerCallbackAddress(Name, reinterpret_cast<void*>(Callback), KaleidoscopeSignature<FnT>::NumArgs);
+    }
+
+    // open a shared library for later 'decl's to bind against (searched after the builtins and the libraries loaded before it)
+    bool loadLibrary(const std::string& Path);
+
+    // evaluate a defined function over columns of inputs => Out[i] = Name(Columns[0][i], Columns[1][i], ...)
+    // evaluateBatch jits a vectorized loop around the inlined function body (compiled once, reused until the function is redefined)
+    // evaluateEach calls the ordinary compiled function once per element (the baseline to compare against)
+    bool evaluateBatch(const std::string& Name, const std::vector<const double*>& Columns, double* Out, size_t Count);
+    bool evaluateEach(const std::string& Name, const std::vector<const double*>& Columns, double* Out, size_t Count);
+
+    void dumpModule(); // print the module that is currently being built to stderr
+
+    void printCallStats(); // the --instrument-calls table so far (what 'stats' prints)
+
+    bool emitObject(); // write everything loaded so far to Options.ObjectPath => false if there is no object path or writing failed
+    bool emitBitcode(); // same for Options.BitcodePath
+
+    bool importLibrary(const std::string& Path); // what 'import "path"' does => false if the library couldn't be imported
+
+    int serve(const std::string& SocketPath); // become a compile server for everything loaded so far (see server.h) => returns when stopped
+
+    JITMemoryStats getJITMemoryStats() const;
+    void printJITMemoryStats(); // a small table of getJITMemoryStats() on stderr
+
+private:
+    void* lookupAddress(const std::string& Name, unsigned NumArgs);
+    bool registerCallbackAddress(const std::string& Name, void* Address, unsigned NumArgs);
+
+    EngineOptions Options;
+    bool Ok = true;
+};
+
+} // namespace kaleidoscope
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef EXPRESSION_HANDLER_H
 #define EXPRESSION_HANDLER_H
 
+#include <algorithm>
+#include <deque>
 #include <iostream>
 
 #include "../../external_libs/KaleidoscopeJIT.h"
@@ -8,11 +10,15 @@
 #include "lexer.h"
 #include "parser.h"
 #include "codegen.h"
+#include "runtime_io.h"
+#include "aot.h"
 
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
@@ -25,13 +31,22 @@
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/StandardInstrumentations.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Transforms/InstCombine/InstCombine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Scalar/IndVarSimplify.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/Transforms/Scalar/LoopRotation.h"
+#include "llvm/Transforms/Scalar/LoopUnrollPass.h"
 #include "llvm/Transforms/Scalar/Reassociate.h"
 #include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Transforms/Scalar/SROA.h"
+#include "llvm/Transforms/Scalar/WarnMissedTransforms.h"
 #include "llvm/Transforms/Utils.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
+#include "llvm/Transforms/Vectorize/LoopVectorize.h"
 
 extern std::unique_ptr<llvm::orc::KaleidoscopeJIT> TheJIT;
 extern llvm::ExitOnError ExitOnErr;
@@ -43,11 +58,29 @@ extern std::unique_ptr<llvm::CGSCCAnalysisManager> TheCGAM;
 extern std::unique_ptr<llvm::ModuleAnalysisManager> TheMAM;
 extern std::unique_ptr<llvm::PassInstrumentationCallbacks> ThePIC;
 extern std::unique_ptr<llvm::StandardInstrumentations> TheSI;
+extern std::unique_ptr<llvm::TargetMachine> TheTM; // the host target (or the target of --emit-obj), shared by every pass pipeline
 
-extern void InitializeModuleAndManagers(void);
+extern unsigned ParallelThreads; // script mode worker threads for independent top level expressions (0 => run them one after another)
+
+extern bool CacheTopLevelExpressions; // keep compiled top level expressions around and reuse them when the same expression comes back
+extern std::map<std::string, unsigned> FunctionVersions; // bumped every time a name gets a new definition or declaration
+
+extern std::set<std::string> ReachableFunctions(const ExprAST& Expr); // everything Expr can end up calling, through the stored definitions
+extern void NoteFunctionChanged(const std::string& Name); // bump the version of Name and evict cached expressions that can reach it
+extern void ClearExpressionCache(); // free the code of every cached expression
+extern void DropExpressionCache(); // forget every cached expression without freeing its code (the executor it lived in is gone)
+
+extern void InitializeSession(void); // creates the long lived context, builder and pass/analysis managers (then the first module)
+extern void InitializeModule(void); // opens a new module in the session for the next unit
 extern void HandleDefinition();
 extern void HandleDecl();
+extern void HandleImport(); // import "lib.bc"
+extern void HandleRecord(); // record name(fields)
 extern void HandleTopLevelExpression();
+extern std::string TopLevelExpressionName(); // the function name the next top level expression should be parsed under
+extern void EvaluateTopLevelExpression(std::unique_ptr<FunctionAST> FnAST); // compile (or fetch from the cache), run and report a parsed top level expression
+extern void QueueTopLevelExpression(); // parallel script mode => compile now, run later in FlushPendingExpressions
+extern void FlushPendingExpressions(); // run the queued expressions (independent ones concurrently) and report them in source order
 extern void MainLoop();
 
 
@@ -0,0 +1,49 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+class FunctionAST;
+
+// INTERPRETER TIER => a top level expression that runs once doesn't need machine code
+// jitting printd(foo(4, 2)); means a module, the function passes, instruction selection and linking for a tree that is evaluated once and freed
+// instead the tree is walked directly => literals, variables, spawn, if, for, the builtin operators and the math builtins are evaluated here,
+// user operators are expanded from their stored definitions (like codegen does), and every other call goes to the jitted (native) function
+// --tier=auto (the default) interprets expressions without loops, async/await or self expanding operators, so the walk is bounded by the size of the tree
+// (and leaves literal calls into loops, like mandel(-2.3, -1.3, 0.05, 0.07), to the jit, which specializes them)
+// --tier=interp interprets everything it can (only async/await still needs the jit), --tier=jit always compiles
+
+enum class ExecutionTier { Auto, Interpreter, JIT };
+
+extern ExecutionTier TopLevelTier;
+extern bool ParseExecutionTier(const std::string& Name, ExecutionTier& Tier); // "auto", "interp" or "jit" => false for anything else
+
+constexpr unsigned MaxInterpretedArgs = 16; // calls with more arguments than this go through the jit
+
+// what ExprAST::interpretable() learns about an expression on the way
+struct InterpreterCheck {
+    std::vector<std::string> Scope; // variables visible at this point
+    std::set<std::string> Expanding; // operators being looked into (recursion guard)
+    bool Loops = false; // a for loop (directly or inside an operator it expands)
+    bool Recursive = false; // an operator that expands itself
+    bool Specializes = false; // a call with literal arguments that codegen would compile a specialized copy for (see specialize.h)
+};
+
+// the variables of one activation => the expression itself, or an expanded operator (which only sees its parameters)
+struct InterpreterFrame {
+    std::vector<std::pair<std::string, double>> Variables; // innermost last, so shadowing is a search from the back
+    bool Failed = false; // a callee couldn't be found (error reported) => the result means nothing
+
+    double* lookup(const std::string& Name);
+};
+
+extern double CallNativeFunction(const std::string& Name, const std::vector<double>& Args, InterpreterFrame& Frame); // the jitted function (or native symbol) Name
+
+extern bool ShouldInterpret(const FunctionAST& Expression); // the tier decision for a parsed top level expression
+extern bool InterpretTopLevelExpression(const FunctionAST& Expression, double& Result); // false (error reported) if something it calls couldn't be found
+extern void ResetInterpreter(); // forget the cached callee addresses (they belong to the jit session)
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef JIT_MEMORY_H
+#define JIT_MEMORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/Support/Alignment.h"
+#include "llvm/Support/Memory.h"
+
+// JIT MEMORY => every object the jit links used to get its own SectionMemoryManager, so each evaluated expression mapped (and later unmapped) its own pages
+// now all objects are carved out of a few large slabs owned by one pool:
+//   => code and read only data are handed out in whole pages (they get their final permissions per object, so they can't share a page with another object)
+//   => writable data never changes permissions, so it is packed at a 16 byte granularity
+//   => memory freed by ResourceTracker::remove() goes back on the pool's free list and is reused first fit, lowest address first,
+//      which keeps live code packed at the start of the code slabs (fewer pages => fewer iTLB misses)
+
+enum class JITMemoryKind { Code, ROData, RWData };
+constexpr unsigned NumJITMemoryKinds = 3;
+
+struct JITMemoryUsage {
+    size_t Live[NumJITMemoryKinds] = {}; // bytes currently handed out, per kind
+    size_t Peak[NumJITMemoryKinds] = {}; // high water mark of Live, per kind
+    size_t Mapped = 0; // bytes of slabs mapped from the os (never given back before the jit goes away)
+    size_t NumSlabs = 0;
+};
+
+class JITMemoryPool {
+public:
+    JITMemoryPool();
+    ~JITMemoryPool(); // unmaps every slab
+
+    llvm::sys::MemoryBlock allocate(JITMemoryKind Kind, size_t Size, size_t Alignment); // returns writable memory (an empty block if the os is out of memory)
+    void release(JITMemoryKind Kind, llvm::sys::MemoryBlock Block); // make the block writable again and put it back on the free list
+
+    JITMemoryUsage getUsage() const;
+
+private:
+    struct Arena {
+        std::map<uintptr_t, size_t> Free; // start address => size, coalesced with its neighbours on release
+        size_t Granule; // every block is a multiple of this
+    };
+
+    bool grow(Arena& A, size_t MinSize); // map another slab into the arena
+
+    mutable std::mutex Mutex; // objects may be linked on any of the jit's threads
+    Arena Arenas[NumJITMemoryKinds];
+    std::vector<llvm::sys::MemoryBlock> Slabs;
+    JITMemoryUsage Usage;
+    size_t PageSize;
+};
+
+// the per object memory manager RuntimeDyld asks for sections => lives as long as the object is linked in
+// it reserves one block per kind up front (RuntimeDyld tells us the totals) and hands the sections out of those
+class SlabMemoryManager : public llvm::RTDyldMemoryManager {
+public:
+    explicit SlabMemoryManager(std::shared_ptr<JITMemoryPool> Pool) : Pool(std::move(Pool)) {}
+    ~SlabMemoryManager() override; // gives every block back to the pool
+
+    bool needsToReserveAllocationSpace() override { return true; }
+    void reserveAllocationSpace(uintptr_t CodeSize, llvm::Align CodeAlign, uintptr_t RODataSize, llvm::Align RODataAlign, uintptr_t RWDataSize, llvm::Align RWDataAlign) override;
+
+    uint8_t* allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID, llvm::StringRef SectionName) override;
+    uint8_t* allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID, llvm::StringRef SectionName, bool IsReadOnly) override;
+
+    bool finalizeMemory(std::string* ErrMsg = nullptr) override; // code => read/execute, read only data => read only
+
+private:
+    struct Reservation {
+        llvm::sys::MemoryBlock Block;
+        size_t Used = 0;
+    };
+
+    uint8_t* allocateSection(JITMemoryKind Kind, uintptr_t Size, unsigned Alignment);
+
+    std::shared_ptr<JITMemoryPool> Pool;
+    Reservation Reserved[NumJITMemoryKinds];
+    std::vector<std::pair<JITMemoryKind, llvm::sys::MemoryBlock>> Blocks; // everything we got from the pool (reservations and overflow)
+};
+
+#endif
@@ -33,13 +33,54 @@ enum Token { // defines the different types of tokens the lexer can return as an
 
     tok_var = -15, // variable tokens
     tok_endspawn = -16, // end spawn
+
+    // tasks
+    tok_async = -17, // async f(args) => start a call on the task runtime
+    tok_await = -18, // await h => wait for the result of an async call
+
+    // libraries
+    tok_import = -19, // import "lib.bc" => load a library written by --emit-bc
+    tok_string = -20, // "text" => the text between the quotes goes into IdentifierStr
+
+    // records
+    tok_record = -21, // record name(field, field: type) => a value type with named fields
+    tok_soa = -22, // soa name(n) => a collection of n records stored field by field
     // ADD MORE HERE LIKE STRINGS, ETC...
 }; // returns unknown tokens as their ASCII values
 
+// where a token starts in the source => used to key profiles (and diagnostics) by line and column
+struct SourceLocation {
+    int Line; // 1 based line number
+    int Col; // column within that line
+};
+
+extern SourceLocation CurLoc; // location of the current token
+extern SourceLocation LexLoc; // location of the lexer itself (one character ahead of the last token)
+extern size_t CurOffset; // byte offset of the current token in the stream => lets --watch cut the source into the text of each definition
+
 extern std::string IdentifierStr; // utilized if we get an identifier (ALWAYS A STRING) => when tok_identifier is used, this is where we store the data
 extern double NumVal; // utilized for the value stored in a particular identifier => tok_number in the case of kaleidoscope, but is expandable
 
+extern bool RecordSource; // keep every character read since ResetLexer in RecordedSource => --emit-bc stores the text of each definition
+extern std::string RecordedSource;
+
 int gettok(); // declares the tokenizer function
+void ResetLexer(); // call after pointing input at a new stream
+
+// everything the lexer carries from one token to the next => lets 'import' lex another source in the middle of a script and then carry on
+struct LexerState {
+    std::istream* Input;
+    int LastChar;
+    size_t LexOffset;
+    size_t CurOffset;
+    SourceLocation CurLoc, LexLoc;
+    std::string IdentifierStr;
+    double NumVal;
+    std::string RecordedSource;
+};
+
+LexerState SaveLexer();
+void RestoreLexer(LexerState&& State);
 
 #endif
 
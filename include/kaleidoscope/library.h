@@ -0,0 +1,28 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Module.h"
+
+// PRECOMPILED LIBRARIES => a prelude of operators and helpers is compiled and optimized once instead of in every script that uses it
+// --emit-bc=lib.bc collects the script's definitions into one module (like --emit-obj, with the usual function passes) and writes it as bitcode,
+// together with the source text of every def and decl (named metadata "kaleidoscope.source")
+// import "lib.bc" hands that code to the jit as it is (nothing is compiled again), then parses (but doesn't compile) the stored source
+// => the prototypes and operator precedences are back for the importing script, and so are the definitions,
+// which is what lets user defined operators from the library be expanded at their use sites like any other operator
+// (only operators => a plain function of the library is called across modules, the function passes have no inliner that could use a copy of its body)
+// while emitting an object or bitcode file, an import is linked into the output module instead (llvm-link style)
+
+extern void RecordLibraryUnit(size_t Start); // bitcode mode => stores the source from offset Start up to the current token with the module
+extern bool EmitBitcodeFile(llvm::Module& M, const std::string& Path); // false (error reported) if it can't be written
+extern bool ImportLibrary(const std::string& Path); // false (error reported) if it can't be read, is for another architecture or redefines something
+extern void ResetImports(); // forget which libraries were imported
+extern bool IsImportedDefinition(const std::string& Name); // its code came with an import (and it hasn't been redefined since)
+extern std::vector<std::unique_ptr<llvm::Module>> ReloadImports(); // the imported code again, read from the kept bitcode => for a restarted executor
+                                                                  // (a definition redefined since the import is left as a declaration)
+
+#endif
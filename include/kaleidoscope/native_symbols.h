@@ -0,0 +1,23 @@
+#ifndef NATIVE_SYMBOLS_H
+#define NATIVE_SYMBOLS_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// NATIVE SYMBOLS => the only native code jitted kaleidoscope can call into
+// the jit no longer searches the whole process with dlsym => every native name is defined explicitly as an absolute symbol:
+// the runtime builtins (putchard, printd, flushd, the task and call stats hooks), the libm/libc functions codegen lowers intrinsics to,
+// host callbacks (Engine::registerCallback), and whatever a 'decl' binds from a library loaded with --load
+// a 'decl' is bound eagerly => the builtins first, then the loaded libraries in load order, and the result is cached
+// native symbols live in their own JITDylib behind the main one, so a kaleidoscope 'def' of the same name shadows them
+// with --executors the same table lives in every executor (see remote.h) => libraries are opened and decls bound there instead
+
+extern std::vector<std::pair<std::string, void*>> BuiltinSymbols(); // the builtin table plus the platform helpers this process has (what an executor exports)
+extern void RegisterBuiltinSymbols(); // defines the whole builtin table in the jit (after it is created)
+extern bool LoadNativeLibrary(const std::string& Path); // opens a shared library for 'decl' to bind against => false (error reported) if it can't be opened
+extern bool DefineNativeSymbol(const std::string& Name, void* Address); // a host function under Name => false (error reported) if Name is already bound elsewhere
+extern bool BindNativeSymbol(const std::string& Name); // what 'decl Name' does => true if a builtin or a loaded library provides Name
+extern void ResetNativeSymbols(); // forgets every binding and closes the libraries (after the jit is gone)
+
+#endif
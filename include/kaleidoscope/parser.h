@@ -5,6 +5,7 @@
 #include <map>
 #include "AST.h"
 #include "lexer.h"
+#include "records.h"
 
 
 // NOTE => NULLPTR RETURNED ON ERRORS IN THE PARSER!!!
@@ -13,8 +14,10 @@ extern int CurTok; // a buffer to hold the current toen being evaluated
 int getNextToken(); // get the next token in the stream
 
 // ERROR HELPER FUNCTIONS
+extern unsigned NumErrors; // running count of reported errors (parse and codegen)
 extern std::unique_ptr<ExprAST> LogError(const char* Str); // logs an error for expressions
 extern std::unique_ptr<PrototypeAST> LogErrorP(const char* Str); // logs an error for function declarations
+extern void LogWarning(const char* Str); // reports something worth knowing that doesn't stop compilation
 
 // numeric expression parser declaration
 extern std::unique_ptr<ExprAST> ParseNumberExpr();
@@ -28,9 +31,18 @@ extern std::unique_ptr<ExprAST> ParseIdentifierExpr();
 // evaluation of local variable declarations
 extern std::unique_ptr<ExprAST> ParseVarExpr();
 
+// evaluation of async calls and awaiting them
+extern std::unique_ptr<ExprAST> ParseAsyncExpr(); // async f(args)
+extern std::unique_ptr<ExprAST> ParseAwaitExpr(); // await h
+
 // helper function that parses the above three types of expressions (primary expressions)
 extern std::unique_ptr<ExprAST> ParsePrimary();
 
+// records and soa collections (see records.h)
+extern std::unique_ptr<ExprAST> ParseSoaExpr(); // soa name(n)
+extern std::unique_ptr<ExprAST> ParsePostfix(std::unique_ptr<ExprAST> Base); // .field and [index] after a primary expression
+extern std::unique_ptr<RecordDeclaration> ParseRecord(); // record name(field, field: type)
+
 
 // PARSING BINARY EXPRESSIONS (INFIX)
 
@@ -56,7 +68,7 @@ extern std::unique_ptr<ExprAST> ParseForExpr(); // allows us to parse for loop e
 
 extern std::unique_ptr<ExprAST> ParseUnaryExpr(); // parsing of user defined unary expressions
 
-extern std::unique_ptr<FunctionAST> ParseTopLevelExpr(); // allows us to create functions without declaring them (lambdas??)
+extern std::unique_ptr<FunctionAST> ParseTopLevelExpr(const std::string& Name = "__anon_expr"); // allows us to create functions without declaring them (lambdas??)
 
 // FULLY PARSING EXPRESSIONS
 extern std::unique_ptr<ExprAST> ParseExpression(); // the function where we start to parse an expression (can be infinitely recursive)
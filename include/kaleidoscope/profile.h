@@ -0,0 +1,32 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <string>
+
+#include "lexer.h"
+
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+
+// PROFILE GUIDED OPTIMIZATION
+// an instrumented run (--profile-generate=file) counts function entries, if branches, for loop trip counts and call sites,
+// keyed by the enclosing function name and the source location, and writes them out at exit
+// a later run (--profile-use=file) reads them back and codegen attaches branch weights, entry counts and hot/cold attributes
+
+extern std::string ProfileGeneratePath; // where the counters are written at exit (empty => no instrumentation)
+extern std::string ProfileUsePath; // the profile that was loaded (empty => no profile data)
+
+extern bool ReadProfile(const std::string& Path); // load a profile for codegen to use
+extern bool WriteProfile(const std::string& Path); // dump the counters of the instrumented run
+extern void ResetProfile(); // drop the loaded profile and the counters (only once no jitted code can increment them anymore)
+
+// every site has two counters => entry: {calls, unused}, if: {then, else}, for: {entries, iterations}, call: {executions, unused}
+extern uint64_t* ProfileCountersFor(const char* Kind, llvm::Function* F, SourceLocation Loc); // counters to increment, or nullptr when not instrumenting
+extern const uint64_t* ProfileCountsFor(const char* Kind, llvm::Function* F, SourceLocation Loc); // counts from the loaded profile, or nullptr
+
+extern void EmitProfileIncrement(uint64_t* Counter); // emits an atomic increment of the counter at the builder's insertion point
+extern llvm::MDNode* CreateProfileWeights(uint64_t Taken, uint64_t NotTaken); // branch weight metadata for a conditional branch
+extern void ApplyFunctionProfile(llvm::Function* F); // entry count plus hot/cold attribute from the loaded profile
+
+#endif
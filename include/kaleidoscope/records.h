@@ -0,0 +1,54 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/DerivedTypes.h"
+
+// RECORDS => 'record complex(re, im)' declares a value type with named fields (numbers, or records: record particle(pos: vec, vel: vec))
+// a record value is an llvm struct => built with complex(1, 2), read with z.re, assigned with z.re = 3 (or z = w), and passed to and
+// returned from definitions by value (def add(a: complex, b: complex): complex ...), which the backend does in registers where it can
+// SOA COLLECTIONS => 'spawn ps = soa particle(n) endspawn ...' allocates n records stored field by field: every number of the record
+// gets a contiguous, 64 byte aligned column, so a loop over ps[i].pos.x walks one array (and can be vectorized)
+// ps[i] reads or assigns a whole record, ps[i].pos.x one column, ps.size is n => like any 'for', 'for i = 0, i < ps.size - 1' also runs
+// the trip that ends it, so that is the loop over every element (every ps[i] is checked against ps.size, unless --no-bounds-check)
+// the 'spawn' that creates a collection owns it and frees it when its scope ends => a collection can be passed to definitions
+// (def step(ps: soa particle) ...), but not returned, assigned, or kept in a record
+// records only exist between definitions => top level expressions, async calls, the interpreter and the host api still see numbers only
+
+struct RecordField {
+    std::string Name;
+    std::string Type; // a record name (empty => a number)
+};
+
+struct RecordDeclaration {
+    std::string Name;
+    std::vector<RecordField> Fields;
+};
+
+struct RecordType {
+    RecordDeclaration Declaration;
+    llvm::StructType* Struct = nullptr; // a value => one element per field
+    llvm::StructType* Soa = nullptr; // a collection => { i64 size, ptr column... }, one column per number of the record
+    std::vector<std::vector<unsigned>> Leaves; // the field index path of every number in the record (nested records flattened, in field order)
+};
+
+extern std::map<std::string, RecordType> Records;
+extern bool CheckBounds; // ps[i] reports an index outside the collection and aborts => off with --no-bounds-check
+
+extern bool DefineRecord(const RecordDeclaration& Declaration); // false (error reported) for unknown field types or a conflicting redefinition
+extern llvm::Type* ResolveType(const std::string& Type); // "" => double, "name" => the record, "soa name" => its collection (nullptr, error reported, if unknown)
+extern const RecordType* RecordOf(llvm::Type* Type); // the record of a value or collection type (nullptr for numbers)
+extern bool IsCollection(llvm::Type* Type);
+extern std::string TypeName(llvm::Type* Type); // "number", "complex" or "soa complex" => for error messages
+extern unsigned FirstLeaf(const RecordType& Record, const std::vector<unsigned>& Path); // the column of the first number at (or under) a field path
+extern void ResetRecords(); // the types belong to the session's context
+
+extern "C" void* kaleidoscope_soa_alloc(int64_t Bytes); // called by jitted code for 'soa' => zeroed, 64 byte aligned
+extern "C" void kaleidoscope_soa_free(void* Block); // ... and when the owning 'spawn' ends
+extern "C" void kaleidoscope_soa_out_of_bounds(int64_t Index, int64_t Size); // the failed bounds check => reports the bad index and aborts
+
+#endif
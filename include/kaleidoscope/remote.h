@@ -0,0 +1,44 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <memory>
+#include <string>
+
+#include "../../external_libs/KaleidoscopeJIT.h"
+#include "llvm/ExecutionEngine/Orc/Shared/SimplePackedSerialization.h"
+
+// REMOTE EXECUTION => --executors=N runs the jitted code in N kaleidoscope_executor processes instead of in the compiler
+// every executor is a child connected over a pair of pipes (orc's SimpleRemoteEPC on our side, SimpleRemoteEPCServer on its side)
+// and has its own jit session => every definition goes to all of them, a top level expression to one (round robin in --parallel mode)
+// a script that crashes only takes its executor down => the expression reports an error, and the executor is restarted
+// with the session replayed into it (imported libraries from their bitcode, every other definition from the stored ASTs), so it carries on where it was
+// the runtime (putchard/printd, async, libm) lives in the executor too, and 'decl' binds from --load libraries opened in each executor
+
+extern std::string ExecutorPath; // the kaleidoscope_executor binary
+extern unsigned NumExecutors; // 0 => jitted code runs in this process
+extern std::string ExecutorOutput; // "stdout" or "stderr" => where output of async tasks goes (an expression's own output is sent back and printed here)
+
+// what the executor exports for running a top level expression => its address in, the result (as bits) and everything it printed out
+using RunExpressionSignature = llvm::orc::shared::SPSTuple<uint64_t, llvm::orc::shared::SPSString>(llvm::orc::shared::SPSExecutorAddr);
+constexpr const char* RunExpressionSymbol = "kaleidoscope_run_expression";
+constexpr const char* NativeSymbolPrefix = "kaleidoscope.native."; // executor bootstrap symbols under this prefix are its builtins
+
+inline bool RemoteExecution() {
+    return NumExecutors > 0;
+}
+
+extern bool StartExecutors(); // spawns NumExecutors executors => TheJIT becomes executor 0's jit (false, error reported, if one couldn't start)
+extern void StopExecutors(); // disconnects and reaps them (the jits are gone afterwards)
+
+extern llvm::orc::KaleidoscopeJIT& ExecutorJIT(unsigned Executor); // executor 0's is TheJIT (the local jit without executors)
+extern unsigned NextExecutor(); // round robin over the live executors (0 without executors)
+extern bool ExecutorAlive(unsigned Executor);
+
+extern void AddDefinitionModule(std::unique_ptr<llvm::Module> M); // every executor gets the definition (executor 0 this module, the others a copy)
+extern bool RunExpression(unsigned Executor, llvm::orc::ExecutorAddr Address, double& Result); // run a compiled top level expression there => false (error reported) if the executor died
+extern void RestartDeadExecutors(); // respawn crashed executors and replay the session into them (between statements only)
+
+extern bool LoadRemoteLibrary(const std::string& Path); // --load in every executor
+extern bool BindRemoteSymbol(const std::string& Name); // 'decl Name' => the builtins first, then the loaded libraries in load order
+
+#endif
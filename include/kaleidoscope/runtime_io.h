@@ -0,0 +1,24 @@
+#ifndef RUNTIME_IO_H
+#define RUNTIME_IO_H
+
+#include <cstddef>
+#include <string>
+
+// RUNTIME OUTPUT => everything the jit compiled code prints (putchard, printd) goes through here
+// each thread gets its own large buffer, which is only written out when it fills up, on an explicit flush, or at exit
+// so an output heavy script like mandelbrot.k issues a handful of write syscalls instead of one per character
+
+extern bool SetRuntimeOutput(const std::string& Target); // select where output goes => "stdout", "stderr" (default) or a file path
+extern void RuntimeWrite(const char* Data, size_t Size); // append bytes to the calling thread's buffer
+extern void RuntimeFlush(); // write out the calling thread's buffer
+
+// capturing => while active, everything the calling thread prints is appended to Capture instead of being buffered for output
+// (lets independent expressions run on worker threads while their output is still presented in source order)
+extern void BeginOutputCapture(std::string* Capture);
+extern void EndOutputCapture();
+extern std::string* CurrentOutputCapture(); // the capture the calling thread writes into (nullptr => its buffer)
+
+extern size_t FormatDouble(double X, char* Out); // formats X like "%f" but without locale lookups (Out needs room for RuntimeDoubleChars)
+constexpr size_t RuntimeDoubleChars = 352; // enough for the largest finite double in fixed notation with 6 decimals
+
+#endif
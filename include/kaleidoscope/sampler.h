@@ -0,0 +1,26 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdio>
+#include <string>
+
+#include "llvm/ExecutionEngine/JITEventListener.h"
+
+// SAMPLING PROFILER => --profile answers "which kaleidoscope function is my script spending its time in"
+// a SIGPROF timer interrupts the process every few hundred microseconds of cpu time, and the handler records the interrupted pc plus the return
+// addresses along the frame pointer chain (jitted functions keep their frame pointers while this runs) into a preallocated buffer
+// the jit reports the address range of every function it loads or frees through a JITEventListener, tagged with an epoch,
+// so at exit every sampled address is mapped to the function that lived there at that moment (slab memory gets reused)
+// => a flat profile (self/total per function) on stderr, and optionally collapsed stacks for flamegraph.pl
+// nothing of this is set up unless profiling was asked for => no overhead otherwise
+
+extern bool StartSampler(unsigned SamplesPerSecond); // installs the handler and starts the timer => false (error reported) where unsupported
+extern void StopSampler(); // stops the timer (the samples stay around for the report)
+extern bool SamplerRunning();
+
+extern llvm::JITEventListener& SamplerSymbolListener(); // register with the jit's object layer so the report can name jitted code
+
+extern void PrintFlatProfile(FILE* Out); // functions by self time, with their total (inclusive) time
+extern bool WriteCollapsedStacks(const std::string& Path); // "outer;inner;leaf count" per distinct stack
+
+#endif
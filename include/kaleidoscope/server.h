@@ -0,0 +1,21 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+
+namespace kaleidoscope {
+class Engine;
+}
+
+// COMPILE SERVER => --serve=/path/to.sock keeps one warm process around for job runners that start thousands of short scripts
+// llvm's targets, the jit session and the definitions of a prelude script (looked up once, so they are machine code already) are set up a single time,
+// then every submitted script runs in a child forked from that warm state => its own copy of the session, so nothing one script defines
+// is visible to another (or to the daemon), and clients are served concurrently
+// the client passes its own stdout and stderr over the unix socket (SCM_RIGHTS), so output streams straight to it, then gets a status byte back
+// every request's latency (accept to finished) is recorded => percentiles on --client --stats and when the daemon stops (Ctrl-C)
+
+extern int ServeScripts(kaleidoscope::Engine& Engine, const std::string& SocketPath); // runs until SIGINT/SIGTERM => exit code
+extern int SubmitScript(const std::string& SocketPath, const std::string& ScriptPath); // the thin client => the script's exit code (1 on errors)
+extern int RequestServerStats(const std::string& SocketPath); // prints the daemon's latency percentiles
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SPECIALIZE_H
+#define SPECIALIZE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Value.h"
+
+// SPECIALIZATION ON CONSTANT ARGUMENTS => mandel(-2.3, -1.3, 0.05, 0.07) used to call the generic mandel, which passes the same values
+// down to mandelhelp on every call, so nothing about them was ever known to the optimizer
+// now a call whose arguments fold to constants (literals, or values computed from them) gets its own copy of the definition,
+// compiled with those parameters fixed => loop bounds and steps become constants (a counted loop with a constant trip count unrolls
+// and vectorizes), calls in the body with constant arguments are specialized in turn, and the call itself passes only the rest
+// copies are cached by (function, constants, the version of every function it can reach), and only made for definitions that can reach a loop
+
+extern bool SpecializeCalls; // off with --no-specialize (and while --watch reloads definitions through stubs)
+extern std::map<llvm::AllocaInst*, double> ConstantSlots; // parameters of the copy being compiled that hold a constant (never assigned in its body)
+
+extern bool ShouldSpecialize(const std::string& Callee); // a definition (not an operator) that can reach a loop => calls with constants get a copy
+extern llvm::Function* SpecializeCall(const std::string& Callee, std::vector<llvm::Value*>& Args); // the copy for these arguments (the constant ones are removed from Args) => nullptr for a normal call
+extern void ClearSpecializations(); // forget every copy (an executor restarted without them, or the session is over)
+
+#endif
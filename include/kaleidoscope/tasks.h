@@ -0,0 +1,22 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <cstdint>
+
+// ASYNC TASKS => 'async f(a, b)' queues a call to f and immediately returns a handle, 'await h' waits for it and returns its result
+// the calls run on a work stealing scheduler => every worker owns a deque, pushes and pops its own tasks at the back (newest first, good for recursion like fib)
+// and steals from the front of the other deques when it runs dry; a thread that awaits an unfinished task runs other tasks in the meantime instead of blocking
+// handles are plain doubles (ids into a table of unawaited tasks), each one is awaited once (that frees the task) => an unknown or already
+// awaited handle is reported and evaluates to NaN
+// what a task prints is kept with it and written out by 'await', as part of the awaiting thread's output (a task that is never awaited prints nothing)
+
+constexpr unsigned MaxTaskArgs = 8; // the most arguments an async call can pass (same limit as CallNative)
+
+extern unsigned TaskWorkers; // worker threads of the scheduler (0 => one per core), read when the first task is queued
+
+extern "C" double kaleidoscope_async(void* Function, const double* Args, int32_t NumArgs); // called by jitted code for 'async'
+extern "C" double kaleidoscope_await(double Handle); // called by jitted code for 'await'
+
+extern void StopTaskRuntime(); // joins the workers (tasks that were never awaited are dropped)
+
+#endif
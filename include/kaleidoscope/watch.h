@@ -0,0 +1,16 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <string>
+
+// WATCH MODE => --watch keeps the jit session alive and reloads the script every time it is saved
+// every top level unit is cut out of the source by its token offsets and hashed (comments and whitespace runs don't count),
+// and only the definitions whose text changed, whose callees changed their signature, or that expand a changed user defined operator get compiled again
+// each definition lives in its own resource tracker under a versioned symbol (foo.3), and everything calls it through a stub named foo,
+// so swapping in a new body is "compile it, repoint the stub, drop the old tracker" => nothing that calls it has to be recompiled
+// after every reload the top level expressions run again, in source order
+
+extern bool WatchFile(const std::string& Path, unsigned PollMilliseconds = 100); // loads the file, then reloads on change until Ctrl-C => false if it can't be read
+extern void ResetWatchState(); // drops the stubs (once the jit that calls through them is gone)
+
+#endif
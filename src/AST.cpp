@@ -1 +1,270 @@
 #include "../include/kaleidoscope/AST.h"
+
+#include <cstdio>
+
+// the operators codegen handles itself => everything else is a user defined operator, which is really a call to binary<op>
+static bool isBuiltinBinaryOp(char Op) {
+    return Op == '=' || Op == '+' || Op == '-' || Op == '*' || Op == '/' || Op == '<';
+}
+
+// COLLECTING CALLEES => walks the tree and records every function an expression calls directly
+
+void NumberExprAST::collectCallees(std::set<std::string> &Callees) const {} // literals call nothing
+
+void VariableExprAST::collectCallees(std::set<std::string> &Callees) const {} // neither do variable references
+
+void VarExprAST::collectCallees(std::set<std::string> &Callees) const {
+    for (auto &Var : VarNames) {
+        if (Var.second) { // initial values are optional
+            Var.second->collectCallees(Callees);
+        }
+    }
+    Body->collectCallees(Callees);
+}
+
+void BinaryExprAST::collectCallees(std::set<std::string> &Callees) const {
+    if (!isBuiltinBinaryOp(Op)) {
+        Callees.insert(std::string("binary") + Op);
+    }
+    LHS->collectCallees(Callees);
+    RHS->collectCallees(Callees);
+}
+
+void CallExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Callees.insert(Callee);
+    for (auto &Arg : Args) {
+        Arg->collectCallees(Callees);
+    }
+}
+
+void AsyncExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Call->collectCallees(Callees);
+}
+
+void AwaitExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Handle->collectCallees(Callees);
+}
+
+void IfExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Condition->collectCallees(Callees);
+    Then->collectCallees(Callees);
+    Else->collectCallees(Callees);
+}
+
+void ForExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Start->collectCallees(Callees);
+    End->collectCallees(Callees);
+    if (Step) { // the step is optional
+        Step->collectCallees(Callees);
+    }
+    Body->collectCallees(Callees);
+}
+
+void UnaryExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Callees.insert(std::string("unary") + Operator);
+    Operand->collectCallees(Callees);
+}
+
+void FieldExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Base->collectCallees(Callees);
+}
+
+void IndexExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Collection->collectCallees(Callees);
+    Index->collectCallees(Callees);
+}
+
+void SoaExprAST::collectCallees(std::set<std::string> &Callees) const {
+    Size->collectCallees(Callees);
+}
+
+// COLLECTING ASSIGNMENTS => every variable name that appears on the left of an '=' (shadowing is ignored, which only makes the answer more conservative)
+
+void NumberExprAST::collectAssigned(std::set<std::string> &Names) const {}
+
+void VariableExprAST::collectAssigned(std::set<std::string> &Names) const {}
+
+void VarExprAST::collectAssigned(std::set<std::string> &Names) const {
+    for (auto &Var : VarNames) {
+        if (Var.second) {
+            Var.second->collectAssigned(Names);
+        }
+    }
+    Body->collectAssigned(Names);
+}
+
+void BinaryExprAST::collectAssigned(std::set<std::string> &Names) const {
+    if (Op == '=') {
+        const ExprAST* Target = LHS.get();
+        while (auto* Field = dynamic_cast<const FieldExprAST*>(Target)) { // z.re = ... assigns z
+            Target = Field->getBase();
+        }
+        if (auto* Variable = dynamic_cast<const VariableExprAST*>(Target)) {
+            Names.insert(Variable->getName());
+        }
+    }
+    LHS->collectAssigned(Names);
+    RHS->collectAssigned(Names);
+}
+
+void CallExprAST::collectAssigned(std::set<std::string> &Names) const {
+    for (auto &Arg : Args) {
+        Arg->collectAssigned(Names);
+    }
+}
+
+void AsyncExprAST::collectAssigned(std::set<std::string> &Names) const {
+    Call->collectAssigned(Names);
+}
+
+void AwaitExprAST::collectAssigned(std::set<std::string> &Names) const {
+    Handle->collectAssigned(Names);
+}
+
+void IfExprAST::collectAssigned(std::set<std::string> &Names) const {
+    Condition->collectAssigned(Names);
+    Then->collectAssigned(Names);
+    Else->collectAssigned(Names);
+}
+
+void ForExprAST::collectAssigned(std::set<std::string> &Names) const {
+    Start->collectAssigned(Names);
+    End->collectAssigned(Names);
+    if (Step) {
+        Step->collectAssigned(Names);
+    }
+    Body->collectAssigned(Names);
+}
+
+void UnaryExprAST::collectAssigned(std::set<std::string> &Names) const {
+    Operand->collectAssigned(Names);
+}
+
+void FieldExprAST::collectAssigned(std::set<std::string> &Names) const {
+    Base->collectAssigned(Names);
+}
+
+void IndexExprAST::collectAssigned(std::set<std::string> &Names) const { // ps[i] = ... writes the columns, the collection itself (and its size) stays
+    Collection->collectAssigned(Names);
+    Index->collectAssigned(Names);
+}
+
+void SoaExprAST::collectAssigned(std::set<std::string> &Names) const {
+    Size->collectAssigned(Names);
+}
+
+// CANONICAL FORM => a fully parenthesized prefix rendering of the tree, used as the key for caching compiled top level expressions
+
+void NumberExprAST::canonicalize(std::string &Out) const {
+    char Text[32];
+    snprintf(Text, sizeof(Text), "%a", Value); // hex float => exact, so 0.1 and 0.10000000000000001 can't collide by rounding
+    Out += Text;
+}
+
+void VariableExprAST::canonicalize(std::string &Out) const {
+    Out += "$" + Name;
+}
+
+void VarExprAST::canonicalize(std::string &Out) const {
+    Out += "(spawn";
+    for (size_t i = 0; i != VarNames.size(); ++i) {
+        auto &Var = VarNames[i];
+        Out += " " + Var.first;
+        if (!VarTypes.empty() && !VarTypes[i].empty()) {
+            Out += ":" + VarTypes[i];
+        }
+        Out += "=";
+        if (Var.second) {
+            Var.second->canonicalize(Out);
+        }
+    }
+    Out += " in ";
+    Body->canonicalize(Out);
+    Out += ")";
+}
+
+void BinaryExprAST::canonicalize(std::string &Out) const {
+    Out += "(";
+    Out += Op;
+    Out += " ";
+    LHS->canonicalize(Out);
+    Out += " ";
+    RHS->canonicalize(Out);
+    Out += ")";
+}
+
+void CallExprAST::canonicalize(std::string &Out) const {
+    Out += "(call " + Callee;
+    for (auto &Arg : Args) {
+        Out += " ";
+        Arg->canonicalize(Out);
+    }
+    Out += ")";
+}
+
+void AsyncExprAST::canonicalize(std::string &Out) const {
+    Out += "(async ";
+    Call->canonicalize(Out);
+    Out += ")";
+}
+
+void AwaitExprAST::canonicalize(std::string &Out) const {
+    Out += "(await ";
+    Handle->canonicalize(Out);
+    Out += ")";
+}
+
+void IfExprAST::canonicalize(std::string &Out) const {
+    Out += "(if ";
+    Condition->canonicalize(Out);
+    Out += " ";
+    Then->canonicalize(Out);
+    Out += " ";
+    Else->canonicalize(Out);
+    Out += ")";
+}
+
+void ForExprAST::canonicalize(std::string &Out) const {
+    Out += "(for " + VarName + " ";
+    Start->canonicalize(Out);
+    Out += " ";
+    End->canonicalize(Out);
+    Out += " ";
+    if (Step) {
+        Step->canonicalize(Out);
+    }
+    Out += " ";
+    if (!Hints.empty()) { // hints change the generated code, so they are part of the key
+        Out += "(hints " + std::to_string(Hints.Unroll) + " " + std::to_string(Hints.VectorizeWidth) + " " + std::to_string(Hints.Interleave) + ") ";
+    }
+    Body->canonicalize(Out);
+    Out += ")";
+}
+
+void UnaryExprAST::canonicalize(std::string &Out) const {
+    Out += "(unary";
+    Out += Operator;
+    Out += " ";
+    Operand->canonicalize(Out);
+    Out += ")";
+}
+
+void FieldExprAST::canonicalize(std::string &Out) const {
+    Out += "(. ";
+    Base->canonicalize(Out);
+    Out += " " + Field + ")";
+}
+
+void IndexExprAST::canonicalize(std::string &Out) const {
+    Out += "([] ";
+    Collection->canonicalize(Out);
+    Out += " ";
+    Index->canonicalize(Out);
+    Out += ")";
+}
+
+void SoaExprAST::canonicalize(std::string &Out) const {
+    Out += "(soa " + Record + " ";
+    Size->canonicalize(Out);
+    Out += ")";
+}
@@ -0,0 +1,75 @@
+#include "../include/kaleidoscope/aot.h"
+#include "../include/kaleidoscope/expression_handler.h"
+
+#include <mutex>
+
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+std::string ObjectOutputPath;
+std::string BitcodeOutputPath;
+std::string TargetTriple;
+std::string TargetCPU;
+std::string TargetFeatures;
+
+void InitializeObjectTargets() {
+    static std::once_flag Initialized;
+    std::call_once(Initialized, [] {
+        LLVMInitializeX86TargetInfo(); // x86-64 is always linked in (it's what the jit runs on)
+        LLVMInitializeX86Target();
+        LLVMInitializeX86TargetMC();
+        LLVMInitializeX86AsmPrinter();
+#ifdef KALEIDOSCOPE_HAVE_AARCH64 // set by cmake when llvm was built with the AArch64 backend
+        LLVMInitializeAArch64TargetInfo();
+        LLVMInitializeAArch64Target();
+        LLVMInitializeAArch64TargetMC();
+        LLVMInitializeAArch64AsmPrinter();
+#endif
+    });
+}
+
+llvm::Expected<llvm::orc::JITTargetMachineBuilder> ObjectTargetBuilder() {
+    llvm::orc::JITTargetMachineBuilder JTMB{llvm::Triple()};
+    if (TargetTriple.empty()) { // the host => same cpu and features the jit would use, unless overridden
+        auto Host = llvm::orc::JITTargetMachineBuilder::detectHost();
+        if (!Host) {
+            return Host.takeError();
+        }
+        JTMB = std::move(*Host);
+        if (!TargetCPU.empty()) {
+            JTMB.setCPU(TargetCPU);
+        }
+    } else { // cross compiling => nothing about this machine applies
+        JTMB = llvm::orc::JITTargetMachineBuilder(llvm::Triple(llvm::Triple::normalize(TargetTriple)));
+        JTMB.setCPU(TargetCPU.empty() ? "generic" : TargetCPU);
+    }
+
+    llvm::SmallVector<llvm::StringRef, 8> Features;
+    llvm::StringRef(TargetFeatures).split(Features, ',', -1, false);
+    for (auto Feature : Features) {
+        JTMB.getFeatures().AddFeature(Feature.trim()); // "+neon", "-avx2" (a bare name means enable)
+    }
+
+    JTMB.setRelocationModel(llvm::Reloc::PIC_); // so the object can go into executables and shared libraries alike
+    JTMB.setCodeGenOptLevel(llvm::CodeGenOptLevel::Aggressive);
+    return JTMB;
+}
+
+bool EmitObjectFile(llvm::Module& M, const std::string& Path) {
+    std::error_code EC;
+    llvm::raw_fd_ostream Out(Path, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+        LogError(("Could not open '" + Path + "': " + EC.message()).c_str());
+        return false;
+    }
+
+    llvm::legacy::PassManager CodeGenPasses; // the backend still runs on the legacy pass manager
+    if (TheTM->addPassesToEmitFile(CodeGenPasses, Out, nullptr, llvm::CodeGenFileType::ObjectFile)) {
+        LogError(("Target '" + TheTM->getTargetTriple().str() + "' can't emit object files.").c_str());
+        return false;
+    }
+    CodeGenPasses.run(M);
+    Out.flush();
+    return true;
+}
@@ -0,0 +1,137 @@
+#include "../include/kaleidoscope/batch.h"
+#include "../include/kaleidoscope/codegen.h"
+#include "../include/kaleidoscope/expression_handler.h"
+
+// a batch wrapper stays valid until the function it wraps is redefined (or declared again)
+struct BatchEntry {
+    unsigned Version; // FunctionVersions[Name] when the wrapper was built (a new definition can reuse the address of the old one)
+    llvm::orc::ResourceTrackerSP RT; // owns the wrapper's code in the jit
+    BatchFunction Function; // the compiled wrapper
+};
+
+static std::map<std::string, BatchEntry> BatchWrappers;
+
+// the normal function pass pipeline has no inliner, so the wrapper module gets the full O3 pipeline
+// tuned for the host cpu (the vectorizer needs the real target to know how wide the vector registers are)
+static void OptimizeBatchModule(llvm::Module& M) {
+
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassBuilder PB(TheTM.get());
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    llvm::ModulePassManager MPM = PB.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O3);
+    MPM.run(M, MAM);
+}
+
+BatchFunction GetBatchFunction(const std::string& Name) {
+    auto DI = FunctionDefs.find(Name);
+    if (DI == FunctionDefs.end()) { // we need the body to inline it, so declared (external) functions can't be batched
+        LogError(("Batch evaluation needs a function defined with 'def', '" + Name + "' is not one.").c_str());
+        return nullptr;
+    }
+
+    auto WI = BatchWrappers.find(Name);
+    if (WI != BatchWrappers.end()) {
+        if (WI->second.Version == FunctionVersions[Name]) { // still the same definition => reuse the compiled wrapper
+            return WI->second.Function;
+        }
+        ExitOnErr(WI->second.RT->remove()); // the function was redefined => throw the stale wrapper away
+        BatchWrappers.erase(WI);
+    }
+
+    llvm::Function* Inner;
+    if (!ProfileGeneratePath.empty() || InstrumentCalls) {
+        // instrumented runs => a copy would bring its own counters and enter/exit hooks, and every element would be counted by both,
+        // so the wrapper calls the definition the jit already has (each element is counted once, by it)
+        Inner = getFunction(Name);
+    } else {
+        // re-emit the function into the current module so it can be inlined into the loop
+        // (internal linkage keeps this copy from clashing with the definition the jit already has)
+        Inner = DI->second->codegen();
+        if (Inner) {
+            Inner->setLinkage(llvm::GlobalValue::InternalLinkage);
+            Inner->addFnAttr(llvm::Attribute::AlwaysInline);
+        }
+    }
+    if (!Inner) {
+        return nullptr;
+    }
+
+    // void __batch_<name>(ptr Columns, ptr Out, i64 Count)
+    llvm::Type* DoubleTy = Builder->getDoubleTy();
+    llvm::Type* PtrTy = Builder->getPtrTy();
+    llvm::Type* Int64Ty = Builder->getInt64Ty();
+    llvm::FunctionType* FT = llvm::FunctionType::get(Builder->getVoidTy(), { PtrTy, PtrTy, Int64Ty }, false);
+    llvm::Function* Wrapper = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "__batch_" + Name, TheModule.get());
+    Wrapper->addParamAttr(1, llvm::Attribute::NoAlias); // the output array doesn't overlap the inputs, so no runtime alias checks are needed for it
+
+    llvm::Value* Columns = Wrapper->getArg(0);
+    llvm::Value* Out = Wrapper->getArg(1);
+    llvm::Value* Count = Wrapper->getArg(2);
+
+    llvm::BasicBlock* Entry = llvm::BasicBlock::Create(*TheContext, "entry", Wrapper);
+    llvm::BasicBlock* Loop = llvm::BasicBlock::Create(*TheContext, "loop", Wrapper);
+    llvm::BasicBlock* Exit = llvm::BasicBlock::Create(*TheContext, "exit", Wrapper);
+
+    Builder->SetInsertPoint(Entry);
+    std::vector<llvm::Value*> ColumnPointers; // load the column base pointers once, outside the loop
+    for (unsigned i = 0, e = Inner->arg_size(); i != e; ++i) {
+        ColumnPointers.push_back(Builder->CreateLoad(PtrTy, Builder->CreateConstInBoundsGEP1_64(PtrTy, Columns, i), "column"));
+    }
+    Builder->CreateCondBr(Builder->CreateICmpUGT(Count, Builder->getInt64(0)), Loop, Exit); // guard => skip the loop for empty batches
+
+    // a canonical counted loop => integer induction variable, trip count known on entry
+    Builder->SetInsertPoint(Loop);
+    llvm::PHINode* Index = Builder->CreatePHI(Int64Ty, 2, "index");
+    Index->addIncoming(Builder->getInt64(0), Entry);
+
+    std::vector<llvm::Value*> Args; // element i of every column
+    for (llvm::Value* Column : ColumnPointers) {
+        Args.push_back(Builder->CreateLoad(DoubleTy, Builder->CreateInBoundsGEP(DoubleTy, Column, Index), "element"));
+    }
+    llvm::Value* Result = Builder->CreateCall(Inner, Args, "result");
+    Builder->CreateStore(Result, Builder->CreateInBoundsGEP(DoubleTy, Out, Index));
+
+    llvm::Value* Next = Builder->CreateAdd(Index, Builder->getInt64(1), "next", true, true);
+    Index->addIncoming(Next, Loop);
+    Builder->CreateCondBr(Builder->CreateICmpULT(Next, Count), Loop, Exit);
+
+    Builder->SetInsertPoint(Exit);
+    Builder->CreateRetVoid();
+    llvm::verifyFunction(*Wrapper);
+
+    OptimizeBatchModule(*TheModule); // inline the body and vectorize the loop
+
+    auto RT = TheJIT->getMainJITDylib().createResourceTracker(); // kept so the wrapper can be dropped on redefinition
+    ExitOnErr(TheJIT->addModule(llvm::orc::ThreadSafeModule(std::move(TheModule), TheTSC), RT));
+    InitializeModule(); // open up a new module
+
+    auto Symbol = ExitOnErr(TheJIT->lookup("__batch_" + Name));
+    BatchFunction Function = Symbol.getAddress().toPtr<BatchFunction>();
+    BatchWrappers[Name] = { FunctionVersions[Name], RT, Function };
+    return Function;
+}
+
+bool CallNative(void* Function, const double* Args, unsigned NumArgs, double& Result) {
+    typedef double D; // every kaleidoscope value is a double, so the arity is the only thing that varies
+    switch (NumArgs) {
+        case 0: Result = reinterpret_cast<D (*)()>(Function)(); return true;
+        case 1: Result = reinterpret_cast<D (*)(D)>(Function)(Args[0]); return true;
+        case 2: Result = reinterpret_cast<D (*)(D, D)>(Function)(Args[0], Args[1]); return true;
+        case 3: Result = reinterpret_cast<D (*)(D, D, D)>(Function)(Args[0], Args[1], Args[2]); return true;
+        case 4: Result = reinterpret_cast<D (*)(D, D, D, D)>(Function)(Args[0], Args[1], Args[2], Args[3]); return true;
+        case 5: Result = reinterpret_cast<D (*)(D, D, D, D, D)>(Function)(Args[0], Args[1], Args[2], Args[3], Args[4]); return true;
+        case 6: Result = reinterpret_cast<D (*)(D, D, D, D, D, D)>(Function)(Args[0], Args[1], Args[2], Args[3], Args[4], Args[5]); return true;
+        case 7: Result = reinterpret_cast<D (*)(D, D, D, D, D, D, D)>(Function)(Args[0], Args[1], Args[2], Args[3], Args[4], Args[5], Args[6]); return true;
+        case 8: Result = reinterpret_cast<D (*)(D, D, D, D, D, D, D, D)>(Function)(Args[0], Args[1], Args[2], Args[3], Args[4], Args[5], Args[6], Args[7]); return true;
+        default: return false; // more arguments than we have a call shape for
+    }
+}
@@ -0,0 +1,226 @@
+#include "../include/kaleidoscope/call_stats.h"
+#include "../include/kaleidoscope/runtime_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+bool InstrumentCalls = false;
+
+// owner thread only writes, queries from other threads only read => relaxed atomics without the cost of a locked add
+struct CallCounters {
+    std::atomic<uint64_t> Calls{0};
+    std::atomic<uint64_t> Inclusive{0};
+    std::atomic<uint64_t> Exclusive{0};
+};
+
+static void Bump(std::atomic<uint64_t>& Counter, uint64_t By) {
+    Counter.store(Counter.load(std::memory_order_relaxed) + By, std::memory_order_relaxed);
+}
+
+// one activation on the shadow stack
+struct CallFrame {
+    int32_t Id;
+    uint64_t Start;
+    uint64_t Callees = 0; // ticks spent in calls made from this activation
+};
+
+struct ThreadCallStats {
+    std::unique_ptr<CallCounters[]> Counters{new CallCounters[MaxInstrumentedFunctions]};
+    std::vector<unsigned> Active = std::vector<unsigned>(MaxInstrumentedFunctions); // activations of each function on this thread's stack
+    std::vector<CallFrame> Stack;
+
+    ThreadCallStats();
+    ~ThreadCallStats();
+};
+
+static std::mutex StatsMutex; // guards the registry, the list of live threads and the retired totals
+static std::map<std::string, int> FunctionIds;
+static std::vector<std::string> FunctionNames;
+static std::set<ThreadCallStats*> LiveThreads;
+static uint64_t Retired[MaxInstrumentedFunctions][3]; // calls, inclusive, exclusive of threads that already exited
+
+static uint64_t CalibrationTicks = 0;
+static std::chrono::steady_clock::time_point CalibrationTime;
+
+ThreadCallStats::ThreadCallStats() {
+    Stack.reserve(256);
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    LiveThreads.insert(this);
+}
+
+ThreadCallStats::~ThreadCallStats() {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    for (unsigned i = 0; i != MaxInstrumentedFunctions; ++i) {
+        Retired[i][0] += Counters[i].Calls.load(std::memory_order_relaxed);
+        Retired[i][1] += Counters[i].Inclusive.load(std::memory_order_relaxed);
+        Retired[i][2] += Counters[i].Exclusive.load(std::memory_order_relaxed);
+    }
+    LiveThreads.erase(this);
+}
+
+static thread_local std::unique_ptr<ThreadCallStats> ThisThread; // created on the first instrumented call a thread makes
+
+static inline uint64_t ReadTicks() {
+#if defined(__x86_64__) || defined(_M_X64)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t Ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(Ticks));
+    return Ticks;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void StartCallStats() {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    for (auto* Thread : LiveThreads) {
+        for (unsigned i = 0; i != MaxInstrumentedFunctions; ++i) {
+            Thread->Counters[i].Calls = 0;
+            Thread->Counters[i].Inclusive = 0;
+            Thread->Counters[i].Exclusive = 0;
+        }
+    }
+    std::fill(&Retired[0][0], &Retired[0][0] + MaxInstrumentedFunctions * 3, 0);
+    FunctionIds.clear();
+    FunctionNames.clear();
+    CalibrationTicks = ReadTicks();
+    CalibrationTime = std::chrono::steady_clock::now();
+}
+
+int CallStatsId(const std::string& Name) {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    auto It = FunctionIds.find(Name);
+    if (It != FunctionIds.end()) {
+        return It->second;
+    }
+    if (FunctionNames.size() == MaxInstrumentedFunctions) {
+        return -1;
+    }
+    FunctionNames.push_back(Name);
+    return FunctionIds[Name] = FunctionNames.size() - 1;
+}
+
+extern "C" void kaleidoscope_enter(int32_t Id) {
+    if (!ThisThread) {
+        ThisThread = std::make_unique<ThreadCallStats>();
+    }
+    ThisThread->Active[Id]++;
+    ThisThread->Stack.push_back({ Id, ReadTicks() });
+}
+
+extern "C" void kaleidoscope_exit(int32_t Id) {
+    uint64_t Now = ReadTicks();
+    ThreadCallStats& Thread = *ThisThread;
+    CallFrame Frame = Thread.Stack.back();
+    Thread.Stack.pop_back();
+    uint64_t Elapsed = Now - Frame.Start;
+
+    CallCounters& Counters = Thread.Counters[Id];
+    Bump(Counters.Calls, 1);
+    Bump(Counters.Exclusive, Elapsed - std::min(Elapsed, Frame.Callees));
+    if (--Thread.Active[Id] == 0) { // the outermost activation already covers the recursive ones
+        Bump(Counters.Inclusive, Elapsed);
+    }
+    if (!Thread.Stack.empty()) {
+        Thread.Stack.back().Callees += Elapsed;
+    }
+}
+
+struct FunctionCallStats {
+    std::string Name;
+    uint64_t Calls, Inclusive, Exclusive;
+};
+
+// every thread's counters summed up, plus how many nanoseconds one tick is
+static std::vector<FunctionCallStats> CollectCallStats(double& NanosecondsPerTick) {
+    std::lock_guard<std::mutex> Lock(StatsMutex);
+    uint64_t Ticks = ReadTicks() - CalibrationTicks;
+    double Nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - CalibrationTime).count();
+    NanosecondsPerTick = Ticks ? Nanoseconds / Ticks : 1.0;
+
+    std::vector<FunctionCallStats> Stats;
+    for (size_t i = 0; i != FunctionNames.size(); ++i) {
+        FunctionCallStats S = { FunctionNames[i], Retired[i][0], Retired[i][1], Retired[i][2] };
+        for (auto* Thread : LiveThreads) {
+            S.Calls += Thread->Counters[i].Calls.load(std::memory_order_relaxed);
+            S.Inclusive += Thread->Counters[i].Inclusive.load(std::memory_order_relaxed);
+            S.Exclusive += Thread->Counters[i].Exclusive.load(std::memory_order_relaxed);
+        }
+        if (S.Calls) {
+            Stats.push_back(std::move(S));
+        }
+    }
+    std::sort(Stats.begin(), Stats.end(), [](const FunctionCallStats& A, const FunctionCallStats& B) { return A.Exclusive > B.Exclusive; });
+    return Stats;
+}
+
+void PrintCallStats(FILE* Out) {
+    double NsPerTick;
+    auto Stats = CollectCallStats(NsPerTick);
+    if (Stats.empty()) {
+        fprintf(Out, "No instrumented calls yet.\n");
+        return;
+    }
+
+    fprintf(Out, "%-24s %14s %14s %14s %12s %12s\n", "function", "calls", "inclusive ms", "exclusive ms", "incl ns/call", "excl ns/call");
+    for (auto &S : Stats) {
+        double Inclusive = S.Inclusive * NsPerTick, Exclusive = S.Exclusive * NsPerTick;
+        fprintf(Out, "%-24s %14llu %14.3f %14.3f %12.1f %12.1f\n", S.Name.c_str(), (unsigned long long)S.Calls, Inclusive / 1e6, Exclusive / 1e6, Inclusive / S.Calls, Exclusive / S.Calls);
+    }
+}
+
+void ShowCallStats() {
+    RuntimeFlush(); // keep the script's output in front of the table
+    if (!InstrumentCalls) {
+        fprintf(stderr, "Call instrumentation is off (run with --instrument-calls).\n");
+        return;
+    }
+    PrintCallStats(stderr);
+}
+
+static std::string JSONString(const std::string& Text) {
+    std::string Quoted = "\"";
+    for (char C : Text) {
+        if (C == '"' || C == '\\') {
+            Quoted += '\\';
+        }
+        Quoted += C;
+    }
+    return Quoted + "\"";
+}
+
+bool WriteCallStatsJSON(const std::string& Path) {
+    std::ofstream File(Path);
+    if (!File) {
+        return false;
+    }
+
+    double NsPerTick;
+    auto Stats = CollectCallStats(NsPerTick);
+    File << "{\n  \"ns_per_tick\": " << NsPerTick << ",\n  \"functions\": [";
+    for (size_t i = 0; i != Stats.size(); ++i) {
+        auto &S = Stats[i];
+        File << (i ? ",\n" : "\n") << "    { \"name\": " << JSONString(S.Name) << ", \"calls\": " << S.Calls
+             << ", \"inclusive_ticks\": " << S.Inclusive << ", \"exclusive_ticks\": " << S.Exclusive
+             << ", \"inclusive_ns_per_call\": " << S.Inclusive * NsPerTick / S.Calls
+             << ", \"exclusive_ns_per_call\": " << S.Exclusive * NsPerTick / S.Calls << " }";
+    }
+    File << "\n  ]\n}\n";
+    return true;
+}
@@ -1,11 +1,17 @@
 #include "../include/kaleidoscope/codegen.h"
+#include "../include/kaleidoscope/specialize.h"
 
-std::unique_ptr<llvm::LLVMContext> TheContext;  // internally declares the llvm context (use this so that we can use other llvm apis)
+llvm::orc::ThreadSafeContext TheTSC; // keeps the context alive for the session and lets the jit lock it
+llvm::LLVMContext* TheContext = nullptr;  // internally declares the llvm context (use this so that we can use other llvm apis)
 std::unique_ptr<llvm::IRBuilder<>> Builder; // the actual llvm ir builder (codegenerator)
 std::unique_ptr<llvm::Module> TheModule; // top level llvm structure that holds functions and global variables (owns all of the ir (memory-wise))
 std::map<std::string, llvm::AllocaInst*> NamedValues; // keeps track of values defined in the current scope...
 
 std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+std::map<std::string, std::unique_ptr<FunctionAST>> FunctionDefs; // definitions are kept around after codegen so operator bodies can be expanded into every module that uses them
+
+static std::set<std::string> ExpandingOperators; // operators whose bodies are currently being expanded (a recursive operator falls back to a real call)
+static std::map<llvm::AllocaInst*, llvm::Value*> CountedIndices; // iterators of the counted loops being emitted => their i64 value, so ps[i] doesn't round trip through a double
 
 llvm::Value *LogErrorV(const char* Str) { // codegen error logging function
     LogError(Str); // calls the LogError function on the passed string
@@ -29,44 +35,324 @@ llvm::Function* getFunction(std::string Name) {
 }
 
 // helper function that ensures that allocas are generated in the entry block of a function (WHERE THEY ARE INTENDED TO BE PLACED!!!)
-llvm::AllocaInst* CreateEntryBlockAllocation(llvm::Function* TheFunction, llvm::StringRef VarName) {
+llvm::AllocaInst* CreateEntryBlockAllocation(llvm::Function* TheFunction, llvm::StringRef VarName, llvm::Type* Type) {
     // create an ir builder that creates an allocation with the associated name
     llvm::IRBuilder<> TmpBuiler(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin()); // creates an ir vbuilder that points to the first insturction in the function's entry block
     // returns a pointer to an allocated object (POINTER TO WHERE IT LIVES ON THE STACK)
-    return TmpBuiler.CreateAlloca(llvm::Type::getDoubleTy(*TheContext), nullptr, VarName); // it then returns a memory allocation with the expected name and returns it
+    return TmpBuiler.CreateAlloca(Type ? Type : llvm::Type::getDoubleTy(*TheContext), nullptr, VarName); // it then returns a memory allocation with the expected name and returns it
 }
 
-// numeric constants represented as ConstantFPs, which holds an APFloat (float with arbitrary precision)
-llvm::Value *NumberExprAST::codegen() { // generating ir for numeric constants
-    return llvm::ConstantFP::get(*TheContext, llvm::APFloat(Value)); // creates and returns a ConstantFP
+// everything but records and their fields works on numbers => reports anything else (V may already be null from an earlier error)
+static llvm::Value* ExpectNumber(llvm::Value* V, const std::string& What) {
+    if (!V || V->getType()->isDoubleTy()) {
+        return V;
+    }
+    return LogErrorV((What + " has to be a number, not a " + TypeName(V->getType()) + ".").c_str());
 }
 
-llvm::Value *BinaryExprAST::codegen() { // RECURSIVELY EMIT IR FOR LHS AND RHS
-    // evaluate the special case of an '=' token
-    if (Op == '=') {
-        VariableExprAST *LHSE = static_cast<VariableExprAST*>(LHS.get()); // casts from a basic expression to a varibale expression node
-        if (!LHSE) {
-            return LogErrorV("must be assigned to a variable..."); // if the variable is not there, throw back a nullptr
+bool CountedLoops = true;
+
+void ResetCodegenState() {
+    ExpandingOperators.clear();
+    CountedIndices.clear();
+}
+
+// operator definitions each live in their own module, so a call to binary<op> / unary<op> can never be inlined by llvm
+// instead we keep the AST of the operator and expand it directly at the use site, which makes user operators as cheap as the builtins
+FunctionAST* getInlinableOperator(const std::string& Name) {
+    auto DI = FunctionDefs.find(Name); // look for a stored definition of the operator
+    if (DI == FunctionDefs.end() || ExpandingOperators.count(Name)) { // not defined (only declared), or we are already inside its own expansion
+        return nullptr; // the caller emits a normal call instead
+    }
+    return DI->second.get();
+}
+
+llvm::Value* InlineOperator(FunctionAST& Operator, llvm::ArrayRef<llvm::Value*> Operands) {
+    const PrototypeAST& P = Operator.getProto();
+    llvm::Function* TheFunction = Builder->GetInsertBlock()->getParent(); // the function we are expanding into
+
+    // the operator body may only see its own parameters, exactly like when it was a separate function
+    std::map<std::string, llvm::AllocaInst*> CallerValues = std::move(NamedValues);
+    NamedValues.clear();
+
+    for (unsigned i = 0, e = Operands.size(); i != e; ++i) {
+        llvm::AllocaInst* Allocation = CreateEntryBlockAllocation(TheFunction, P.getArgs()[i]); // each parameter gets its own slot (mem2reg removes it again)
+        Builder->CreateStore(Operands[i], Allocation); // the operands are evaluated once, just like arguments to a call
+        NamedValues[P.getArgs()[i]] = Allocation;
+    }
+
+    ExpandingOperators.insert(P.getName()); // guard against operators that use themselves
+    llvm::Value* Result = Operator.getBody()->codegen(); // emit the body in place of the call
+    ExpandingOperators.erase(P.getName());
+
+    NamedValues = std::move(CallerValues); // restore the scope of the caller
+    return Result;
+}
+
+// RECORDS AND SOA COLLECTIONS (see records.h)
+
+// z.pos.x => { "pos", "x" } on the innermost expression that isn't a field access (z here, ps[i] for ps[i].pos.x)
+static const ExprAST* FieldPath(const ExprAST* E, std::vector<std::string>& Names) {
+    while (auto* Field = dynamic_cast<const FieldExprAST*>(E)) {
+        Names.insert(Names.begin(), Field->getField());
+        E = Field->getBase();
+    }
+    return E;
+}
+
+// field names => struct indices, starting from a record value type => the type at the end of the path (nullptr, error reported, if a name doesn't fit)
+static llvm::Type* ResolveFieldPath(llvm::Type* Type, const std::vector<std::string>& Names, std::vector<unsigned>& Indices) {
+    for (auto &Name : Names) {
+        const RecordType* Record = RecordOf(Type);
+        if (!Record || IsCollection(Type)) {
+            LogError(("A " + TypeName(Type) + " has no field '" + Name + "'.").c_str());
+            return nullptr;
+        }
+        const auto &Fields = Record->Declaration.Fields;
+        auto FI = std::find_if(Fields.begin(), Fields.end(), [&Name](const RecordField& Field) { return Field.Name == Name; });
+        if (FI == Fields.end()) {
+            LogError(("Record '" + Record->Declaration.Name + "' has no field '" + Name + "'.").c_str());
+            return nullptr;
+        }
+        Indices.push_back(FI - Fields.begin());
+        Type = Record->Struct->getElementType(Indices.back());
+    }
+    return Type;
+}
+
+// every index is checked against the size unless --no-bounds-check => the failing branch is marked cold, so the loop body stays straight line code
+static void EmitBoundsCheck(llvm::Value* Collection, llvm::Value* Index) {
+    llvm::Function* TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::Value* Size = Builder->CreateExtractValue(Collection, { 0 }, "size");
+    llvm::Value* Outside = Builder->CreateICmpUGE(Index, Size, "outside"); // a negative index wraps around to a huge one
+    llvm::BasicBlock* FailBasicBlock = llvm::BasicBlock::Create(*TheContext, "outofbounds", TheFunction);
+    llvm::BasicBlock* InBoundsBasicBlock = llvm::BasicBlock::Create(*TheContext, "inbounds", TheFunction);
+    Builder->CreateCondBr(Outside, FailBasicBlock, InBoundsBasicBlock, CreateProfileWeights(0, 1));
+
+    Builder->SetInsertPoint(FailBasicBlock);
+    llvm::FunctionType* FailType = llvm::FunctionType::get(Builder->getVoidTy(), { Builder->getInt64Ty(), Builder->getInt64Ty() }, false);
+    Builder->CreateCall(TheModule->getOrInsertFunction("kaleidoscope_soa_out_of_bounds", FailType), { Index, Size });
+    Builder->CreateUnreachable(); // it aborts
+
+    Builder->SetInsertPoint(InBoundsBasicBlock);
+}
+
+// the collection and the i64 index of ps[i] => the iterator of a counted loop is used as it is, anything else is truncated towards zero
+static bool CodegenElement(const IndexExprAST& Element, llvm::Value*& Collection, llvm::Value*& Index, const RecordType*& Record) {
+    Collection = Element.getCollection()->codegen();
+    if (!Collection) {
+        return false;
+    }
+    if (!IsCollection(Collection->getType())) {
+        LogError(("Only a soa collection can be indexed, not a " + TypeName(Collection->getType()) + ".").c_str());
+        return false;
+    }
+    Record = RecordOf(Collection->getType());
+
+    Index = nullptr;
+    if (auto* Variable = dynamic_cast<const VariableExprAST*>(Element.getIndex())) {
+        auto VI = NamedValues.find(Variable->getName());
+        auto CI = VI == NamedValues.end() ? CountedIndices.end() : CountedIndices.find(VI->second);
+        if (CI != CountedIndices.end()) {
+            Index = CI->second;
         }
-        
-        llvm::Value* val = RHS->codegen(); // evaluate the RHS of the assignment operator...
-        if (!val) {
-            return nullptr; // if it is not converted to llvm ir, return a nullptr back...
+    }
+    if (!Index) {
+        Index = ExpectNumber(Element.getIndex()->codegen(), "An index");
+        if (!Index) {
+            return false;
         }
+        Index = Builder->CreateFPToSI(Index, Builder->getInt64Ty(), "index");
+    }
+    if (CheckBounds) {
+        EmitBoundsCheck(Collection, Index);
+    }
+    return true;
+}
+
+// the address of element Index in column Leaf
+static llvm::Value* ColumnAddress(llvm::Value* Collection, unsigned Leaf, llvm::Value* Index) {
+    llvm::Value* Column = Builder->CreateExtractValue(Collection, { 1 + Leaf }, "column");
+    return Builder->CreateInBoundsGEP(Builder->getDoubleTy(), Column, Index, "element");
+}
 
-        llvm::Value* Variable = NamedValues[LHSE->getName()]; // store a pointer to the variables location in the named values map
-        if (!Variable) {
-            return LogErrorV("Unknown var name"); // if the variable isn't in the map, pass back a nullptr
+// ps[i] or ps[i].pos => only the columns under Path are read
+static llvm::Value* LoadElement(llvm::Value* Collection, llvm::Value* Index, const RecordType& Record, const std::vector<unsigned>& Path, llvm::Type* Type) {
+    if (Type->isDoubleTy()) {
+        return Builder->CreateLoad(Type, ColumnAddress(Collection, FirstLeaf(Record, Path), Index), "field");
+    }
+    llvm::Value* Result = llvm::UndefValue::get(Type);
+    for (unsigned Leaf = FirstLeaf(Record, Path); Leaf != Record.Leaves.size(); ++Leaf) {
+        const std::vector<unsigned>& Indices = Record.Leaves[Leaf];
+        if (Indices.size() < Path.size() || !std::equal(Path.begin(), Path.end(), Indices.begin())) { // past the run of columns under Path
+            break;
+        }
+        llvm::Value* Value = Builder->CreateLoad(Builder->getDoubleTy(), ColumnAddress(Collection, Leaf, Index), "field");
+        Result = Builder->CreateInsertValue(Result, Value, llvm::ArrayRef<unsigned>(Indices).drop_front(Path.size()));
+    }
+    return Result;
+}
+
+static void StoreElement(llvm::Value* Collection, llvm::Value* Index, const RecordType& Record, const std::vector<unsigned>& Path, llvm::Value* Value) {
+    if (Value->getType()->isDoubleTy()) {
+        Builder->CreateStore(Value, ColumnAddress(Collection, FirstLeaf(Record, Path), Index));
+        return;
+    }
+    for (unsigned Leaf = FirstLeaf(Record, Path); Leaf != Record.Leaves.size(); ++Leaf) {
+        const std::vector<unsigned>& Indices = Record.Leaves[Leaf];
+        if (Indices.size() < Path.size() || !std::equal(Path.begin(), Path.end(), Indices.begin())) {
+            break;
         }
+        llvm::Value* Field = Builder->CreateExtractValue(Value, llvm::ArrayRef<unsigned>(Indices).drop_front(Path.size()));
+        Builder->CreateStore(Field, ColumnAddress(Collection, Leaf, Index));
+    }
+}
 
-        Builder->CreateStore(val, Variable); // creates a store instruction that puts the evaluated RHS expression into the location where the variable was allocated
+// x = ..., z.re = ..., ps[i] = ..., ps[i].pos.x = ... => evaluates to the value assigned
+static llvm::Value* CodegenAssignment(ExprAST* Target, ExprAST* Value) {
+    std::vector<std::string> Names;
+    const ExprAST* Root = FieldPath(Target, Names);
+    auto* Variable = dynamic_cast<const VariableExprAST*>(Root);
+    auto* Element = dynamic_cast<const IndexExprAST*>(Root);
+    if (!Variable && !Element) {
+        return LogErrorV("must be assigned to a variable, a field or an element of a collection...");
+    }
+
+    llvm::Value* val = Value->codegen(); // evaluate the RHS of the assignment operator...
+    if (!val) {
+        return nullptr; // if it is not converted to llvm ir, return a nullptr back...
+    }
+
+    std::vector<unsigned> Indices;
+    if (Element) {
+        llvm::Value *Collection, *Index;
+        const RecordType* Record;
+        if (!CodegenElement(*Element, Collection, Index, Record)) {
+            return nullptr;
+        }
+        llvm::Type* Type = ResolveFieldPath(Record->Struct, Names, Indices);
+        if (!Type) {
+            return nullptr;
+        }
+        if (val->getType() != Type) {
+            return LogErrorV(("Can't assign a " + TypeName(val->getType()) + " to a " + TypeName(Type) + ".").c_str());
+        }
+        StoreElement(Collection, Index, *Record, Indices, val);
         return val;
     }
 
+    llvm::AllocaInst* Slot = NamedValues[Variable->getName()]; // store a pointer to the variables location in the named values map
+    if (!Slot) {
+        return LogErrorV("Unknown var name"); // if the variable isn't in the map, pass back a nullptr
+    }
+    llvm::Type* Type = ResolveFieldPath(Slot->getAllocatedType(), Names, Indices);
+    if (!Type) {
+        return nullptr;
+    }
+    if (val->getType() != Type) {
+        return LogErrorV(("Can't assign a " + TypeName(val->getType()) + " to a " + TypeName(Type) + ".").c_str());
+    }
+    if (IsCollection(Type)) { // the 'spawn' that created a collection frees it => it can't be swapped for another one
+        return LogErrorV("A soa collection can't be assigned, assign its elements instead.");
+    }
+
+    llvm::Value* Address = Slot;
+    if (!Indices.empty()) {
+        std::vector<llvm::Value*> GEPIndices = { Builder->getInt32(0) };
+        for (unsigned Index : Indices) {
+            GEPIndices.push_back(Builder->getInt32(Index));
+        }
+        Address = Builder->CreateInBoundsGEP(Slot->getAllocatedType(), Slot, GEPIndices, "fieldaddr");
+    }
+    Builder->CreateStore(val, Address); // creates a store instruction that puts the evaluated RHS expression into the location where the variable was allocated
+    return val;
+}
+
+llvm::Value* FieldExprAST::codegen() {
+    std::vector<std::string> Names;
+    const ExprAST* Root = FieldPath(this, Names);
+    std::vector<unsigned> Indices;
+
+    if (auto* Element = dynamic_cast<const IndexExprAST*>(Root)) { // ps[i].pos.x => one column, not the whole record
+        llvm::Value *Collection, *Index;
+        const RecordType* Record;
+        if (!CodegenElement(*Element, Collection, Index, Record)) {
+            return nullptr;
+        }
+        llvm::Type* Type = ResolveFieldPath(Record->Struct, Names, Indices);
+        return Type ? LoadElement(Collection, Index, *Record, Indices, Type) : nullptr;
+    }
+
+    llvm::Value* BaseV = const_cast<ExprAST*>(Root)->codegen();
+    if (!BaseV) {
+        return nullptr;
+    }
+    if (IsCollection(BaseV->getType())) {
+        if (Names.size() != 1 || Names[0] != "size") {
+            return LogErrorV("A soa collection only has a 'size', index it to get at the fields (ps[i].field).");
+        }
+        return Builder->CreateSIToFP(Builder->CreateExtractValue(BaseV, { 0 }), Builder->getDoubleTy(), "size");
+    }
+    if (!ResolveFieldPath(BaseV->getType(), Names, Indices)) {
+        return nullptr;
+    }
+    return Builder->CreateExtractValue(BaseV, Indices, Field);
+}
+
+llvm::Value* IndexExprAST::codegen() {
+    llvm::Value *CollectionV, *IndexV;
+    const RecordType* Record;
+    if (!CodegenElement(*this, CollectionV, IndexV, Record)) {
+        return nullptr;
+    }
+    return LoadElement(CollectionV, IndexV, *Record, {}, Record->Struct);
+}
+
+// one block => every column starts on a 64 byte boundary (the size rounded up to 8 doubles), and the first column's pointer is the block itself
+llvm::Value* SoaExprAST::codegen() {
+    auto RI = Records.find(Record);
+    if (RI == Records.end()) {
+        return LogErrorV(("Unknown record '" + Record + "'.").c_str());
+    }
+    const RecordType& R = RI->second;
+
+    llvm::Value* SizeV = ExpectNumber(Size->codegen(), "The size of a collection");
+    if (!SizeV) {
+        return nullptr;
+    }
+    llvm::Type* IndexTy = Builder->getInt64Ty();
+    llvm::Value* Count = Builder->CreateIntrinsic(llvm::Intrinsic::fptosi_sat, { IndexTy, SizeV->getType() }, { SizeV }); // NaN => 0
+    Count = Builder->CreateBinaryIntrinsic(llvm::Intrinsic::smax, Count, llvm::ConstantInt::get(IndexTy, 0), nullptr, "count");
+    llvm::Value* Stride = Builder->CreateAnd(Builder->CreateAdd(Count, llvm::ConstantInt::get(IndexTy, 7)), llvm::ConstantInt::get(IndexTy, -8), "stride");
+    llvm::Value* Bytes = Builder->CreateMul(Stride, llvm::ConstantInt::get(IndexTy, R.Leaves.size() * sizeof(double)), "bytes");
+
+    llvm::FunctionCallee Alloc = TheModule->getOrInsertFunction("kaleidoscope_soa_alloc", llvm::FunctionType::get(Builder->getPtrTy(), { IndexTy }, false));
+    llvm::Value* Block = Builder->CreateCall(Alloc, { Bytes }, "block");
+
+    llvm::Value* Result = Builder->CreateInsertValue(llvm::UndefValue::get(R.Soa), Count, { 0 });
+    for (unsigned Leaf = 0; Leaf != R.Leaves.size(); ++Leaf) {
+        llvm::Value* Column = Builder->CreateInBoundsGEP(Builder->getDoubleTy(), Block, Builder->CreateMul(Stride, llvm::ConstantInt::get(IndexTy, Leaf)), "column");
+        Result = Builder->CreateInsertValue(Result, Column, { 1 + Leaf });
+    }
+    return Result;
+}
+
+// numeric constants represented as ConstantFPs, which holds an APFloat (float with arbitrary precision)
+llvm::Value *NumberExprAST::codegen() { // generating ir for numeric constants
+    return llvm::ConstantFP::get(*TheContext, llvm::APFloat(Value)); // creates and returns a ConstantFP
+}
+
+llvm::Value *BinaryExprAST::codegen() { // RECURSIVELY EMIT IR FOR LHS AND RHS
+    // evaluate the special case of an '=' token
+    if (Op == '=') {
+        return CodegenAssignment(LHS.get(), RHS.get()); // a variable, a field of one, or an element of a collection
+    }
+
 
 
-    llvm::Value *L = LHS->codegen(); // calls the codegen function on the lefthandside of the expression
-    llvm::Value *R = RHS->codegen(); // calls the codegen function on the righthand side
+    std::string Operand = std::string("An operand of '") + Op + "'"; // operators (builtin or user defined) work on numbers only
+    llvm::Value *L = ExpectNumber(LHS->codegen(), Operand); // calls the codegen function on the lefthandside of the expression
+    llvm::Value *R = ExpectNumber(RHS->codegen(), Operand); // calls the codegen function on the righthand side
     if (!L || !R) { // if the LHS or RHS evaluate to a nullptr, we have an error, so pass that back up as a nullptr
         return nullptr;
     }
@@ -88,6 +374,10 @@ llvm::Value *BinaryExprAST::codegen() { // RECURSIVELY EMIT IR FOR LHS AND RHS
             break; // means it is a user defined operator...
     }
 
+    if (FunctionAST* Operator = getInlinableOperator(std::string("binary") + Op)) { // if we have the body of the operator, expand it instead of calling it
+        return InlineOperator(*Operator, { L, R });
+    }
+
     llvm::Function* F = getFunction(std::string("binary") + Op); // looks for the defined function in the module symbol table
     assert(F && "binary operator not found."); 
 
@@ -100,11 +390,16 @@ llvm::Value *VariableExprAST::codegen() {
     if (!A) { // if the varibale isn't in the NamedValues table, throw an error
         LogErrorV("Undeclared variable name."); // pass a nullptr back 
     }
+    auto CI = ConstantSlots.find(A);
+    if (CI != ConstantSlots.end()) { // a parameter this copy of the function fixed (see specialize.h) => fold it right here
+        return llvm::ConstantFP::get(*TheContext, llvm::APFloat(CI->second));
+    }
     return Builder->CreateLoad(A->getAllocatedType(), A, Name.c_str()); // generates a load instruction for the variable A
 }
 
 llvm::Value *VarExprAST::codegen() {
     std::vector<llvm::AllocaInst*> OldBindings; // remeber the previous value of a variable that we replace
+    std::vector<llvm::Value*> Owned; // the collections created here
 
     llvm::Function* TheFunction = Builder->GetInsertBlock()->getParent(); // gets the functiton in which the block exists
 
@@ -112,17 +407,33 @@ llvm::Value *VarExprAST::codegen() {
         const std::string &VarName = VarNames[i].first; // extracts the variable name from the vector pair entry
         ExprAST *InitExpr = VarNames[i].second.get(); // gets the value of the expression corresponding to the name in the vector
     
+        llvm::Type* Declared = nullptr; // 'spawn z: complex' => the type the variable has to have
+        if (!VarTypes.empty() && !VarTypes[i].empty()) {
+            Declared = ResolveType(VarTypes[i]);
+            if (!Declared) {
+                return nullptr;
+            }
+        }
+
         llvm::Value* InitVal; // declare an initial value variable
         if (InitExpr) { // if there was an initial expressiond eclared in the declaration...
             InitVal = InitExpr->codegen(); // generate ir for that expression
             if (!InitVal) {
                 return nullptr; // if code generation failed, pass back a nullptr
             }
+            if (Declared && InitVal->getType() != Declared) {
+                return LogErrorV(("'" + VarName + "' is a " + TypeName(Declared) + ", but its initial value is a " + TypeName(InitVal->getType()) + ".").c_str());
+            }
+            if (dynamic_cast<SoaExprAST*>(InitExpr)) {
+                Owned.push_back(InitVal); // freed when the body is done
+            }
+        } else if (Declared && IsCollection(Declared)) {
+            return LogErrorV(("'" + VarName + "' needs a collection to hold => spawn " + VarName + " = soa " + RecordOf(Declared)->Declaration.Name + "(n)").c_str());
         } else {
-            InitVal = llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)); // if the value is unspecified, just set it to 0
+            InitVal = llvm::Constant::getNullValue(Declared ? Declared : llvm::Type::getDoubleTy(*TheContext)); // if the value is unspecified, just set it to 0 (every field of a record)
         }
 
-        llvm::AllocaInst* Allocation = CreateEntryBlockAllocation(TheFunction, VarName); // create a memory allocation in the function with the corresponding variable name
+        llvm::AllocaInst* Allocation = CreateEntryBlockAllocation(TheFunction, VarName, InitVal->getType()); // create a memory allocation in the function with the corresponding variable name
         Builder->CreateStore(InitVal, Allocation); // create a store instruction that stores the initial value at the allocation
 
         OldBindings.push_back(NamedValues[VarName]); // store the old variable binding for when we jump down the recursive call stack later and want to restore old variables...
@@ -134,6 +445,14 @@ llvm::Value *VarExprAST::codegen() {
     if (!BodyValue) { // if the body failed to evaluate, pass back a nullptr
         return nullptr;
     }
+    if (IsCollection(BodyValue->getType())) { // it could be one of ours, which is about to be freed
+        return LogErrorV("A 'spawn' can't evaluate to a soa collection.");
+    }
+
+    llvm::FunctionCallee Free = TheModule->getOrInsertFunction("kaleidoscope_soa_free", llvm::FunctionType::get(Builder->getVoidTy(), { Builder->getPtrTy() }, false));
+    for (llvm::Value* Collection : Owned) {
+        Builder->CreateCall(Free, { Builder->CreateExtractValue(Collection, { 1 }) }); // the first column starts the block
+    }
 
     for (unsigned i = 0, e = VarNames.size(); i != e; ++i) {
         NamedValues[VarNames[i].first] = OldBindings[i]; // reset the old bindings after we go out of scope
@@ -142,7 +461,83 @@ llvm::Value *VarExprAST::codegen() {
     return BodyValue; // return the actual value of the computation
 }
 
+// builtin math library => these names are lowered straight to llvm intrinsics instead of opaque calls into libc
+// the intrinsics carry the right attributes (no side effects, no errno), so llvm can constant fold them, vectorize them, or pick native instructions (sqrtsd, roundsd, ...)
+struct MathBuiltin {
+    llvm::Intrinsic::ID ID; // the intrinsic the call lowers to
+    unsigned NumArgs; // how many operands it takes
+};
+
+static const std::map<std::string, MathBuiltin> MathBuiltins = {
+    {"sqrt", {llvm::Intrinsic::sqrt, 1}},
+    {"fabs", {llvm::Intrinsic::fabs, 1}},
+    {"floor", {llvm::Intrinsic::floor, 1}},
+    {"ceil", {llvm::Intrinsic::ceil, 1}},
+    {"fma", {llvm::Intrinsic::fma, 3}},
+    {"sin", {llvm::Intrinsic::sin, 1}},
+    {"cos", {llvm::Intrinsic::cos, 1}},
+    {"exp", {llvm::Intrinsic::exp, 1}},
+    {"log", {llvm::Intrinsic::log, 1}},
+    {"pow", {llvm::Intrinsic::pow, 2}},
+    {"min", {llvm::Intrinsic::minnum, 2}},
+    {"max", {llvm::Intrinsic::maxnum, 2}},
+};
+
+// returns the builtin for a callee, unless the user wrote their own function with that name
+static const MathBuiltin* getMathBuiltin(const std::string& Callee, size_t NumArgs) {
+    auto BI = MathBuiltins.find(Callee);
+    if (BI == MathBuiltins.end() || BI->second.NumArgs != NumArgs) { // not a builtin, or called with the wrong arity (let the normal path report it)
+        return nullptr;
+    }
+
+    if (FunctionDefs.count(Callee)) { // a user 'def' always wins over the builtin ('decl' does not, that just names the libc version)
+        return nullptr;
+    }
+    llvm::Function* F = TheModule->getFunction(Callee);
+    if (F && !F->empty()) { // the function being defined right now has this name (recursive user definition)
+        return nullptr;
+    }
+
+    return &BI->second;
+}
+
+bool isMathBuiltin(const std::string& Name) {
+    return MathBuiltins.count(Name) && !FunctionDefs.count(Name);
+}
+
 llvm::Value *CallExprAST::codegen() { // WE CAN CALL NATIVE C FUNCTIONS BY DEFAULT!!!
+    auto RI = Records.find(Callee);
+    if (RI != Records.end()) { // complex(1, 2) => a record value, one argument per field
+        const RecordType& Record = RI->second;
+        if (Args.size() != Record.Declaration.Fields.size()) {
+            return LogErrorV(("Record '" + Callee + "' has " + std::to_string(Record.Declaration.Fields.size()) + " fields.").c_str());
+        }
+        llvm::Value* Result = llvm::UndefValue::get(Record.Struct);
+        for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+            llvm::Value* Field = Args[i]->codegen();
+            if (!Field) {
+                return nullptr;
+            }
+            llvm::Type* FieldTy = Record.Struct->getElementType(i);
+            if (Field->getType() != FieldTy) {
+                return LogErrorV(("Field '" + Record.Declaration.Fields[i].Name + "' of '" + Callee + "' is a " + TypeName(FieldTy) + ", not a " + TypeName(Field->getType()) + ".").c_str());
+            }
+            Result = Builder->CreateInsertValue(Result, Field, { i });
+        }
+        return Result;
+    }
+
+    if (const MathBuiltin* Builtin = getMathBuiltin(Callee, Args.size())) { // math builtins become intrinsics rather than external calls
+        std::vector<llvm::Value*> ArgsV;
+        for (auto &Arg : Args) {
+            ArgsV.push_back(ExpectNumber(Arg->codegen(), "An argument of '" + Callee + "'")); // generate ir for each operand
+            if (!ArgsV.back()) {
+                return nullptr;
+            }
+        }
+        return Builder->CreateIntrinsic(Builtin->ID, { llvm::Type::getDoubleTy(*TheContext) }, ArgsV, nullptr, "calltmp"); // the intrinsics are overloaded on the floating point type
+    }
+
     llvm::Function *CalleeF = getFunction(Callee); // grabs a function pointer to the Callee from the FunctionProtos table
     if (!CalleeF) { // if the function is not found...
         return LogErrorV("Function not found in module symbol table"); // throw an error and pass back a nullptr
@@ -158,14 +553,99 @@ llvm::Value *CallExprAST::codegen() { // WE CAN CALL NATIVE C FUNCTIONS BY DEFAU
         if (!ArgsV.back()) { // if the element hasn't been added, then the end of the vector is a nullptr because the ir hasn't been evauluated properly..
             return nullptr; // pass nullptr back (error-handling)
         }
+        llvm::Type* ParamTy = CalleeF->getFunctionType()->getParamType(i);
+        if (ArgsV.back()->getType() != ParamTy) {
+            return LogErrorV(("Argument " + std::to_string(i + 1) + " of '" + Callee + "' is a " + TypeName(ParamTy) + ", not a " + TypeName(ArgsV.back()->getType()) + ".").c_str());
+        }
+    }
+
+    if (llvm::Function* Specialized = SpecializeCall(Callee, ArgsV)) { // constant arguments => call a copy compiled for them (ArgsV keeps the others)
+        CalleeF = Specialized;
+    }
+
+    llvm::Function* TheFunction = Builder->GetInsertBlock()->getParent(); // the function making the call
+    if (uint64_t* Counters = ProfileCountersFor("call", TheFunction, getLoc())) {
+        EmitProfileIncrement(&Counters[0]); // count how often this call site runs
     }
 
-    return Builder->CreateCall(CalleeF, ArgsV, "calltmp"); // build a function call with pointer to the function name in the symbol table, and the vector of evaluated arguments
+    llvm::CallInst* Call = Builder->CreateCall(CalleeF, ArgsV, "calltmp"); // build a function call with pointer to the function name in the symbol table, and the vector of evaluated arguments
+
+    const uint64_t* Counts = ProfileCountsFor("call", TheFunction, getLoc());
+    if (Counts && Counts[0] == 0 && TheFunction->getEntryCount() && TheFunction->getEntryCount()->getCount() > 0) {
+        Call->addFnAttr(llvm::Attribute::Cold); // the caller ran but this call never did => keep it off the hot path (and don't inline it)
+    }
+    return Call;
+}
+
+// the arguments are stored in a stack array that the runtime copies into the task, so the call itself can happen later on any thread
+llvm::Value *AsyncExprAST::codegen() {
+    llvm::Function *CalleeF = getFunction(Call->getCallee());
+    if (!CalleeF) {
+        return LogErrorV("Function not found in module symbol table");
+    }
+    const auto &Args = Call->getArgs();
+    if (CalleeF->arg_size() != Args.size()) {
+        return LogErrorV("Incorrect number of arguments to function.");
+    }
+    if (Args.size() > MaxTaskArgs) {
+        return LogErrorV("Too many arguments for an async call.");
+    }
+    auto PI = FunctionProtos.find(Call->getCallee());
+    if (PI != FunctionProtos.end() && PI->second->hasRecords()) { // the task runtime passes and returns doubles
+        return LogErrorV("An async call can only pass and return numbers.");
+    }
+
+    llvm::Function* TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::Type* DoubleTy = llvm::Type::getDoubleTy(*TheContext);
+    llvm::ArrayType* ArgsTy = llvm::ArrayType::get(DoubleTy, std::max<size_t>(Args.size(), 1));
+    llvm::IRBuilder<> TmpBuilder(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin()); // allocas belong in the entry block (see CreateEntryBlockAllocation)
+    llvm::AllocaInst* ArgsArray = TmpBuilder.CreateAlloca(ArgsTy, nullptr, "asyncargs");
+
+    for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+        llvm::Value* ArgV = ExpectNumber(Args[i]->codegen(), "An argument of an async call");
+        if (!ArgV) {
+            return nullptr;
+        }
+        Builder->CreateStore(ArgV, Builder->CreateConstInBoundsGEP2_32(ArgsTy, ArgsArray, 0, i));
+    }
+
+    llvm::FunctionCallee Spawn = TheModule->getOrInsertFunction("kaleidoscope_async", llvm::FunctionType::get(DoubleTy, { Builder->getPtrTy(), Builder->getPtrTy(), Builder->getInt32Ty() }, false));
+    return Builder->CreateCall(Spawn, { CalleeF, ArgsArray, Builder->getInt32(Args.size()) }, "asynctmp");
+}
+
+llvm::Value *AwaitExprAST::codegen() {
+    llvm::Value* HandleV = ExpectNumber(Handle->codegen(), "The handle of an await");
+    if (!HandleV) {
+        return nullptr;
+    }
+
+    llvm::Type* DoubleTy = llvm::Type::getDoubleTy(*TheContext);
+    llvm::FunctionCallee Await = TheModule->getOrInsertFunction("kaleidoscope_await", llvm::FunctionType::get(DoubleTy, { DoubleTy }, false));
+    return Builder->CreateCall(Await, { HandleV }, "awaittmp");
 }
 
 llvm::Function *PrototypeAST::codegen() {
-    std::vector<llvm::Type*> Doubles(Args.size(), llvm::Type::getDoubleTy(*TheContext)); // creates a vector called Doubles that is passed the size of arguments for the prototype, and creates sets the ir to floating point types (ALL ARGS ARE DOUBLES)
-    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*TheContext), Doubles, false);  // creates an LLVM function type that sets the return type to a Double in terms of the context, and indicates that the function args list does not vary (false)
+    if (Records.count(Name)) { // Name(...) already builds the record
+        LogError(("'" + Name + "' is a record, it can't name a function too.").c_str());
+        return nullptr;
+    }
+    if (IsOperator && hasRecords()) { // operators are expanded where they are used, on numbers
+        LogError("Operators only take and return numbers.");
+        return nullptr;
+    }
+
+    std::vector<llvm::Type*> Params; // numbers unless the prototype names a record (see records.h)
+    for (size_t i = 0; i != Args.size(); ++i) {
+        Params.push_back(ResolveType(getArgType(i)));
+        if (!Params.back()) {
+            return nullptr;
+        }
+    }
+    llvm::Type* Result = ResolveType(ReturnType);
+    if (!Result) {
+        return nullptr;
+    }
+    llvm::FunctionType *FT = llvm::FunctionType::get(Result, Params, false);  // creates an LLVM function type with the return and parameter types, and indicates that the function args list does not vary (false)
     llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Name, TheModule.get()); // creates the llvm ir for the prototype, which indicates the type, name, which symbol table to define it in (TheModule), and the external linkage (MUST IT BE DEFINED IN THE SAME MODULE)
 
     unsigned Index = 0; // set an iterator
@@ -178,7 +658,7 @@ llvm::Function *PrototypeAST::codegen() {
 
 llvm::Function *FunctionAST::codegen() {
     auto &P = *Proto;
-    FunctionProtos[Proto->getName()] = std::move(Proto); // move ownership of the prototype into the prototype map
+    FunctionProtos[Proto->getName()] = std::make_unique<PrototypeAST>(*Proto); // copy the prototype into the prototype map (the definition keeps its own copy for later expansion)
     llvm::Function *TheFunction = getFunction(P.getName()); // TheFunction points to the function retrieved from the FunctionProtos map
  
     if (!TheFunction) { // if the function evaluates to a nullptr, pass it back up
@@ -194,13 +674,39 @@ llvm::Function *FunctionAST::codegen() {
 
     NamedValues.clear(); // clears named values in case they are defined globally, etc so that we don't get an error
     for (auto &Arg : TheFunction->args()) { // add arguments defined in the already ir-ified prototype, and put them into the NamedValues table
-        llvm::AllocaInst* Allocation = CreateEntryBlockAllocation(TheFunction, Arg.getName()); //  creates a stack allocation for an argument to a function (OCCURS IN FUNCTION ENTRY BLOCK!!!!)
+        llvm::AllocaInst* Allocation = CreateEntryBlockAllocation(TheFunction, Arg.getName(), Arg.getType()); //  creates a stack allocation for an argument to a function (OCCURS IN FUNCTION ENTRY BLOCK!!!!)
         Builder->CreateStore(&Arg, Allocation); // create a store instruction that puts the argument's initial value into the stack allocation
         NamedValues[std::string(Arg.getName())] = Allocation; // sets the the value of the argument name in the NamedValues map to the address of the allocation for that argument
 
     }
 
-    if (llvm::Value* ReturnVal = Body->codegen()) { // if we properly turn the body into llvm ir... => call codegen on the root expression of the function
+    ApplyFunctionProfile(TheFunction); // entry count and hot/cold attribute from a loaded profile
+    if (SamplerRunning()) {
+        TheFunction->addFnAttr("frame-pointer", "all"); // the sampler walks the frame pointer chain to find the callers
+    }
+    if (uint64_t* Counters = ProfileCountersFor("entry", TheFunction, {0, 0})) {
+        EmitProfileIncrement(&Counters[0]); // count calls to this function
+    }
+
+    int StatsId = InstrumentCalls && P.getName().rfind("__", 0) != 0 ? CallStatsId(P.getName()) : -1; // top level expressions and generated wrappers aren't user functions
+    llvm::FunctionType* HookType = llvm::FunctionType::get(Builder->getVoidTy(), { Builder->getInt32Ty() }, false);
+    if (StatsId >= 0) {
+        Builder->CreateCall(TheModule->getOrInsertFunction("kaleidoscope_enter", HookType), { Builder->getInt32(StatsId) });
+    }
+
+    llvm::Value* ReturnVal = Body->codegen(); // call codegen on the root expression of the function
+    if (ReturnVal && ReturnVal->getType() != TheFunction->getReturnType()) {
+        if (P.getName().rfind("__", 0) == 0) { // a top level expression (or a generated wrapper) => the host only ever gets numbers
+            LogError(("A top level expression has to evaluate to a number, not a " + TypeName(ReturnVal->getType()) + ".").c_str());
+        } else {
+            LogError(("'" + P.getName() + "' returns a " + TypeName(TheFunction->getReturnType()) + ", but its body is a " + TypeName(ReturnVal->getType()) + ".").c_str());
+        }
+        ReturnVal = nullptr;
+    }
+    if (ReturnVal) { // if we properly turn the body into llvm ir...
+        if (StatsId >= 0) {
+            Builder->CreateCall(TheModule->getOrInsertFunction("kaleidoscope_exit", HookType), { Builder->getInt32(StatsId) }); // the body is a single expression => this is the only way out
+        }
         Builder->CreateRet(ReturnVal); // create a return value in the builder that corresponds to the Return Value computed above => "completes the function"
         llvm::verifyFunction(*TheFunction); // validate generated ir => VERY VERY VERY IMPORTANT
         TheFPM->run(*TheFunction, *TheFAM); // run optimization passes
@@ -216,7 +722,7 @@ llvm::Function *FunctionAST::codegen() {
 }
 
 llvm::Value *IfExprAST::codegen(){
-    llvm::Value* CondV = Condition->codegen(); // generates llvm ir for the if condition expression
+    llvm::Value* CondV = ExpectNumber(Condition->codegen(), "The condition of an 'if'"); // generates llvm ir for the if condition expression
     if (!CondV) { // if the condition didn't evaluate correclty, pass back a nullptr
         return nullptr;
     }
@@ -232,10 +738,19 @@ llvm::Value *IfExprAST::codegen(){
 
     // *** THE THEN PART!!!
 
+    llvm::MDNode* Weights = nullptr; // how often each side was taken in a profiled run
+    if (const uint64_t* Counts = ProfileCountsFor("if", TheFunction, getLoc())) {
+        Weights = CreateProfileWeights(Counts[0], Counts[1]);
+    }
+    uint64_t* Counters = ProfileCountersFor("if", TheFunction, getLoc()); // {then, else} counters when instrumenting
+
     // NOTE THAT CONDV HOLDS A BOOLEAN => if we get a 1, go the ThenBasicBlock, otherwise go to the Else Basic Block
-    Builder->CreateCondBr(CondV, ThenBasicBlock, ElseBasicBlock); // creates a conditional branch in the llvm ir that goes to the then block if the conditon is true, and the else block if it is false
+    Builder->CreateCondBr(CondV, ThenBasicBlock, ElseBasicBlock, Weights); // creates a conditional branch in the llvm ir that goes to the then block if the conditon is true, and the else block if it is false
 
     Builder->SetInsertPoint(ThenBasicBlock); // moves the builder's insertion point to the Then Block to generate ir for that block
+    if (Counters) {
+        EmitProfileIncrement(&Counters[0]);
+    }
     llvm::Value* ThenV = Then->codegen(); // generates the llvm ir for the Then Block
     if(!ThenV) { // if it hasn't been evaluated properly, return a nullptr back up
         return nullptr;
@@ -252,6 +767,9 @@ llvm::Value *IfExprAST::codegen(){
 
     TheFunction->insert(TheFunction->end(), ElseBasicBlock); // adds the else block to the function itself
     Builder->SetInsertPoint(ElseBasicBlock); // moves the builder's insertion point to the else block for it generation
+    if (Counters) {
+        EmitProfileIncrement(&Counters[1]);
+    }
 
     llvm::Value* ElseV = Else->codegen(); // generate llvm ir for the Else statement
     if (!ElseV) { // if the else expression block evaluated to a nullptr, pass the nullptr back up and unwind...
@@ -266,7 +784,10 @@ llvm::Value *IfExprAST::codegen(){
     TheFunction->insert(TheFunction->end(), MergeBasicBlock); // adding the merge block at the end of the function
     Builder->SetInsertPoint(MergeBasicBlock); // set the new insertion point of the builder to where the MergeBasicBlock begins
 
-    llvm::PHINode* PN = Builder->CreatePHI(llvm::Type::getDoubleTy(*TheContext), 2, "iftmp"); // specifies that the phinode will choose from 2 possible values
+    if (ThenV->getType() != ElseV->getType()) { // either branch may be a record, as long as it is the same one
+        return LogErrorV(("The branches of an 'if' are a " + TypeName(ThenV->getType()) + " and a " + TypeName(ElseV->getType()) + ".").c_str());
+    }
+    llvm::PHINode* PN = Builder->CreatePHI(ThenV->getType(), 2, "iftmp"); // specifies that the phinode will choose from 2 possible values
 
     // IT CHOOSES BASED ON WHETHER CONTROL FLOW CAME FROM THE THEN OR ELSE BLOCK AND PICKS THE CORRECT ONE!!!
     PN->addIncoming(ThenV, ThenBasicBlock); // adds the llvm ir and the end of the Then block to the phi node (functionally adding a single possibility)
@@ -274,12 +795,245 @@ llvm::Value *IfExprAST::codegen(){
     return PN;
 }
 
+// turns loop hints into the llvm.loop metadata the loop passes read => nullptr when there are none
+// whatever a pass couldn't honor is reported by the WarnMissedTransformations pass at the end of the pipeline
+static llvm::MDNode* CreateLoopHintMetadata(const LoopHints& Hints) {
+    if (Hints.empty()) {
+        return nullptr;
+    }
+
+    std::vector<llvm::Metadata*> Operands = { nullptr }; // a loop id starts with a reference to itself (filled in below)
+    auto AddHint = [&Operands](const char* Name, llvm::Constant* Value) {
+        std::vector<llvm::Metadata*> Hint = { llvm::MDString::get(*TheContext, Name) };
+        if (Value) {
+            Hint.push_back(llvm::ConstantAsMetadata::get(Value));
+        }
+        Operands.push_back(llvm::MDNode::get(*TheContext, Hint));
+    };
+
+    if (Hints.Unroll == 1) {
+        AddHint("llvm.loop.unroll.disable", nullptr);
+    } else if (Hints.Unroll) {
+        AddHint("llvm.loop.unroll.count", Builder->getInt32(Hints.Unroll));
+    }
+    if (Hints.VectorizeWidth) {
+        AddHint("llvm.loop.vectorize.width", Builder->getInt32(Hints.VectorizeWidth)); // a width of 1 turns vectorization off
+        if (Hints.VectorizeWidth > 1) {
+            AddHint("llvm.loop.vectorize.enable", Builder->getTrue()); // also lets the vectorizer reorder floating point reductions
+        }
+    }
+    if (Hints.Interleave) {
+        AddHint("llvm.loop.interleave.count", Builder->getInt32(Hints.Interleave));
+    }
+
+    llvm::MDNode* LoopID = llvm::MDNode::getDistinct(*TheContext, Operands);
+    LoopID->replaceOperandWith(0, LoopID);
+    return LoopID;
+}
+
+// COUNTED LOOPS => the general lowering below keeps a double iterator in memory, adds the step with an fadd and tests an arbitrary condition
+// after the body, so llvm can't work out how many times it runs (and won't vectorize or unroll it)
+// loops of the shape 'for i = a, i < b, s' where a and s are integer constants (s > 0, literals or specialized parameters), b is a number or a variable the loop never assigns
+// (possibly plus or minus a whole number, like ps.size - 1), and the body never assigns i, get an integer induction variable with a trip count computed up front instead
+// a literal, or a parameter that the copy of the function being compiled fixed to a constant (see specialize.h)
+static bool ConstantOperand(const ExprAST* E, double &Value) {
+    if (auto* Number = dynamic_cast<const NumberExprAST*>(E)) {
+        Value = Number->getValue();
+        return true;
+    }
+    auto* Variable = dynamic_cast<const VariableExprAST*>(E);
+    if (!Variable) {
+        return false;
+    }
+    auto VI = NamedValues.find(Variable->getName());
+    if (VI == NamedValues.end()) {
+        return false;
+    }
+    auto CI = ConstantSlots.find(VI->second);
+    if (CI == ConstantSlots.end()) {
+        return false;
+    }
+    Value = CI->second;
+    return true;
+}
+
+static bool IsInteger(double X) {
+    return X == std::trunc(X) && std::fabs(X) <= 9007199254740992.0; // exact in a double (2^53)
+}
+
+// a number, n, or ps.size / box.n (a field of a variable the loop never assigns) => with Offset, also one of those plus or minus a whole
+// number (the builtin '+' and '-' of something loop invariant is loop invariant too, and the whole bound is evaluated once up front)
+static bool InvariantBound(ExprAST* E, const std::string& VarName, const std::set<std::string>& Assigned, bool Offset) {
+    if (dynamic_cast<const NumberExprAST*>(E)) {
+        return true;
+    }
+    auto* Sum = dynamic_cast<const BinaryExprAST*>(E);
+    if (Offset && Sum && (Sum->getOp() == '+' || Sum->getOp() == '-')) {
+        auto* Constant = dynamic_cast<const NumberExprAST*>(Sum->getRHS());
+        auto* Left = dynamic_cast<const NumberExprAST*>(Sum->getLHS());
+        if (Constant && IsInteger(Constant->getValue())) { // b + k, b - k
+            return InvariantBound(Sum->getLHS(), VarName, Assigned, false);
+        }
+        return Left && IsInteger(Left->getValue()) && Sum->getOp() == '+' && InvariantBound(Sum->getRHS(), VarName, Assigned, false); // k + b
+    }
+    std::vector<std::string> Fields;
+    auto* Bound = dynamic_cast<const VariableExprAST*>(FieldPath(E, Fields));
+    return Bound && Bound->getName() != VarName && !Assigned.count(Bound->getName());
+}
+
+bool ForExprAST::isCountedLoop(double &StartValue, double &StepValue) const {
+
+    if (!ConstantOperand(Start.get(), StartValue) || !IsInteger(StartValue)) {
+        return false;
+    }
+
+    StepValue = 1.0; // the default step
+    if (Step) {
+        auto* StepVariable = dynamic_cast<const VariableExprAST*>(Step.get());
+        if (StepVariable && StepVariable->getName() == VarName) { // the step is evaluated with the iterator in scope
+            return false;
+        }
+        if (!ConstantOperand(Step.get(), StepValue) || !IsInteger(StepValue) || StepValue <= 0) {
+            return false;
+        }
+    }
+
+    auto* Condition = dynamic_cast<const BinaryExprAST*>(End.get());
+    if (!Condition || Condition->getOp() != '<') {
+        return false;
+    }
+    auto* Iterator = dynamic_cast<const VariableExprAST*>(Condition->getLHS());
+    if (!Iterator || Iterator->getName() != VarName) {
+        return false;
+    }
+
+    std::set<std::string> Assigned; // the iterator and the bound have to stay put while the loop runs
+    Body->collectAssigned(Assigned);
+    if (Assigned.count(VarName)) {
+        return false;
+    }
+    return InvariantBound(Condition->getRHS(), VarName, Assigned, true);
+}
+
+// same semantics as the general lowering => the body runs, then the condition is tested with the value i had in that trip, and i takes the
+// values a, a + s, a + 2s, ... exactly, so after trip k it goes on while a + k*s < b  <=>  a + k*s < ceil(b)
+// => trip count = 1 + ceil((ceil(b) - a) / s) when ceil(b) > a, else 1 (the last trip sees the first i at or past the bound), all in integers
+llvm::Value* ForExprAST::codegenCounted(double StartValue, double StepValue) {
+    llvm::Function* TheFunction = Builder->GetInsertBlock()->getParent();
+    llvm::Type* DoubleTy = llvm::Type::getDoubleTy(*TheContext);
+    llvm::Type* IndexTy = Builder->getInt64Ty();
+
+    llvm::AllocaInst* Allocation = CreateEntryBlockAllocation(TheFunction, VarName); // the body still reads the iterator through a variable (mem2reg cleans it up)
+
+    // the bound can't change while the loop runs (isCountedLoop checked that), so it is evaluated once up front
+    llvm::Value* BoundValue = ExpectNumber(static_cast<BinaryExprAST*>(End.get())->getRHS()->codegen(), "The bound of a 'for'");
+    if (!BoundValue) {
+        return nullptr;
+    }
+
+    // a NaN or +inf bound never makes 'i < b' false => the general lowering (and the interpreter) loop forever, while the trip count below
+    // would clamp it, so those bounds take the general lowering at runtime (a constant bound is known to be fine)
+    llvm::BasicBlock* DoneBasicBlock = nullptr;
+    auto* ConstantBound = llvm::dyn_cast<llvm::ConstantFP>(BoundValue);
+    if (!ConstantBound || ConstantBound->isNaN() || ConstantBound->isInfinity()) {
+        llvm::BasicBlock* CountedBasicBlock = llvm::BasicBlock::Create(*TheContext, "counted", TheFunction);
+        llvm::BasicBlock* GeneralBasicBlock = llvm::BasicBlock::Create(*TheContext, "uncounted", TheFunction);
+        DoneBasicBlock = llvm::BasicBlock::Create(*TheContext, "fordone", TheFunction);
+        llvm::Value* Finite = Builder->CreateFCmpOLT(BoundValue, llvm::ConstantFP::getInfinity(DoubleTy), "countable"); // false for NaN and +inf
+        Builder->CreateCondBr(Finite, CountedBasicBlock, GeneralBasicBlock, CreateProfileWeights(1, 0));
+
+        Builder->SetInsertPoint(GeneralBasicBlock);
+        if (!codegenGeneral()) {
+            return nullptr;
+        }
+        Builder->CreateBr(DoneBasicBlock);
+        Builder->SetInsertPoint(CountedBasicBlock);
+    }
+    llvm::Value* StartFP = llvm::ConstantFP::get(DoubleTy, StartValue);
+    llvm::Value* Ceiling = Builder->CreateUnaryIntrinsic(llvm::Intrinsic::ceil, BoundValue, nullptr, "bound");
+    Ceiling = Builder->CreateBinaryIntrinsic(llvm::Intrinsic::maxnum, Ceiling, StartFP); // a bound at or below the start => just the one trip
+    Ceiling = Builder->CreateBinaryIntrinsic(llvm::Intrinsic::minnum, Ceiling, llvm::ConstantFP::get(DoubleTy, 9007199254740992.0)); // past 2^53 the iterator could not advance anymore
+    llvm::Value* Span = Builder->CreateFPToSI(Builder->CreateFSub(Ceiling, StartFP), IndexTy, "span"); // exact => both are integers
+    llvm::Value* StepIndex = llvm::ConstantInt::get(IndexTy, (uint64_t)StepValue);
+    llvm::Value* Tests = Builder->CreateUDiv(Builder->CreateAdd(Span, llvm::ConstantInt::get(IndexTy, (uint64_t)StepValue - 1)), StepIndex, "passes"); // tests that go on (0 when the span is)
+    llvm::Value* TripCount = Builder->CreateAdd(Tests, llvm::ConstantInt::get(IndexTy, 1), "tripcount", /*HasNUW*/ true, /*HasNSW*/ true); // plus the trip whose test stops it
+
+    uint64_t* Counters = ProfileCountersFor("for", TheFunction, getLoc()); // same counters as the general lowering
+    if (Counters) {
+        EmitProfileIncrement(&Counters[0]);
+    }
+
+    llvm::BasicBlock* PreheaderBasicBlock = Builder->GetInsertBlock();
+    llvm::BasicBlock* LoopBasicBlock = llvm::BasicBlock::Create(*TheContext, "loop", TheFunction);
+    Builder->CreateBr(LoopBasicBlock);
+    Builder->SetInsertPoint(LoopBasicBlock);
+
+    llvm::PHINode* Index = Builder->CreatePHI(IndexTy, 2, "index"); // 0, 1, 2, ... => the induction variable llvm sees
+    Index->addIncoming(llvm::ConstantInt::get(IndexTy, 0), PreheaderBasicBlock);
+    if (Counters) {
+        EmitProfileIncrement(&Counters[1]);
+    }
+
+    llvm::Value* Iterator = Builder->CreateFAdd(StartFP, Builder->CreateFMul(Builder->CreateSIToFP(Index, DoubleTy), llvm::ConstantFP::get(DoubleTy, StepValue)), VarName); // start + index * step (exact)
+    Builder->CreateStore(Iterator, Allocation);
+
+    llvm::AllocaInst* OldValue = NamedValues[VarName]; // shadow an outer variable with the same name, like the general lowering
+    NamedValues[VarName] = Allocation;
+    CountedIndices[Allocation] = Builder->CreateAdd(llvm::ConstantInt::get(IndexTy, (int64_t)StartValue), Builder->CreateMul(Index, StepIndex, "", false, true), "", false, true); // ps[i] indexes with this directly
+
+    llvm::Value* BodyV = Body->codegen();
+    CountedIndices.erase(Allocation);
+    if (!BodyV) {
+        return nullptr;
+    }
+
+    llvm::Value* NextIndex = Builder->CreateAdd(Index, llvm::ConstantInt::get(IndexTy, 1), "nextindex", /*HasNUW*/ true, /*HasNSW*/ true);
+    Index->addIncoming(NextIndex, Builder->GetInsertBlock()); // the body may have ended in a different block
+    llvm::Value* Continue = Builder->CreateICmpULT(NextIndex, TripCount, "forcond");
+
+    llvm::BasicBlock* AfterLoopBasicBlock = llvm::BasicBlock::Create(*TheContext, "afterloop", TheFunction);
+    llvm::MDNode* Weights = nullptr;
+    if (const uint64_t* Counts = ProfileCountsFor("for", TheFunction, getLoc())) {
+        Weights = CreateProfileWeights(Counts[1] > Counts[0] ? Counts[1] - Counts[0] : 0, Counts[0]);
+    }
+    llvm::BranchInst* Latch = Builder->CreateCondBr(Continue, LoopBasicBlock, AfterLoopBasicBlock, Weights);
+    if (llvm::MDNode* LoopID = CreateLoopHintMetadata(Hints)) {
+        Latch->setMetadata(llvm::LLVMContext::MD_loop, LoopID);
+    }
+    Builder->SetInsertPoint(AfterLoopBasicBlock);
+    if (DoneBasicBlock) {
+        DoneBasicBlock->moveAfter(AfterLoopBasicBlock); // keeps the blocks in source order
+        Builder->CreateBr(DoneBasicBlock);
+        Builder->SetInsertPoint(DoneBasicBlock);
+    }
+
+    if (OldValue) {
+        NamedValues[VarName] = OldValue;
+    } else {
+        NamedValues.erase(VarName);
+    }
+
+    return llvm::Constant::getNullValue(DoubleTy);
+}
+
 llvm::Value* ForExprAST::codegen() {
+    double CountedStart, CountedStep;
+    if (CountedLoops && isCountedLoop(CountedStart, CountedStep)) {
+        return codegenCounted(CountedStart, CountedStep);
+    }
+    if (!Hints.empty()) {
+        std::string Message = "the loop at " + std::to_string(getLoc().Line) + ":" + std::to_string(getLoc().Col) + " is not a counted loop (integer start and step, invariant '<' bound, optionally plus or minus a whole number), so its hints will likely be ignored.";
+        LogWarning(Message.c_str());
+    }
+    return codegenGeneral();
+}
+
+llvm::Value* ForExprAST::codegenGeneral() {
     llvm::Function* TheFunction = Builder->GetInsertBlock()->getParent(); // gets the current function, which holds the for loop itse;f
 
     llvm::AllocaInst* Allocation = CreateEntryBlockAllocation(TheFunction, VarName); // creates a memory allocation for the iterator variable
 
-    llvm::Value* StartValue = Start->codegen(); // generate ir for the initialization of the iterator
+    llvm::Value* StartValue = ExpectNumber(Start->codegen(), "The start of a 'for'"); // generate ir for the initialization of the iterator
     if (!StartValue) { // if we failed to generate ir for the startvalue, pass an error back up
         return nullptr;
     }
@@ -287,11 +1041,19 @@ llvm::Value* ForExprAST::codegen() {
     Builder->CreateStore(StartValue, Allocation); // creates a store instruction that stores the start value of the iterator at the location in memory it is allocated
     llvm::BasicBlock* LoopBasicBlock = llvm::BasicBlock::Create(*TheContext, "loop", TheFunction); // creatin a new basic block in the current function which corresponds to the function
 
+    uint64_t* Counters = ProfileCountersFor("for", TheFunction, getLoc()); // {entries, iterations} counters when instrumenting
+    if (Counters) {
+        EmitProfileIncrement(&Counters[0]); // count how often we enter the loop
+    }
+
     // for execution
     Builder->CreateBr(LoopBasicBlock); // jumps straight into the loop block
 
     // for further code insertion (comppiler use...)
     Builder->SetInsertPoint(LoopBasicBlock); // sets where new instructions will be inserted
+    if (Counters) {
+        EmitProfileIncrement(&Counters[1]); // count every trip through the body
+    }
 
     // this allows variable shadowing, so we hold the old value of the variable, and temporarily insert the iterator into the named values map
     /* Consider...
@@ -314,7 +1076,7 @@ llvm::Value* ForExprAST::codegen() {
 
     llvm::Value* StepValue = nullptr; // initialize the StepValue to a nullptr to start
     if (Step) { // if we have defined a step in the for loop header...
-        StepValue = Step->codegen(); // generate ir for the declared step value
+        StepValue = ExpectNumber(Step->codegen(), "The step of a 'for'"); // generate ir for the declared step value
         if (!StepValue) { // if we unsuccessfully create ir for the declared step value, pass back a nullptr
             return nullptr;
         }
@@ -323,7 +1085,7 @@ llvm::Value* ForExprAST::codegen() {
     }
 
     // *** EVALUATING THE END CONDITION
-    llvm::Value* EndCondition = End->codegen(); // generate ir for the end condition of the loop
+    llvm::Value* EndCondition = ExpectNumber(End->codegen(), "The condition of a 'for'"); // generate ir for the end condition of the loop
     if (!EndCondition) { // if the end condition isn't evalutated to llvm ir properly, pass back a nullptr
         return nullptr;
     }
@@ -342,7 +1104,14 @@ llvm::Value* ForExprAST::codegen() {
         if (EndCondition) => branch to the basic loop (slightly inverted logic because of the comparison of floats above)
         if (!EndCondition) => branch to the AfterLoop block, which is where control flow should go when we want to exit the loop
     */
-    Builder->CreateCondBr(EndCondition, LoopBasicBlock, AfterLoopBasicBlock);
+    llvm::MDNode* Weights = nullptr; // back edge vs exit => llvm derives the estimated trip count of the loop from these
+    if (const uint64_t* Counts = ProfileCountsFor("for", TheFunction, getLoc())) {
+        Weights = CreateProfileWeights(Counts[1] > Counts[0] ? Counts[1] - Counts[0] : 0, Counts[0]);
+    }
+    llvm::BranchInst* Latch = Builder->CreateCondBr(EndCondition, LoopBasicBlock, AfterLoopBasicBlock, Weights);
+    if (llvm::MDNode* LoopID = CreateLoopHintMetadata(Hints)) { // still attached, but without a trip count the passes can rarely act on them
+        Latch->setMetadata(llvm::LLVMContext::MD_loop, LoopID);
+    }
     
     Builder->SetInsertPoint(AfterLoopBasicBlock); // set the instruction insertion point to the spot after the loop, thus allowing us to continue building ir in the correct spot where contol flow is passed...
 
@@ -356,11 +1125,15 @@ llvm::Value* ForExprAST::codegen() {
 }
 
 llvm::Value* UnaryExprAST::codegen() {
-    llvm::Value* OperandV = Operand->codegen(); // generate llvm ir for the expression that the unary operator is acting on...
+    llvm::Value* OperandV = ExpectNumber(Operand->codegen(), std::string("The operand of '") + Operator + "'"); // generate llvm ir for the expression that the unary operator is acting on...
     if (!OperandV) { // if the code generation of the operand failed, pass back a nullptr
         return nullptr;
     }
 
+    if (FunctionAST* Definition = getInlinableOperator(std::string("unary") + Operator)) { // expand the operator body in place when we have it
+        return InlineOperator(*Definition, { OperandV });
+    }
+
     llvm::Function* F = getFunction(std::string("unary") + Operator); // checks if the function has been defined, and get a pointer to it from the module
     if (!F) { // the function is undefined, throw a nullptr back up
         return LogErrorV("Undefined unary operator.");
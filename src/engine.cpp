@@ -0,0 +1,383 @@
+#include "../include/kaleidoscope/engine.h"
+
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+#include "../include/kaleidoscope/parser.h"
+#include "../include/kaleidoscope/lexer.h"
+#include "../include/kaleidoscope/codegen.h"
+#include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/batch.h"
+#include "../include/kaleidoscope/sampler.h"
+#include "../include/kaleidoscope/call_stats.h"
+#include "../include/kaleidoscope/watch.h"
+#include "../include/kaleidoscope/native_symbols.h"
+#include "../include/kaleidoscope/library.h"
+#include "../include/kaleidoscope/interpreter.h"
+#include "../include/kaleidoscope/server.h"
+#include "../include/kaleidoscope/remote.h"
+#include "../include/kaleidoscope/specialize.h"
+
+namespace kaleidoscope {
+
+static bool EngineAlive = false; // the compiler state is global, so we only allow one engine at a time
+
+Engine::Engine(const EngineOptions& Options) : Options(Options) {
+    if (EngineAlive) { // a second engine would share (and then tear down) the first one's jit, modules and symbol tables
+        throw std::logic_error("only one kaleidoscope::Engine may exist at a time");
+    }
+    EngineAlive = true;
+
+    static std::once_flag TargetsInitialized; // llvm's target registry only needs to be set up once per process
+    std::call_once(TargetsInitialized, [] {
+        llvm::InitializeNativeTarget(); // checks the target architecture on the local host
+        llvm::InitializeNativeTargetAsmPrinter(); // initializes a native assembly printer
+        llvm::InitializeNativeTargetAsmParser(); // initializes a native assembly parser
+    });
+
+    // indicate our operator precedence
+    BinOpPrecedence['='] = 2;
+    BinOpPrecedence['<'] = 10;
+    BinOpPrecedence['+'] = 20;
+    BinOpPrecedence['-'] = 30;
+    BinOpPrecedence['*'] = 40;
+    BinOpPrecedence['/'] = 50;
+
+    if (!SetRuntimeOutput(Options.Output)) {
+        LogError(("Could not open output '" + Options.Output + "'.").c_str());
+        Ok = false;
+    }
+    ProfileGeneratePath = Options.ProfileGeneratePath;
+    ParallelThreads = Options.ParallelThreads;
+    CacheTopLevelExpressions = Options.CacheExpressions;
+    SpecializeCalls = Options.Specialize;
+    CheckBounds = Options.CheckBounds;
+    if (!ParseExecutionTier(Options.Tier, TopLevelTier)) {
+        LogError(("Unknown tier '" + Options.Tier + "' (auto, interp or jit).").c_str());
+        Ok = false;
+    }
+    if (!Options.ProfileUsePath.empty() && !ReadProfile(Options.ProfileUsePath)) {
+        LogError(("Could not read profile '" + Options.ProfileUsePath + "'.").c_str());
+        Ok = false;
+    }
+
+    TaskWorkers = Options.TaskWorkers;
+
+    if (!Options.ObjectPath.empty() || !Options.BitcodePath.empty()) { // ahead of time => InitializeSession picks up the target from here
+        InitializeObjectTargets();
+        ObjectOutputPath = Options.ObjectPath;
+        BitcodeOutputPath = Options.BitcodePath;
+        RecordSource = EmittingBitcode(); // the library stores the text of every definition
+        TargetTriple = Options.TargetTriple;
+        TargetCPU = Options.TargetCPU;
+        TargetFeatures = Options.TargetFeatures;
+        if (!ProfileGeneratePath.empty()) { // the counters live in this process, the object's code never will
+            LogError("--profile-generate can't instrument an object file, ignoring it.");
+            ProfileGeneratePath.clear();
+        }
+    }
+
+    bool Measure = true; // the profilers read counters and samples of code running in this process
+    if (Options.Executors > 0 && !EmittingObject()) { // everything that reads or calls the code from this process is off
+        NumExecutors = Options.Executors;
+        ExecutorPath = Options.ExecutorPath;
+        ExecutorOutput = Options.Output == "stdout" ? "stdout" : "stderr";
+        TopLevelTier = ExecutionTier::JIT; // the interpreter calls jitted functions natively
+        if (!ProfileGeneratePath.empty() || Options.InstrumentCalls || Options.SampleProfile) {
+            LogError("--profile-generate, --instrument-calls and --profile measure code in this process, ignoring them with --executors.");
+            ProfileGeneratePath.clear();
+            Measure = false;
+        }
+    }
+
+    InstrumentCalls = Measure && Options.InstrumentCalls && !EmittingObject(); // same for the call counters
+    if (InstrumentCalls) {
+        StartCallStats();
+    }
+
+    if (RemoteExecution() && !StartExecutors()) { // executor 0's jit becomes TheJIT, with the executor's builtins bound
+        LogError("Running the jitted code in this process instead.");
+        StopExecutors();
+        NumExecutors = 0;
+    }
+    if (!RemoteExecution()) {
+        TheJIT = ExitOnErr(llvm::orc::KaleidoscopeJIT::Create());
+        RegisterBuiltinSymbols(); // the jit doesn't search the process => every native function it may call is bound up front
+    }
+    for (auto &Path : Options.Libraries) {
+        LoadNativeLibrary(Path);
+    }
+    if (Measure && Options.SampleProfile && StartSampler(Options.SamplesPerSecond)) {
+        TheJIT->registerEventListener(SamplerSymbolListener()); // address ranges of everything the jit loads from now on
+    }
+    InitializeSession();
+}
+
+Engine::~Engine() {
+    StopTaskRuntime(); // the workers may still be running jitted code
+    RuntimeFlush(); // make sure all buffered script output is written
+
+    if (InstrumentCalls) { // every worker is joined => all counters are final
+        PrintCallStats(stderr);
+        if (!Options.CallStatsPath.empty() && !WriteCallStatsJSON(Options.CallStatsPath)) {
+            LogError(("Could not write call stats '" + Options.CallStatsPath + "'.").c_str());
+        }
+        InstrumentCalls = false;
+    }
+
+    if (SamplerRunning()) { // the report only needs the recorded ranges, so it can go before the jit does
+        StopSampler();
+        PrintFlatProfile(stderr);
+        if (!Options.SampleStacksPath.empty() && !WriteCollapsedStacks(Options.SampleStacksPath)) {
+            LogError(("Could not write stacks '" + Options.SampleStacksPath + "'.").c_str());
+        }
+    }
+
+    if (!ProfileGeneratePath.empty() && !WriteProfile(ProfileGeneratePath)) { // dump the counters of an instrumented run
+        LogError(("Could not write profile '" + ProfileGeneratePath + "'.").c_str());
+    }
+    ProfileGeneratePath.clear();
+    ParallelThreads = 0;
+    TaskWorkers = 0;
+    CacheTopLevelExpressions = true;
+    SpecializeCalls = true;
+    CheckBounds = true;
+    CountedLoops = true;
+    TopLevelTier = ExecutionTier::Auto;
+    ObjectOutputPath.clear();
+    BitcodeOutputPath.clear();
+    RecordSource = false;
+    TargetTriple.clear();
+    TargetCPU.clear();
+    TargetFeatures.clear();
+
+    // drop everything the session knew about, so a new engine starts from scratch
+    FunctionDefs.clear();
+    FunctionProtos.clear();
+    NamedValues.clear();
+    BinOpPrecedence.clear();
+    ClearExpressionCache(); // the cached code lives in the jit, so it has to go before the jit does
+    ClearSpecializations();
+    ResetRecords(); // the struct types belong to the context that goes away below
+    FunctionVersions.clear();
+
+    TheFPM.reset(); // pass managers first (they refer to the context)
+    TheMAM.reset();
+    TheCGAM.reset();
+    TheFAM.reset();
+    TheLAM.reset();
+    TheSI.reset();
+    TheTM.reset();
+    ThePIC.reset();
+    Builder.reset();
+    TheModule.reset();
+    TheContext = nullptr;
+    TheTSC = llvm::orc::ThreadSafeContext(); // the jit may still share the context, so it is freed once the last owner lets go
+    TheJIT.reset(); // ends the jit session and frees all compiled code
+    StopExecutors(); // and the other executors' sessions (their processes exit)
+    NumExecutors = 0;
+    ResetWatchState(); // the stubs --watch called through
+    ResetNativeSymbols(); // no jitted code is left to call into the libraries
+    ResetImports();
+    ResetInterpreter();
+    ResetProfile(); // the counters' addresses were baked into code that is gone now
+    ResetCodegenState();
+    CurTok = 0; // the next engine's first load primes its own token
+
+    EngineAlive = false;
+}
+
+bool Engine::loadSource(const std::string& Source) {
+    std::istringstream Stream(Source);
+    return loadStream(Stream);
+}
+
+bool Engine::loadFile(const std::string& Path) {
+    std::ifstream File(Path);
+    if (!File) {
+        LogError(("Could not open '" + Path + "'.").c_str());
+        return false;
+    }
+    return loadStream(File);
+}
+
+bool Engine::loadStream(std::istream& Stream) {
+    unsigned ErrorsBefore = NumErrors; // so we can tell whether this load reported anything
+
+    input = &Stream; // point the lexer at the new source
+    ResetLexer();
+    if (input == &std::cin) {
+        fprintf(stderr, ">> "); // prime the inital token
+    }
+
+    getNextToken(); // go the the next one...
+    MainLoop(); // run the main interpreter loop until the stream runs out
+    input = nullptr;
+
+    return NumErrors == ErrorsBefore;
+}
+
+bool Engine::watchFile(const std::string& Path) {
+    if (RemoteExecution()) { // the reload stubs are patched in this process
+        LogError("--watch needs the jitted code in this process, it can't be combined with executors.");
+        return false;
+    }
+    SpecializeCalls = false; // a reload repoints the stub of a name => a specialized copy of the old body would keep running
+    unsigned ErrorsBefore = NumErrors;
+    return WatchFile(Path) && NumErrors == ErrorsBefore;
+}
+
+void* Engine::lookupAddress(const std::string& Name, unsigned NumArgs) {
+    if (RemoteExecution()) {
+        LogError(("'" + Name + "' lives in an executor process, it can't be called from here.").c_str());
+        return nullptr;
+    }
+    auto PI = FunctionProtos.find(Name);
+    if (PI == FunctionProtos.end()) {
+        LogError(("Unknown function '" + Name + "'.").c_str());
+        return nullptr;
+    }
+    if (PI->second->hasRecords()) { // the host api passes doubles
+        LogError(("Function '" + Name + "' takes or returns records, it can only be called from other definitions.").c_str());
+        return nullptr;
+    }
+    if (PI->second->getArgs().size() != NumArgs) { // the pointer type the host asked for has to match the kaleidoscope signature
+        LogError(("Function '" + Name + "' takes " + std::to_string(PI->second->getArgs().size()) + " arguments.").c_str());
+        return nullptr;
+    }
+
+    auto Symbol = TheJIT->lookup(Name); // materializes the function if it hasn't been compiled yet
+    if (!Symbol) {
+        LogError(llvm::toString(Symbol.takeError()).c_str());
+        return nullptr;
+    }
+    return Symbol->getAddress().toPtr<void*>();
+}
+
+bool Engine::registerCallbackAddress(const std::string& Name, void* Address, unsigned NumArgs) {
+    if (!DefineNativeSymbol(Name, Address)) { // the jit resolves the name straight to the host function
+        return false;
+    }
+
+    std::vector<std::string> ArgNames; // give the prototype placeholder parameter names
+    for (unsigned i = 0; i != NumArgs; ++i) {
+        ArgNames.push_back("arg" + std::to_string(i));
+    }
+    FunctionProtos[Name] = std::make_unique<PrototypeAST>(Name, std::move(ArgNames)); // acts like an implicit 'decl'
+    NoteFunctionChanged(Name);
+    return true;
+}
+
+bool Engine::loadLibrary(const std::string& Path) {
+    return LoadNativeLibrary(Path);
+}
+
+bool Engine::evaluateBatch(const std::string& Name, const std::vector<const double*>& Columns, double* Out, size_t Count) {
+    if (RemoteExecution()) {
+        LogError("Batch evaluation runs the code in this process, it isn't available with executors.");
+        return false;
+    }
+    auto PI = FunctionProtos.find(Name);
+    if (PI == FunctionProtos.end() || PI->second->getArgs().size() != Columns.size()) { // one column per parameter
+        LogError(("Batch evaluation of '" + Name + "' needs one input column per parameter.").c_str());
+        return false;
+    }
+    if (PI->second->hasRecords()) {
+        LogError(("Function '" + Name + "' takes or returns records, it can't be evaluated over columns of numbers.").c_str());
+        return false;
+    }
+
+    BatchFunction Batch = GetBatchFunction(Name);
+    if (!Batch) {
+        return false;
+    }
+    Batch(Columns.data(), Out, Count);
+    return true;
+}
+
+bool Engine::evaluateEach(const std::string& Name, const std::vector<const double*>& Columns, double* Out, size_t Count) {
+    void* Function = lookupAddress(Name, Columns.size());
+    if (!Function) {
+        return false;
+    }
+
+    std::vector<double> Args(Columns.size()); // the arguments for one element
+    for (size_t i = 0; i != Count; ++i) {
+        for (size_t c = 0; c != Columns.size(); ++c) {
+            Args[c] = Columns[c][i];
+        }
+        if (!CallNative(Function, Args.data(), Args.size(), Out[i])) {
+            LogError("Too many arguments for a per element call.");
+            return false;
+        }
+    }
+    return true;
+}
+
+void Engine::dumpModule() {
+    TheModule->print(llvm::errs(), nullptr);
+}
+
+bool Engine::emitObject() {
+    if (ObjectOutputPath.empty()) {
+        LogError("No object file to emit (the engine was created without an object path).");
+        return false;
+    }
+    if (llvm::verifyModule(*TheModule, &llvm::errs())) {
+        LogError("The module is broken, not writing the object file.");
+        return false;
+    }
+    return EmitObjectFile(*TheModule, ObjectOutputPath);
+}
+
+bool Engine::emitBitcode() {
+    if (!EmittingBitcode()) {
+        LogError("No bitcode file to emit (the engine was created without a bitcode path).");
+        return false;
+    }
+    if (llvm::verifyModule(*TheModule, &llvm::errs())) {
+        LogError("The module is broken, not writing the bitcode file.");
+        return false;
+    }
+    return EmitBitcodeFile(*TheModule, BitcodeOutputPath);
+}
+
+bool Engine::importLibrary(const std::string& Path) {
+    return ImportLibrary(Path);
+}
+
+int Engine::serve(const std::string& SocketPath) {
+    return ServeScripts(*this, SocketPath);
+}
+
+void Engine::printCallStats() {
+    ShowCallStats();
+}
+
+JITMemoryStats Engine::getJITMemoryStats() const {
+    JITMemoryUsage Usage = TheJIT->getMemoryUsage();
+    JITMemoryStats Stats;
+    Stats.LiveCode = Usage.Live[static_cast<unsigned>(JITMemoryKind::Code)];
+    Stats.PeakCode = Usage.Peak[static_cast<unsigned>(JITMemoryKind::Code)];
+    Stats.LiveROData = Usage.Live[static_cast<unsigned>(JITMemoryKind::ROData)];
+    Stats.PeakROData = Usage.Peak[static_cast<unsigned>(JITMemoryKind::ROData)];
+    Stats.LiveRWData = Usage.Live[static_cast<unsigned>(JITMemoryKind::RWData)];
+    Stats.PeakRWData = Usage.Peak[static_cast<unsigned>(JITMemoryKind::RWData)];
+    Stats.Mapped = Usage.Mapped;
+    Stats.NumSlabs = Usage.NumSlabs;
+    return Stats;
+}
+
+void Engine::printJITMemoryStats() {
+    RuntimeFlush(); // keep the script's output in front of the report
+    JITMemoryStats Stats = getJITMemoryStats();
+    fprintf(stderr, "JIT memory        live bytes    peak bytes\n");
+    fprintf(stderr, "  code          %12zu  %12zu\n", Stats.LiveCode, Stats.PeakCode);
+    fprintf(stderr, "  rodata        %12zu  %12zu\n", Stats.LiveROData, Stats.PeakROData);
+    fprintf(stderr, "  rwdata        %12zu  %12zu\n", Stats.LiveRWData, Stats.PeakRWData);
+    fprintf(stderr, "  mapped        %12zu  (%zu slabs)\n", Stats.Mapped, Stats.NumSlabs);
+}
+
+} // namespace kaleidoscope
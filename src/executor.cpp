@@ -0,0 +1,56 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "../include/kaleidoscope/native_symbols.h"
+#include "../include/kaleidoscope/remote.h"
+#include "../include/kaleidoscope/runtime_io.h"
+#include "../include/kaleidoscope/tasks.h"
+
+#include "llvm/ADT/bit.h"
+#include "llvm/ExecutionEngine/Orc/Shared/WrapperFunctionUtils.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/SimpleExecutorMemoryManager.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/SimpleRemoteEPCServer.h"
+
+// THE EXECUTOR => ./kaleidoscope_executor <in fd> <out fd> [stdout|stderr], started by the compiler for --executors (see remote.h)
+// it never compiles anything => the compiler allocates memory here, writes the linked code into it and calls the run wrapper below
+// it exports the same builtins as the compiler (putchard, printd, the task runtime, libm) and the dylib manager for --load
+
+// runs a top level expression => its output is captured and sent back with the result, so the compiler prints both in order
+static llvm::orc::shared::CWrapperFunctionResult RunExpressionWrapper(const char* ArgData, size_t ArgSize) {
+    return llvm::orc::shared::WrapperFunction<RunExpressionSignature>::handle(ArgData, ArgSize, [](llvm::orc::ExecutorAddr Address) {
+        std::string Output;
+        BeginOutputCapture(&Output);
+        double Result = Address.toPtr<double (*)()>()();
+        EndOutputCapture();
+        return std::make_pair(llvm::bit_cast<uint64_t>(Result), std::move(Output));
+    }).release();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: ./kaleidoscope_executor <in fd> <out fd> [stdout|stderr] (started by ./main --executors=N)\n");
+        return 1;
+    }
+    int InFD = atoi(argv[1]), OutFD = atoi(argv[2]);
+    SetRuntimeOutput(argc > 3 ? argv[3] : "stderr"); // what async tasks print
+
+    llvm::ExitOnError ExitOnErr("kaleidoscope_executor: ");
+    auto Server = ExitOnErr(llvm::orc::SimpleRemoteEPCServer::Create<llvm::orc::FDSimpleRemoteEPCTransport>(
+        [](llvm::orc::SimpleRemoteEPCServer::Setup& S) -> llvm::Error {
+            S.setDispatcher(std::make_unique<llvm::orc::SimpleRemoteEPCServer::ThreadDispatcher>()); // expressions of a parallel batch run concurrently
+            S.bootstrapSymbols() = llvm::orc::SimpleRemoteEPCServer::defaultBootstrapSymbols(); // eh frame registration and friends
+            S.services().push_back(std::make_unique<llvm::orc::rt_bootstrap::SimpleExecutorMemoryManager>());
+            for (auto &Builtin : BuiltinSymbols()) {
+                S.bootstrapSymbols()[std::string(NativeSymbolPrefix) + Builtin.first] = llvm::orc::ExecutorAddr::fromPtr(Builtin.second);
+            }
+            S.bootstrapSymbols()[RunExpressionSymbol] = llvm::orc::ExecutorAddr::fromPtr(&RunExpressionWrapper);
+            return llvm::Error::success();
+        },
+        InFD, OutFD));
+    ExitOnErr(Server->waitForDisconnect()); // the compiler is done (or gone)
+
+    StopTaskRuntime();
+    RuntimeFlush();
+    return 0;
+}
@@ -1,4 +1,8 @@
 #include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/native_symbols.h"
+#include "../include/kaleidoscope/library.h"
+#include "../include/kaleidoscope/interpreter.h"
+#include "../include/kaleidoscope/remote.h"
 
 
 #ifdef _WIN32 // if we're on windows
@@ -9,14 +13,23 @@
 
 // treat it as a C function
 extern "C" DLLEXPORT double putchard(double X) {
-    fputc((char)X, stderr); // takes some double X, and prints it as a char to the error stream using fputc(...)
-    //fprintf(stderr, "\n"); // OPTIONAL
+    char C = (char)X; // takes some double X, and prints it as a char
+    RuntimeWrite(&C, 1); // into the buffered runtime output (one syscall per buffer instead of one per character)
     return 0;
 }
 
 // treat it as a C function
 extern "C" DLLEXPORT double printd(double X) {
-    fprintf(stderr, "%f\n", X); // takes some double X, and prints it as a double to the error stream using fprintf(...)
+    char Text[RuntimeDoubleChars + 1]; // room for the number and the trailing newline
+    size_t Length = FormatDouble(X, Text); // takes some double X, and formats it like "%f"
+    Text[Length++] = '\n';
+    RuntimeWrite(Text, Length); // into the buffered runtime output
+    return 0;
+}
+
+// treat it as a C function => lets a script force its output out (e.g. before a long computation)
+extern "C" DLLEXPORT double flushd() {
+    RuntimeFlush();
     return 0;
 }
 
@@ -30,14 +43,43 @@ std::unique_ptr<llvm::CGSCCAnalysisManager> TheCGAM;
 std::unique_ptr<llvm::ModuleAnalysisManager> TheMAM;
 std::unique_ptr<llvm::PassInstrumentationCallbacks> ThePIC;
 std::unique_ptr<llvm::StandardInstrumentations> TheSI;
+std::unique_ptr<llvm::TargetMachine> TheTM;
+
+unsigned ParallelThreads = 0;
+bool CacheTopLevelExpressions = true;
+std::map<std::string, unsigned> FunctionVersions;
+
+static unsigned NumAnonExpressions = 0; // gives anonymous expressions that stay in the jit their own symbol names
+
+// the optimizer reports loop hints it couldn't honor as warnings => print those (and drop the remarks, which are just noise here)
+static void HandleOptimizerDiagnostic(const llvm::DiagnosticInfo& DI, void* Context) {
+    if (DI.getSeverity() != llvm::DS_Warning && DI.getSeverity() != llvm::DS_Error) {
+        return;
+    }
+
+    std::string Message;
+    if (auto* OD = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&DI)) {
+        Message = "in function '" + OD->getFunction().getName().str() + "': " + OD->getMsg();
+    } else {
+        llvm::raw_string_ostream OS(Message);
+        llvm::DiagnosticPrinterRawOStream DP(OS);
+        DI.print(DP);
+    }
+    LogWarning(Message.c_str());
+}
+
+// everything here lives for the whole session => the context, the builder, the pass pipeline and the analysis registrations
+// used to be rebuilt after every definition and top level expression, which cost more than compiling a one line expression
+void InitializeSession(void) {
+    TheTSC = llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>()); // one context shared with the jit (every module we hand over keeps it alive)
+    TheContext = TheTSC.getContext(); // codegen only ever runs on the main thread, and so does the jit's compilation (it happens inside lookup)
+    TheContext->setDiagnosticHandlerCallBack(HandleOptimizerDiagnostic);
 
-void InitializeModuleAndManagers(void) {
-    TheContext = std::make_unique<llvm::LLVMContext>(); // initializes an llvm context object
-    TheModule = std::make_unique<llvm::Module>("Just in Time (JIT) Compiler", *TheContext); // initializes an llvm module to hold functions and other global declarations
-    TheModule->setDataLayout(TheJIT->getDataLayout()); // sets the data layout to that of the just in time compiler
-    
     Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext); // declares the ir builder, which is passed a pointer to the context object
 
+    auto JTMB = ExitOnErr(EmittingObject() ? ObjectTargetBuilder() : llvm::orc::JITTargetMachineBuilder::detectHost()); // the same host target the jit compiles for (or the target of the object file)
+    TheTM = ExitOnErr(JTMB.createTargetMachine()); // gives the loop passes real costs (vector width, unroll budgets, ...)
+
     TheFPM = std::make_unique<llvm::FunctionPassManager>(); // this holds and organizes the LLVM optimizations we want to run
     TheLAM = std::make_unique<llvm::LoopAnalysisManager>(); // optimizes loops in our program (for, while, etc)
     TheFAM = std::make_unique<llvm::FunctionAnalysisManager>(); // optimizes functions, and their bodies, etc
@@ -48,29 +90,73 @@ void InitializeModuleAndManagers(void) {
 
     TheSI->registerCallbacks(*ThePIC, TheMAM.get()); // sets up callbacks for standard instrumentation passes
 
+    TheFPM->addPass(llvm::PromotePass()); // promote stack allocations (variables, expanded operator parameters) to ssa registers
+    TheFPM->addPass(llvm::SROAPass(llvm::SROAOptions::ModifyCFG)); // splits up and promotes whatever mem2reg couldn't (the argument arrays of async calls)
     TheFPM->addPass(llvm::InstCombinePass()); // wholly simplifies the ir by using algebraic identities, etc to simplify
     TheFPM->addPass(llvm::ReassociatePass()); // identifies associateive expressions, and uses for further constant folding optimizations (LLVM already has basic implemented)
     TheFPM->addPass(llvm::GVNPass()); // eliminates redundant subexpressions so that we don't compute the same things twice...
     TheFPM->addPass(llvm::SimplifyCFGPass()); // simplifies the control flow graph (merges blocks (currently just function bodies...))
+
+    // loop passes => counted for loops have an integer induction variable with a computable trip count, which is what these need
+    llvm::LoopPassManager LPM;
+    LPM.addPass(llvm::LoopRotatePass()); // canonical rotated form (guard + bottom tested latch)
+    LPM.addPass(llvm::IndVarSimplifyPass()); // canonicalizes induction variables and exit conditions
+    TheFPM->addPass(llvm::createFunctionToLoopPassAdaptor(std::move(LPM)));
+    TheFPM->addPass(llvm::LoopVectorizePass()); // vectorizes (and interleaves) loops the target says are worth it
+    TheFPM->addPass(llvm::InstCombinePass()); // cleans up after the vectorizer
+    TheFPM->addPass(llvm::LoopUnrollPass()); // unrolls loops with small constant or runtime trip counts
+    TheFPM->addPass(llvm::SimplifyCFGPass());
+    TheFPM->addPass(llvm::WarnMissedTransformationsPass()); // reports loop hints that were not honored
    
     //TheFPM->addPass(llvm::createPromoteMemoryToRegisterPass()); // promote memory references to register references if possible
     //TheFPM->addPass(llvm::createInstructionCombiningPass()); //combine instructions to simplify and optimize # of exectuded instructions
     //TheFPM->addPass(llvm::createReassociatePass()); // reassociates expressions to execute the fewest instructions possible
 
-    llvm::PassBuilder PB; // pass builder -> object to control optimization passes
+    llvm::PassBuilder PB(TheTM.get()); // pass builder -> object to control optimization passes (the target machine provides the cost model)
     PB.registerModuleAnalyses(*TheMAM); // registers module level passes
+    PB.registerCGSCCAnalyses(*TheCGAM);
     PB.registerFunctionAnalyses(*TheFAM); // registers function level passes
+    PB.registerLoopAnalyses(*TheLAM); // the loop passes need these
     PB.crossRegisterProxies(*TheLAM, *TheFAM, *TheCGAM, *TheMAM); // allows analyes from one manager to be accessed by others
+
+    InitializeModule();
+}
+
+// the only per unit work => a fresh module for the next definition or top level expression
+void InitializeModule(void) {
+    TheLAM->clear(); // cached analyses point at functions of the module the jit just took (and will free)
+    TheFAM->clear();
+    TheMAM->clear();
+
+    TheModule = std::make_unique<llvm::Module>("Just in Time (JIT) Compiler", *TheContext); // initializes an llvm module to hold functions and other global declarations
+    TheModule->setDataLayout(EmittingObject() ? TheTM->createDataLayout() : TheJIT->getDataLayout()); // sets the data layout to that of the just in time compiler (or of the object's target)
+    TheModule->setTargetTriple(TheTM->getTargetTriple().str());
 }
 
 void HandleDefinition() {
+    size_t Start = CurOffset; // where the 'def' starts => its text goes into a bitcode library
     if (auto FnAST = ParseDefinition()) { // parse the function definition
+        if (EmittingObject()) { // every definition shares the object's module => a second body for the same symbol can't go in
+            llvm::Function* Existing = TheModule->getFunction(FnAST->getProto().getName());
+            if (Existing && !Existing->empty()) {
+                LogError(("'" + FnAST->getProto().getName() + "' is already defined in the object file.").c_str());
+                return;
+            }
+        }
         if (auto* FnIR = FnAST->codegen()) { // generate llvm ir from the definition
             fprintf(stderr, "Read function definition: "); // print out the generated ir (next 2 lines as well)
             FnIR->print(llvm::errs());
             fprintf(stderr, "\n");
-            ExitOnErr(TheJIT->addModule(llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext)))); // transfer the new function to the JIT
-            InitializeModuleAndManagers(); // open a new module to clean up the environment for further function defintiions,etc
+            if (EmittingBitcode()) {
+                RecordLibraryUnit(Start);
+            }
+            if (!EmittingObject()) { // the object file keeps collecting definitions in the same module
+                AddDefinitionModule(std::move(TheModule)); // transfer the new function to the JIT (of every executor)
+                InitializeModule(); // open a new module to clean up the environment for further function defintiions,etc
+            }
+            std::string Name = FnAST->getProto().getName();
+            FunctionDefs[Name] = std::move(FnAST); // keep the AST so user defined operators can be expanded at their use sites
+            NoteFunctionChanged(Name); // anything cached against the old definition is stale now
         } 
     } else { // error handling
         getNextToken();
@@ -78,58 +164,365 @@ void HandleDefinition() {
 }
 
 void HandleDecl() {
+    size_t Start = CurOffset;
     if (auto ProtoAST = ParseDecl()) { // parse the function delcaration into an AST node
+        if (ProtoAST->hasRecords()) { // a native function would have to agree with llvm on how a struct is passed
+            LogError("A 'decl' names a native function, which only takes and returns numbers.");
+            return;
+        }
         if (auto* FnIR = ProtoAST->codegen()) { // generate llvm ir for the function delcaration
             fprintf(stderr, "Read function declaration: "); // print out the ir
             FnIR->print(llvm::errs());
             fprintf(stderr, "\n");
-            FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST); // transfers ownership of the parsed function prototype into the ProtosMap for use later
+            if (EmittingBitcode()) { // importers need the prototype too
+                RecordLibraryUnit(Start);
+            }
+            std::string Name = ProtoAST->getName();
+            if (!BindNativeSymbol(Name) && !FunctionDefs.count(Name)) { // bound now rather than when the first call is linked
+                LogWarning(("'" + Name + "' is not a builtin or in any --load library (fine if a 'def' of it follows).").c_str());
+            }
+            FunctionProtos[Name] = std::move(ProtoAST); // transfers ownership of the parsed function prototype into the ProtosMap for use later
+            NoteFunctionChanged(Name);
         }
     } else {
         getNextToken();
     }
 }
 
+void HandleRecord() {
+    size_t Start = CurOffset;
+    if (auto Declaration = ParseRecord()) {
+        if (DefineRecord(*Declaration)) {
+            fprintf(stderr, "Read record definition: ");
+            Records[Declaration->Name].Struct->print(llvm::errs());
+            fprintf(stderr, "\n");
+            if (EmittingBitcode()) { // importers need the fields to use the library's definitions
+                RecordLibraryUnit(Start);
+            }
+        }
+    } else {
+        getNextToken();
+    }
+}
+
+void HandleImport() {
+    getNextToken(); // eat 'import'
+    if (CurTok != tok_string) {
+        LogError("Expected a quoted path after 'import'.");
+        return;
+    }
+    ImportLibrary(IdentifierStr);
+    getNextToken(); // eat the path
+}
+
+// every function an expression can end up calling => its direct callees, plus everything reachable through the stored definitions
+std::set<std::string> ReachableFunctions(const ExprAST& Expr) {
+    std::set<std::string> Callees;
+    Expr.collectCallees(Callees);
+    std::vector<std::string> Worklist(Callees.begin(), Callees.end());
+    std::set<std::string> Reachable;
+
+    while (!Worklist.empty()) {
+        std::string Name = Worklist.back();
+        Worklist.pop_back();
+        if (!Reachable.insert(Name).second) { // already visited (recursion ends up here)
+            continue;
+        }
+
+        auto DI = FunctionDefs.find(Name);
+        if (DI != FunctionDefs.end()) { // look inside kaleidoscope definitions as well
+            std::set<std::string> Inner;
+            DI->second->getBody()->collectCallees(Inner);
+            Worklist.insert(Worklist.end(), Inner.begin(), Inner.end());
+        }
+    }
+    return Reachable;
+}
+
+// TOP LEVEL EXPRESSION CACHE
+// re-evaluating the same expression (a REPL probe, a monitoring loop) used to mean a full codegen + optimize + jit cycle every time
+// now the compiled code is kept, keyed by the canonical form of the expression plus the version of every function it can reach,
+// so a repeat skips compilation entirely => redefining any of those functions evicts the entry
+
+struct CachedExpression {
+    llvm::orc::ResourceTrackerSP RT; // owns the compiled expression
+    llvm::orc::ExecutorAddr Address; // the compiled expression itself (in executor 0 with --executors)
+    std::set<std::string> Reaches; // functions it depends on (for eviction)
+};
+
+static std::map<std::string, CachedExpression> ExpressionCache;
+static std::deque<std::string> ExpressionCacheOrder; // oldest first, so the cache can't grow without bound
+static constexpr size_t MaxCachedExpressions = 256;
+
+static void EvictCachedExpression(const std::string& Key) {
+    auto CI = ExpressionCache.find(Key);
+    if (CI == ExpressionCache.end()) {
+        return;
+    }
+    ExitOnErr(CI->second.RT->remove()); // free the compiled code
+    ExpressionCache.erase(CI);
+    ExpressionCacheOrder.erase(std::find(ExpressionCacheOrder.begin(), ExpressionCacheOrder.end(), Key));
+}
+
+void NoteFunctionChanged(const std::string& Name) {
+    FunctionVersions[Name]++; // keys built from now on won't match the old code
+
+    std::vector<std::string> Stale; // and drop the entries that can reach the old version
+    for (auto &Entry : ExpressionCache) {
+        if (Entry.second.Reaches.count(Name)) {
+            Stale.push_back(Entry.first);
+        }
+    }
+    for (auto &Key : Stale) {
+        EvictCachedExpression(Key);
+    }
+}
+
+void ClearExpressionCache() {
+    while (!ExpressionCacheOrder.empty()) {
+        EvictCachedExpression(ExpressionCacheOrder.front());
+    }
+}
+
+void DropExpressionCache() {
+    ExpressionCache.clear();
+    ExpressionCacheOrder.clear();
+}
+
+std::string TopLevelExpressionName() {
+    return CacheTopLevelExpressions ? "__anon_expr." + std::to_string(NumAnonExpressions++) : "__anon_expr"; // cached code stays in the jit, so it needs its own name
+}
+
 void HandleTopLevelExpression() {
-    if (auto FnAST = ParseTopLevelExpr()) {
+    if (auto FnAST = ParseTopLevelExpr(TopLevelExpressionName())) {
+        EvaluateTopLevelExpression(std::move(FnAST));
+    }
+}
+
+void EvaluateTopLevelExpression(std::unique_ptr<FunctionAST> FnAST) {
+    std::string Name = FnAST->getProto().getName();
+    std::string Key; // canonical expression + the versions of everything it can reach
+    std::set<std::string> Reaches;
+    if (CacheTopLevelExpressions) {
+        FnAST->getBody()->canonicalize(Key);
+        Reaches = ReachableFunctions(*FnAST->getBody());
+        for (auto &Callee : Reaches) {
+            Key += " " + Callee + "@" + std::to_string(FunctionVersions[Callee]);
+        }
+
+        auto CI = ExpressionCache.find(Key);
+        if (CI != ExpressionCache.end()) { // seen it before => skip straight to running the compiled code
+            double Result;
+            if (RunExpression(0, CI->second.Address, Result)) {
+                RuntimeFlush(); // flush the script's output before our own message so the two stay in order
+                fprintf(stderr, "Evaluated to %f\n", Result);
+            }
+            RestartDeadExecutors(); // if it crashed its executor
+            return;
+        }
+    }
+
+    if (ShouldInterpret(*FnAST)) { // cheaper to walk the tree once than to compile it (see interpreter.h)
+        double Result;
+        if (InterpretTopLevelExpression(*FnAST, Result)) {
+            RuntimeFlush();
+            fprintf(stderr, "Evaluated to %f\n", Result);
+        }
+        return;
+    }
+
+    if (FnAST->codegen()) {
+        auto RT = TheJIT->getMainJITDylib().createResourceTracker(); // create a resource tracker to track JIT memory allocation
+
+        auto TSM = llvm::orc::ThreadSafeModule(std::move(TheModule), TheTSC); // moves the module into a thread safe module that shares the session's context, which allows us to "safely" work with an llvm module
+        ExitOnErr(TheJIT->addModule(std::move(TSM), RT)); // triggers code generation for all functions in the module
+        InitializeModule(); // open up a new module
+
+        auto ExprSymbol = ExitOnErr(TheJIT->lookup(Name)); // look for anonymous top level expressions in the JIT (GET A POINTER TO THE GENERATED CODE)
+        //assert(ExprSymbol && "Function not found"); // assert that the lookup returned something
+
+        double Result;
+        if (RunExpression(0, ExprSymbol.getAddress(), Result)) { // calls it natively (or has executor 0 call it)
+            RuntimeFlush(); // flush the script's output before our own message so the two stay in order
+            fprintf(stderr, "Evaluated to %f\n", Result);
+        }
+
+        if (!ExecutorAlive(0)) { // the code went down with the executor => nothing to keep or free
+            RestartDeadExecutors();
+        } else if (CacheTopLevelExpressions) { // keep the code around for the next time this expression shows up
+            if (ExpressionCache.size() >= MaxCachedExpressions) {
+                EvictCachedExpression(ExpressionCacheOrder.front());
+            }
+            ExpressionCache[Key] = { RT, ExprSymbol.getAddress(), std::move(Reaches) };
+            ExpressionCacheOrder.push_back(Key);
+        } else {
+            ExitOnErr(RT->remove()); // delete the anonymous expression module from the just in time compiler
+        }
+    }
+    FunctionProtos.erase(Name); // nobody can call an anonymous expression
+}
+
+// PARALLEL SCRIPT MODE
+// top level expressions only depend on the definitions above them, so we queue them up until the next def/decl (or the end of the script)
+// then every expression whose callees stay inside kaleidoscope code, math builtins and the output builtins runs on a worker thread
+// (its output is captured and replayed in source order), while anything that reaches other external functions runs alone, in order
+
+// a top level expression that has been compiled but not run yet
+struct PendingExpression {
+    llvm::orc::ResourceTrackerSP RT; // owns the compiled expression
+    unsigned Executor; // where it was compiled (and runs), always 0 without --executors
+    llvm::orc::ExecutorAddr Address; // the compiled expression itself
+    bool Parallel; // safe to run on a worker thread
+};
+
+static std::vector<PendingExpression> PendingExpressions;
+
+// the only external effects we know how to reorder => output, which can be captured
+static bool isOutputBuiltin(const std::string& Name) {
+    return (Name == "putchard" || Name == "printd" || Name == "flushd") && !FunctionDefs.count(Name);
+}
+
+// checks every function the expression can reach
+static bool CanRunInParallel(const ExprAST& Expr) {
+    for (auto &Name : ReachableFunctions(Expr)) {
+        if (FunctionDefs.count(Name) || isMathBuiltin(Name) || isOutputBuiltin(Name)) { // kaleidoscope code, or a builtin we understand
+            continue;
+        }
+        return false; // some external function with unknown effects
+    }
+    return true;
+}
+
+void QueueTopLevelExpression() {
+    std::string Name = "__anon_expr." + std::to_string(NumAnonExpressions++); // queued expressions coexist in the jit, so they need distinct names
+    if (auto FnAST = ParseTopLevelExpr(Name)) {
+        bool Parallel = CanRunInParallel(*FnAST->getBody());
+        unsigned Executor = Parallel ? NextExecutor() : 0; // independent expressions are spread over the executors
         if (FnAST->codegen()) {
-            auto RT = TheJIT->getMainJITDylib().createResourceTracker(); // create a resource tracker to track JIT memory allocation
+            auto &JIT = ExecutorJIT(Executor);
+            auto RT = JIT.getMainJITDylib().createResourceTracker(); // create a resource tracker to track JIT memory allocation
+            ExitOnErr(JIT.addModule(llvm::orc::ThreadSafeModule(std::move(TheModule), TheTSC), RT));
+            InitializeModule(); // open up a new module
+
+            auto ExprSymbol = ExitOnErr(JIT.lookup(Name)); // compiles it here, so the worker threads only ever run finished code
+            PendingExpressions.push_back({ RT, Executor, ExprSymbol.getAddress(), Parallel });
+        }
+        FunctionProtos.erase(Name); // nobody can call an anonymous expression
+    }
+}
 
-            auto TSM = llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext)); // moves the context and the module itself into a thread safe module, which allows us to "safely" work with an llvm module
-            ExitOnErr(TheJIT->addModule(std::move(TSM), RT)); // triggers code generation for all functions in the module
-            InitializeModuleAndManagers(); // open up a new module
+void FlushPendingExpressions() {
+    if (PendingExpressions.empty()) {
+        return;
+    }
 
-            auto ExprSymbol = ExitOnErr(TheJIT->lookup("__anon_expr")); // look for anonymous top level expressions in the JIT (GET A POINTER TO THE GENERATED CODE)
-            //assert(ExprSymbol && "Function not found"); // assert that the lookup returned something
+    size_t Count = PendingExpressions.size();
+    std::vector<double> Results(Count);
+    std::vector<std::string> Outputs(Count); // captured output of the expressions that ran on workers
+    std::vector<char> Ran(Count, false); // false => its executor died under it (already reported)
+    std::vector<std::shared_future<void>> Running(Count);
+    size_t Reported = 0; // every expression before this one has been reported
 
-            // FUNCTIONALLY NO DIFFERENCE BETWEEN JIT COMPILED CODE AND NATIVE MACHINE CODE STATICALLY LINKED
-            double (*FP)() = ExprSymbol.getAddress().toPtr<double (*)()>(); // gets the address of the anonymous symbol and returns a double so we can call it natively
-            fprintf(stderr, "Evaluated to %f\n", FP());
+    auto Report = [&](size_t i) { // replay the output, then say what it evaluated to (same as the sequential mode)
+        if (Running[i].valid()) {
+            Running[i].wait();
+        }
+        RuntimeWrite(Outputs[i].data(), Outputs[i].size());
+        RuntimeFlush();
+        if (Ran[i]) {
+            fprintf(stderr, "Evaluated to %f\n", Results[i]);
+        }
+    };
+
+    {
+        llvm::ThreadPool Pool(llvm::hardware_concurrency(ParallelThreads));
+        for (size_t i = 0; i != Count; ++i) {
+            if (PendingExpressions[i].Parallel) {
+                Running[i] = Pool.async([&, i] {
+                    BeginOutputCapture(&Outputs[i]);
+                    Ran[i] = RunExpression(PendingExpressions[i].Executor, PendingExpressions[i].Address, Results[i]);
+                    EndOutputCapture();
+                });
+                continue;
+            }
 
-            ExitOnErr(RT->remove()); // delete the anonymous expression module from the just in time compiler (b/c we don't support re-evaluation of top-level expressions)
+            // unknown effects => everything before it finishes (and prints) first, then it runs by itself on this thread
+            for (; Reported != i; ++Reported) {
+                Report(Reported);
+            }
+            Ran[i] = RunExpression(PendingExpressions[i].Executor, PendingExpressions[i].Address, Results[i]);
+            Report(i);
+            Reported = i + 1;
+        }
+
+        for (; Reported != Count; ++Reported) { // report whatever is left, still in source order
+            Report(Reported);
+        }
+    }
+
+    for (auto &Pending : PendingExpressions) {
+        if (ExecutorAlive(Pending.Executor)) { // a dead executor's code is gone already
+            ExitOnErr(Pending.RT->remove()); // delete the expressions from the jit, like the sequential mode does
         }
     }
+    PendingExpressions.clear();
+    RestartDeadExecutors();
+}
+
+// object (or bitcode) file mode => there's nothing to run a top level expression on (it may be compiled for another architecture)
+static void SkipTopLevelExpression() {
+    if (ParseTopLevelExpr("__anon_expr")) {
+        LogWarning("top level expressions are not evaluated when emitting an object or bitcode file");
+    } else {
+        getNextToken();
+    }
+}
+
+// 'stats' as a statement of its own => the call instrumentation table so far (a function called stats takes precedence)
+static bool isStatsCommand() {
+    return CurTok == tok_identifier && IdentifierStr == "stats" && !FunctionProtos.count("stats");
 }
 
 void MainLoop() {
+    bool Parallel = ParallelThreads > 0 && input != &std::cin; // only scripts are batched up (the prompt stays interactive)
     while (true) {
         if (input == &std::cin) {
             fprintf(stderr, ">> \n");
         }
         switch(CurTok) {
             case tok_eof: // if its the end of the file, exit the loop
+                FlushPendingExpressions(); // run whatever is still queued
                 return;
             case ';':
                 getNextToken(); // ignore semicolons and get the next token...
                 break; // then break out of the switch statement
             case tok_def:
+                FlushPendingExpressions(); // queued expressions must run against the definitions they were compiled with
                 HandleDefinition(); // handle function definitions
                 break; 
             case tok_decl:
+                FlushPendingExpressions();
                 HandleDecl(); // handle function declarations
                 break;
+            case tok_import:
+                FlushPendingExpressions();
+                HandleImport(); // load a precompiled library
+                break;
+            case tok_record:
+                HandleRecord(); // nothing queued can use it yet
+                break;
             default:
-                HandleTopLevelExpression(); // otherwise, it's a top level expression, so deal with that...
+                if (isStatsCommand()) {
+                    FlushPendingExpressions(); // the queued expressions count too
+                    ShowCallStats();
+                    getNextToken();
+                } else if (EmittingObject()) {
+                    SkipTopLevelExpression();
+                } else if (Parallel) {
+                    QueueTopLevelExpression(); // compile now, run with the rest of the batch
+                } else {
+                    HandleTopLevelExpression(); // otherwise, it's a top level expression, so deal with that...
+                }
                 break;
         }
     }
@@ -0,0 +1,366 @@
+#include "../include/kaleidoscope/interpreter.h"
+#include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/specialize.h"
+
+#include <cmath>
+#include <map>
+
+ExecutionTier TopLevelTier = ExecutionTier::Auto;
+
+bool ParseExecutionTier(const std::string& Name, ExecutionTier& Tier) {
+    if (Name == "auto") {
+        Tier = ExecutionTier::Auto;
+    } else if (Name == "interp") {
+        Tier = ExecutionTier::Interpreter;
+    } else if (Name == "jit") {
+        Tier = ExecutionTier::JIT;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+double* InterpreterFrame::lookup(const std::string& Name) {
+    for (auto It = Variables.rbegin(); It != Variables.rend(); ++It) {
+        if (It->first == Name) {
+            return &It->second;
+        }
+    }
+    return nullptr;
+}
+
+// the interpreter's side of the math builtins (codegen lowers the same names to intrinsics => same libm results)
+struct InterpretedBuiltin {
+    unsigned NumArgs;
+    double (*Evaluate)(const double* Args);
+};
+
+static const std::map<std::string, InterpretedBuiltin> InterpretedBuiltins = {
+    {"sqrt", {1, [](const double* A) { return std::sqrt(A[0]); }}},
+    {"fabs", {1, [](const double* A) { return std::fabs(A[0]); }}},
+    {"floor", {1, [](const double* A) { return std::floor(A[0]); }}},
+    {"ceil", {1, [](const double* A) { return std::ceil(A[0]); }}},
+    {"fma", {3, [](const double* A) { return std::fma(A[0], A[1], A[2]); }}},
+    {"sin", {1, [](const double* A) { return std::sin(A[0]); }}},
+    {"cos", {1, [](const double* A) { return std::cos(A[0]); }}},
+    {"exp", {1, [](const double* A) { return std::exp(A[0]); }}},
+    {"log", {1, [](const double* A) { return std::log(A[0]); }}},
+    {"pow", {2, [](const double* A) { return std::pow(A[0], A[1]); }}},
+    {"min", {2, [](const double* A) { return std::fmin(A[0], A[1]); }}}, // llvm.minnum => the non-NaN operand, like fmin
+    {"max", {2, [](const double* A) { return std::fmax(A[0], A[1]); }}},
+};
+
+// the builtin a call evaluates to, unless a user 'def' took the name (same rule as codegen)
+static const InterpretedBuiltin* getInterpretedBuiltin(const std::string& Callee, size_t NumArgs) {
+    auto BI = InterpretedBuiltins.find(Callee);
+    if (BI == InterpretedBuiltins.end() || BI->second.NumArgs != NumArgs || !isMathBuiltin(Callee)) {
+        return nullptr;
+    }
+    return &BI->second;
+}
+
+// fcmp one against 0 => NaN is false, like the jitted code
+static bool isTrue(double Value) {
+    return Value < 0 || Value > 0;
+}
+
+// a native call with as many double arguments as the index sequence is long
+template <size_t... I> static double CallWithArgs(void* Address, const double* Args, std::index_sequence<I...>) {
+    using FnT = double (*)(decltype((void)I, 0.0)...);
+    return reinterpret_cast<FnT>(Address)(Args[I]...);
+}
+
+// one caller per arity => picks the right function pointer type at run time
+template <size_t... N> static double CallWithArity(void* Address, const std::vector<double>& Args, std::index_sequence<N...>) {
+    using CallerT = double (*)(void*, const double*);
+    static const CallerT Callers[] = { [](void* Address, const double* Args) { return CallWithArgs(Address, Args, std::make_index_sequence<N>()); }... };
+    return Callers[Args.size()](Address, Args.data());
+}
+
+static std::map<std::string, std::pair<unsigned, void*>> CalleeAddresses; // name => (version it was looked up at, address)
+
+double CallNativeFunction(const std::string& Name, const std::vector<double>& Args, InterpreterFrame& Frame) {
+    auto VI = FunctionVersions.find(Name);
+    unsigned Version = VI == FunctionVersions.end() ? 0 : VI->second;
+    auto CI = CalleeAddresses.find(Name);
+    if (CI == CalleeAddresses.end() || CI->second.first != Version) { // first call, or redefined since => ask the jit (compiles it on first use)
+        auto Symbol = TheJIT->lookup(Name);
+        if (!Symbol) {
+            LogError(llvm::toString(Symbol.takeError()).c_str());
+            Frame.Failed = true;
+            return 0;
+        }
+        CI = CalleeAddresses.insert_or_assign(Name, std::make_pair(Version, Symbol->getAddress().toPtr<void*>())).first;
+    }
+    return CallWithArity(CI->second.second, Args, std::make_index_sequence<MaxInterpretedArgs + 1>());
+}
+
+// can an operator body be interpreted in place of the operator => it only sees its own parameters, like in codegen's expansion
+static bool OperatorInterpretable(const FunctionAST& Operator, InterpreterCheck& Check) {
+    const std::string& Name = Operator.getProto().getName();
+    if (Check.Expanding.count(Name)) { // expands itself => fine for the interpreter, but there's no telling how long it runs
+        Check.Recursive = true;
+        return true;
+    }
+    std::vector<std::string> CallerScope = std::move(Check.Scope);
+    Check.Scope = Operator.getProto().getArgs();
+    Check.Expanding.insert(Name);
+    bool Interpretable = Operator.getBody()->interpretable(Check);
+    Check.Expanding.erase(Name);
+    Check.Scope = std::move(CallerScope);
+    return Interpretable;
+}
+
+// a user operator => its stored definition if there is one, the declared (native) function otherwise
+static bool UserOperatorInterpretable(const std::string& Name, size_t NumArgs, InterpreterCheck& Check) {
+    auto DI = FunctionDefs.find(Name);
+    if (DI != FunctionDefs.end()) {
+        return OperatorInterpretable(*DI->second, Check);
+    }
+    auto PI = FunctionProtos.find(Name);
+    return PI != FunctionProtos.end() && PI->second->getArgs().size() == NumArgs;
+}
+
+static double InterpretUserOperator(const std::string& Name, const std::vector<double>& Operands, InterpreterFrame& Caller) {
+    auto DI = FunctionDefs.find(Name);
+    if (DI == FunctionDefs.end()) {
+        return CallNativeFunction(Name, Operands, Caller);
+    }
+
+    const PrototypeAST& P = DI->second->getProto();
+    InterpreterFrame Frame; // the body may only see its own parameters
+    for (size_t i = 0; i != Operands.size(); ++i) {
+        Frame.Variables.emplace_back(P.getArgs()[i], Operands[i]);
+    }
+    double Result = DI->second->getBody()->interpret(Frame);
+    Caller.Failed |= Frame.Failed;
+    return Result;
+}
+
+bool NumberExprAST::interpretable(InterpreterCheck &Check) const {
+    return true;
+}
+
+double NumberExprAST::interpret(InterpreterFrame &Frame) const {
+    return Value;
+}
+
+bool VariableExprAST::interpretable(InterpreterCheck &Check) const {
+    return std::find(Check.Scope.begin(), Check.Scope.end(), Name) != Check.Scope.end(); // codegen reports undeclared names
+}
+
+double VariableExprAST::interpret(InterpreterFrame &Frame) const {
+    return *Frame.lookup(Name);
+}
+
+bool VarExprAST::interpretable(InterpreterCheck &Check) const {
+    if (!VarTypes.empty()) { // records => the interpreter only has doubles
+        return false;
+    }
+    size_t ScopeSize = Check.Scope.size();
+    bool Interpretable = true;
+    for (auto &Var : VarNames) { // each initializer sees the variables before it
+        if (Var.second && !Var.second->interpretable(Check)) {
+            Interpretable = false;
+            break;
+        }
+        Check.Scope.push_back(Var.first);
+    }
+    Interpretable = Interpretable && Body->interpretable(Check);
+    Check.Scope.resize(ScopeSize);
+    return Interpretable;
+}
+
+double VarExprAST::interpret(InterpreterFrame &Frame) const {
+    size_t NumVariables = Frame.Variables.size();
+    for (auto &Var : VarNames) {
+        double InitVal = Var.second ? Var.second->interpret(Frame) : 0.0; // unspecified => 0, like codegen
+        Frame.Variables.emplace_back(Var.first, InitVal);
+    }
+    double BodyValue = Body->interpret(Frame);
+    Frame.Variables.resize(NumVariables); // out of scope again
+    return BodyValue;
+}
+
+bool BinaryExprAST::interpretable(InterpreterCheck &Check) const {
+    if (Op == '=') {
+        auto* Variable = dynamic_cast<VariableExprAST*>(LHS.get());
+        return Variable && Variable->interpretable(Check) && RHS->interpretable(Check);
+    }
+    if (!LHS->interpretable(Check) || !RHS->interpretable(Check)) {
+        return false;
+    }
+    switch (Op) {
+        case '+': case '-': case '*': case '/': case '<':
+            return true;
+        default:
+            return UserOperatorInterpretable(std::string("binary") + Op, 2, Check);
+    }
+}
+
+double BinaryExprAST::interpret(InterpreterFrame &Frame) const {
+    if (Op == '=') {
+        double Value = RHS->interpret(Frame);
+        *Frame.lookup(static_cast<VariableExprAST*>(LHS.get())->getName()) = Value;
+        return Value;
+    }
+
+    double L = LHS->interpret(Frame);
+    double R = RHS->interpret(Frame);
+    switch (Op) {
+        case '+':
+            return L + R;
+        case '-':
+            return L - R;
+        case '*':
+            return L * R;
+        case '/':
+            return L / R;
+        case '<':
+            return !(L >= R) ? 1.0 : 0.0; // fcmp ult => unordered (a NaN) counts as less
+        default:
+            return InterpretUserOperator(std::string("binary") + Op, { L, R }, Frame);
+    }
+}
+
+bool CallExprAST::interpretable(InterpreterCheck &Check) const {
+    for (auto &Arg : Args) {
+        if (!Arg->interpretable(Check)) {
+            return false;
+        }
+    }
+    if (getInterpretedBuiltin(Callee, Args.size())) {
+        return true;
+    }
+    for (auto &Arg : Args) {
+        if (dynamic_cast<const NumberExprAST*>(Arg.get()) && ShouldSpecialize(Callee)) {
+            Check.Specializes = true;
+            break;
+        }
+    }
+    auto PI = FunctionProtos.find(Callee);
+    return PI != FunctionProtos.end() && PI->second->getArgs().size() == Args.size() && Args.size() <= MaxInterpretedArgs && !PI->second->hasRecords(); // a record constructor isn't a prototype either
+}
+
+double CallExprAST::interpret(InterpreterFrame &Frame) const {
+    std::vector<double> ArgValues;
+    ArgValues.reserve(Args.size());
+    for (auto &Arg : Args) {
+        ArgValues.push_back(Arg->interpret(Frame));
+    }
+    if (const InterpretedBuiltin* Builtin = getInterpretedBuiltin(Callee, Args.size())) {
+        return Builtin->Evaluate(ArgValues.data());
+    }
+    if (Frame.Failed) { // don't call into native code with the results of a failed lookup
+        return 0;
+    }
+    return CallNativeFunction(Callee, ArgValues, Frame);
+}
+
+// the task runtime needs a jitted function to hand to the workers => async and await stay with the jit
+bool AsyncExprAST::interpretable(InterpreterCheck &Check) const {
+    return false;
+}
+
+double AsyncExprAST::interpret(InterpreterFrame &Frame) const {
+    return 0;
+}
+
+bool AwaitExprAST::interpretable(InterpreterCheck &Check) const {
+    return false;
+}
+
+double AwaitExprAST::interpret(InterpreterFrame &Frame) const {
+    return 0;
+}
+
+bool FieldExprAST::interpretable(InterpreterCheck &Check) const { // records and collections are compiled code only
+    return false;
+}
+
+double FieldExprAST::interpret(InterpreterFrame &Frame) const {
+    return 0;
+}
+
+bool IndexExprAST::interpretable(InterpreterCheck &Check) const {
+    return false;
+}
+
+double IndexExprAST::interpret(InterpreterFrame &Frame) const {
+    return 0;
+}
+
+bool SoaExprAST::interpretable(InterpreterCheck &Check) const {
+    return false;
+}
+
+double SoaExprAST::interpret(InterpreterFrame &Frame) const {
+    return 0;
+}
+
+bool IfExprAST::interpretable(InterpreterCheck &Check) const {
+    return Condition->interpretable(Check) && Then->interpretable(Check) && Else->interpretable(Check);
+}
+
+double IfExprAST::interpret(InterpreterFrame &Frame) const {
+    return isTrue(Condition->interpret(Frame)) ? Then->interpret(Frame) : Else->interpret(Frame);
+}
+
+bool ForExprAST::interpretable(InterpreterCheck &Check) const {
+    Check.Loops = true;
+    if (!Start->interpretable(Check)) {
+        return false;
+    }
+    Check.Scope.push_back(VarName);
+    bool Interpretable = End->interpretable(Check) && (!Step || Step->interpretable(Check)) && Body->interpretable(Check);
+    Check.Scope.pop_back();
+    return Interpretable;
+}
+
+// same order as the general codegen => body, step, end condition (with the old value), increment, then test
+double ForExprAST::interpret(InterpreterFrame &Frame) const {
+    double StartValue = Start->interpret(Frame);
+    Frame.Variables.emplace_back(VarName, StartValue);
+    size_t Slot = Frame.Variables.size() - 1; // the body may push variables of its own, so no pointers into the vector
+    while (!Frame.Failed) {
+        Body->interpret(Frame);
+        double StepValue = Step ? Step->interpret(Frame) : 1.0;
+        double EndValue = End->interpret(Frame);
+        Frame.Variables[Slot].second += StepValue;
+        if (!isTrue(EndValue)) {
+            break;
+        }
+    }
+    Frame.Variables.pop_back();
+    return 0;
+}
+
+bool UnaryExprAST::interpretable(InterpreterCheck &Check) const {
+    return Operand->interpretable(Check) && UserOperatorInterpretable(std::string("unary") + Operator, 1, Check);
+}
+
+double UnaryExprAST::interpret(InterpreterFrame &Frame) const {
+    double OperandValue = Operand->interpret(Frame);
+    return InterpretUserOperator(std::string("unary") + Operator, { OperandValue }, Frame);
+}
+
+bool ShouldInterpret(const FunctionAST& Expression) {
+    if (TopLevelTier == ExecutionTier::JIT || EmittingObject()) {
+        return false;
+    }
+    InterpreterCheck Check;
+    if (!Expression.getBody()->interpretable(Check)) { // async/await, or an error the jit path reports properly
+        return false;
+    }
+    return TopLevelTier == ExecutionTier::Interpreter || (!Check.Loops && !Check.Recursive && !Check.Specializes);
+}
+
+bool InterpretTopLevelExpression(const FunctionAST& Expression, double& Result) {
+    InterpreterFrame Frame;
+    Result = Expression.getBody()->interpret(Frame);
+    return !Frame.Failed;
+}
+
+void ResetInterpreter() {
+    CalleeAddresses.clear();
+}
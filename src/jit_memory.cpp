@@ -0,0 +1,190 @@
+#include "../include/kaleidoscope/jit_memory.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Process.h"
+
+static constexpr size_t SlabSize = 1 << 20; // 1 MiB per slab => hundreds of one line expressions before we need to map more
+static constexpr size_t DataGranule = 16;
+
+static constexpr unsigned ReadWrite = llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_WRITE;
+
+static unsigned KindIndex(JITMemoryKind Kind) {
+    return static_cast<unsigned>(Kind);
+}
+
+JITMemoryPool::JITMemoryPool() {
+    PageSize = llvm::sys::Process::getPageSizeEstimate();
+    Arenas[KindIndex(JITMemoryKind::Code)].Granule = PageSize;
+    Arenas[KindIndex(JITMemoryKind::ROData)].Granule = PageSize;
+    Arenas[KindIndex(JITMemoryKind::RWData)].Granule = DataGranule;
+}
+
+JITMemoryPool::~JITMemoryPool() {
+    for (auto &Slab : Slabs) {
+        llvm::sys::Memory::releaseMappedMemory(Slab);
+    }
+}
+
+bool JITMemoryPool::grow(Arena& A, size_t MinSize) {
+    size_t Size = llvm::alignTo(std::max(MinSize, SlabSize), PageSize);
+
+    std::error_code EC;
+    llvm::sys::MemoryBlock Slab = llvm::sys::Memory::allocateMappedMemory(Size, nullptr, ReadWrite, EC);
+    if (EC) {
+        return false;
+    }
+
+    Slabs.push_back(Slab);
+    Usage.Mapped += Slab.allocatedSize();
+    Usage.NumSlabs++;
+    A.Free[reinterpret_cast<uintptr_t>(Slab.base())] = Slab.allocatedSize();
+    return true;
+}
+
+llvm::sys::MemoryBlock JITMemoryPool::allocate(JITMemoryKind Kind, size_t Size, size_t Alignment) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Arena& A = Arenas[KindIndex(Kind)];
+    Size = llvm::alignTo(std::max<size_t>(Size, 1), A.Granule);
+    Alignment = std::max(Alignment, A.Granule);
+
+    for (int Attempt = 0; Attempt != 2; ++Attempt) {
+        for (auto FI = A.Free.begin(); FI != A.Free.end(); ++FI) { // first fit => lowest address wins
+            uintptr_t Start = FI->first;
+            uintptr_t End = Start + FI->second;
+            uintptr_t Aligned = llvm::alignTo(Start, Alignment);
+            if (Aligned + Size > End) {
+                continue;
+            }
+
+            A.Free.erase(FI);
+            if (Aligned != Start) { // keep the padding in front of the block
+                A.Free[Start] = Aligned - Start;
+            }
+            if (Aligned + Size != End) { // ... and the rest of the free range behind it
+                A.Free[Aligned + Size] = End - (Aligned + Size);
+            }
+
+            size_t& Live = Usage.Live[KindIndex(Kind)];
+            Live += Size;
+            Usage.Peak[KindIndex(Kind)] = std::max(Usage.Peak[KindIndex(Kind)], Live);
+            return llvm::sys::MemoryBlock(reinterpret_cast<void*>(Aligned), Size);
+        }
+
+        if (!grow(A, Size + Alignment)) { // nothing fits => map another slab and try again
+            break;
+        }
+    }
+    return llvm::sys::MemoryBlock();
+}
+
+void JITMemoryPool::release(JITMemoryKind Kind, llvm::sys::MemoryBlock Block) {
+    if (!Block.base()) {
+        return;
+    }
+    if (Kind != JITMemoryKind::RWData) { // code and read only data had their permissions changed when the object was finalized
+        llvm::sys::Memory::protectMappedMemory(Block, ReadWrite);
+    }
+
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Arena& A = Arenas[KindIndex(Kind)];
+    uintptr_t Start = reinterpret_cast<uintptr_t>(Block.base());
+    size_t Size = Block.allocatedSize();
+    Usage.Live[KindIndex(Kind)] -= Size;
+
+    auto Next = A.Free.lower_bound(Start);
+    if (Next != A.Free.end() && Start + Size == Next->first) { // merge with the free range right behind us
+        Size += Next->second;
+        Next = A.Free.erase(Next);
+    }
+    if (Next != A.Free.begin()) { // ... and with the one right in front of us
+        auto Prev = std::prev(Next);
+        if (Prev->first + Prev->second == Start) {
+            Prev->second += Size;
+            return;
+        }
+    }
+    A.Free[Start] = Size;
+}
+
+JITMemoryUsage JITMemoryPool::getUsage() const {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Usage;
+}
+
+SlabMemoryManager::~SlabMemoryManager() {
+    for (auto &Entry : Blocks) {
+        Pool->release(Entry.first, Entry.second);
+    }
+}
+
+void SlabMemoryManager::reserveAllocationSpace(uintptr_t CodeSize, llvm::Align CodeAlign, uintptr_t RODataSize, llvm::Align RODataAlign, uintptr_t RWDataSize, llvm::Align RWDataAlign) {
+    uintptr_t Sizes[NumJITMemoryKinds] = { CodeSize, RODataSize, RWDataSize };
+    llvm::Align Aligns[NumJITMemoryKinds] = { CodeAlign, RODataAlign, RWDataAlign };
+
+    for (unsigned K = 0; K != NumJITMemoryKinds; ++K) { // one block per kind, so all sections of a kind end up next to each other
+        if (Sizes[K] == 0) {
+            continue;
+        }
+        llvm::sys::MemoryBlock Block = Pool->allocate(static_cast<JITMemoryKind>(K), Sizes[K], Aligns[K].value());
+        if (Block.base()) {
+            Reserved[K].Block = Block;
+            Blocks.push_back({ static_cast<JITMemoryKind>(K), Block });
+        }
+    }
+}
+
+uint8_t* SlabMemoryManager::allocateSection(JITMemoryKind Kind, uintptr_t Size, unsigned Alignment) {
+    Alignment = std::max(Alignment, 1u);
+    Reservation& R = Reserved[KindIndex(Kind)];
+
+    if (R.Block.base()) { // carve the section out of the reservation
+        uintptr_t Base = reinterpret_cast<uintptr_t>(R.Block.base());
+        uintptr_t Start = llvm::alignTo(Base + R.Used, Alignment);
+        if (Start + Size <= Base + R.Block.allocatedSize()) {
+            R.Used = Start + Size - Base;
+            return reinterpret_cast<uint8_t*>(Start);
+        }
+    }
+
+    llvm::sys::MemoryBlock Block = Pool->allocate(Kind, Size, Alignment); // RuntimeDyld asked for more than it reserved => get a block of its own
+    if (!Block.base()) {
+        return nullptr;
+    }
+    Blocks.push_back({ Kind, Block });
+    return static_cast<uint8_t*>(Block.base());
+}
+
+uint8_t* SlabMemoryManager::allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID, llvm::StringRef SectionName) {
+    return allocateSection(JITMemoryKind::Code, Size, Alignment);
+}
+
+uint8_t* SlabMemoryManager::allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID, llvm::StringRef SectionName, bool IsReadOnly) {
+    return allocateSection(IsReadOnly ? JITMemoryKind::ROData : JITMemoryKind::RWData, Size, Alignment);
+}
+
+bool SlabMemoryManager::finalizeMemory(std::string* ErrMsg) {
+    for (auto &Entry : Blocks) {
+        unsigned Flags;
+        if (Entry.first == JITMemoryKind::Code) {
+            Flags = llvm::sys::Memory::MF_READ | llvm::sys::Memory::MF_EXEC;
+        } else if (Entry.first == JITMemoryKind::ROData) {
+            Flags = llvm::sys::Memory::MF_READ;
+        } else {
+            continue; // writable data stays as it is
+        }
+
+        if (std::error_code EC = llvm::sys::Memory::protectMappedMemory(Entry.second, Flags)) {
+            if (ErrMsg) {
+                *ErrMsg = EC.message();
+            }
+            return true; // RuntimeDyld expects true on failure
+        }
+        if (Entry.first == JITMemoryKind::Code) {
+            llvm::sys::Memory::InvalidateInstructionCache(Entry.second.base(), Entry.second.allocatedSize());
+        }
+    }
+    return false;
+}
@@ -3,21 +3,77 @@
 std::string IdentifierStr;
 double NumVal;
 std::istream* input;
+SourceLocation CurLoc;
+SourceLocation LexLoc = {1, 0};
+size_t CurOffset = 0;
+bool RecordSource = false;
+std::string RecordedSource;
+
+static size_t LexOffset = 0; // characters read from the stream so far
+
+static int LastChar = ' '; // the last character read but not yet turned into a token (starts as whitespace so the first call reads)
+
+// reads the next character from the input and keeps track of the line and column we are at
+// (every caller stores the result in LastChar, so before the read LastChar is the previous character)
+static int advance() {
+    int Char = input->get();
+    if (Char != EOF) {
+        LexOffset++;
+        if (RecordSource) {
+            RecordedSource += (char)Char;
+        }
+    }
+    if (Char == '\n' && LastChar == '\r') { // the second half of a "\r\n" => the line was counted at the '\r'
+        LexLoc.Col = 0;
+    } else if (Char == '\n' || Char == '\r') { // a new line resets the column
+        LexLoc.Line++;
+        LexLoc.Col = 0;
+    } else {
+        LexLoc.Col++;
+    }
+    return Char;
+}
+
+// start lexing a fresh input stream from the beginning
+void ResetLexer() {
+    LastChar = ' '; // forget anything left over from the previous stream (like its EOF)
+    LexLoc = {1, 0};
+    LexOffset = 0;
+    CurOffset = 0;
+    RecordedSource.clear();
+}
+
+LexerState SaveLexer() {
+    return { input, LastChar, LexOffset, CurOffset, CurLoc, LexLoc, IdentifierStr, NumVal, std::move(RecordedSource) };
+}
+
+void RestoreLexer(LexerState&& State) {
+    input = State.Input;
+    LastChar = State.LastChar;
+    LexOffset = State.LexOffset;
+    CurOffset = State.CurOffset;
+    CurLoc = State.CurLoc;
+    LexLoc = State.LexLoc;
+    IdentifierStr = std::move(State.IdentifierStr);
+    NumVal = State.NumVal;
+    RecordedSource = std::move(State.RecordedSource);
+}
 
 // the entire implementation of the lexer...
 // TODO => figure out how to take file input as opposed to just standard input...
 int gettok() {
-    static int LastChar = ' '; // sets the last character to an empty character
-
     while (isspace(LastChar)) { // SKIPS WHITESPACE
         // GET CHAR IS A DEFAULT C function that reads the next character from the standard input...
-        LastChar = input->get();  // while the current character is whitespace (initialized like that) go to the next character
+        LastChar = advance();  // while the current character is whitespace (initialized like that) go to the next character
     }
 
+    CurLoc = LexLoc; // the token starts here
+    CurOffset = LastChar == EOF ? LexOffset : LexOffset - 1; // LastChar was already read
+
     // all alphanumberic combinations in any order with as many as we want... => IDENTIFIERS
     if (isalpha(LastChar) || LastChar == '_') { // looking for identifiers now.. => gets more complex in here if we want string data types too...
         IdentifierStr = LastChar; // set the identifier string to the character brought in by the input stream...
-        while (isalnum(LastChar = input->get()) || (LastChar == '_')) { // while we iterate over the character stream, and it is still an alphanumeric...
+        while (isalnum(LastChar = advance()) || (LastChar == '_')) { // while we iterate over the character stream, and it is still an alphanumeric...
             IdentifierStr += LastChar; // append the most recently read character onto the current Identifier
         }
 
@@ -55,11 +111,32 @@ int gettok() {
         if (IdentifierStr == "endspawn") {
             return tok_endspawn;
         }
+        if (IdentifierStr == "async") {
+            return tok_async;
+        }
+        if (IdentifierStr == "await") {
+            return tok_await;
+        }
+        if (IdentifierStr == "import") {
+            return tok_import;
+        }
+        if (IdentifierStr == "record") {
+            return tok_record;
+        }
+        if (IdentifierStr == "soa") {
+            return tok_soa;
+        }
 
         // if we have an alphanumeric stream and it's not a keyword, it must be an identifier, so return the appropriate token
         return tok_identifier;
     }
 
+    // a '.' in front of a name is field access (z.re, ps[i].pos.x), not the start of a number
+    if (LastChar == '.' && (isalpha(input->peek()) || input->peek() == '_')) {
+        LastChar = advance();
+        return '.';
+    }
+
     // if its a digit (OUR ONLY DATA TYPE...)
     if (isdigit(LastChar) || LastChar == '.') { 
         std::string NumStr; // declare a temporary input string for the number to be stored in...
@@ -74,18 +151,30 @@ int gettok() {
 
 
             NumStr += LastChar; // append the last character to the input stream string
-            LastChar = input->get(); // get the next character
+            LastChar = advance(); // get the next character
         } while (isdigit(LastChar) || LastChar == '.'); // so long as the new character is a digit, or a '.', keep looping
 
         NumVal = strtod(NumStr.c_str(), nullptr); // converts the NumStr to a double precision float, the 0 indicates that we don't need to tell it where to stop parsing, as the string is finite...
         return tok_number; // return a tok_number, as that is the type we have read in
     }
 
+    // a string literal => only used for the path of an import, so no escapes
+    if (LastChar == '"') {
+        IdentifierStr.clear();
+        while ((LastChar = advance()) != '"' && LastChar != EOF && LastChar != '\n') {
+            IdentifierStr += LastChar;
+        }
+        if (LastChar == '"') { // eat the closing quote
+            LastChar = advance();
+        }
+        return tok_string;
+    }
+
     // if we see the character #, we ignore the rest of the line until a '\n' character
     /*
     if (LastChar == '#') { // if we hit a '#'
         do {
-            LastChar = input->get(); // keep chugging through input until...
+            LastChar = advance(); // keep chugging through input until...
         } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r'); // we hit the end of the file, a newline, or a reset
 
         if (LastChar != EOF) { // if we're not at the end of the file...
@@ -95,10 +184,10 @@ int gettok() {
     */
 
    if (LastChar == '/') {
-        LastChar = input->get();
+        LastChar = advance();
         if (LastChar == '/') {
              do {
-                LastChar = input->get(); // keep chugging through input until...
+                LastChar = advance(); // keep chugging through input until...
             } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r'); // we hit the end of the file, a newline, or a reset
         } else {
             int divchar = '/';
@@ -117,7 +206,7 @@ int gettok() {
 
     // if the character matchs none of our tokens just spit out it's ASCII value
     int ThisChar = LastChar; // get the ASCII value of the character
-    LastChar = input->get(); // get the next character
+    LastChar = advance(); // get the next character
     return ThisChar; // return the ASCII value of the character
 
 }
\ No newline at end of file
@@ -0,0 +1,220 @@
+#include "../include/kaleidoscope/library.h"
+#include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/native_symbols.h"
+#include "../include/kaleidoscope/remote.h"
+
+#include <set>
+#include <sstream>
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+static const char* const SourceMetadata = "kaleidoscope.source"; // one string per def/decl, in source order
+
+static std::set<std::string> ImportedPaths; // real paths => importing the same library again does nothing
+
+struct ImportedLibrary {
+    std::unique_ptr<llvm::MemoryBuffer> Bitcode; // what the jit got => a restarted executor gets the same code
+    std::map<std::string, unsigned> Definitions; // name => its version right after the import (a newer one means it was redefined)
+};
+static std::vector<ImportedLibrary> Imports; // in import order (only jitted ones, an emitted file links them in)
+
+void RecordLibraryUnit(size_t Start) {
+    if (Start > CurOffset || CurOffset > RecordedSource.size()) {
+        return;
+    }
+    llvm::NamedMDNode* Source = TheModule->getOrInsertNamedMetadata(SourceMetadata);
+    Source->addOperand(llvm::MDNode::get(*TheContext, llvm::MDString::get(*TheContext, RecordedSource.substr(Start, CurOffset - Start))));
+}
+
+bool EmitBitcodeFile(llvm::Module& M, const std::string& Path) {
+    std::error_code EC;
+    llvm::raw_fd_ostream Out(Path, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+        LogError(("Could not open '" + Path + "': " + EC.message()).c_str());
+        return false;
+    }
+    llvm::WriteBitcodeToFile(M, Out);
+    Out.flush();
+    return true;
+}
+
+// the stored source of a library module
+static std::vector<std::string> LibrarySource(llvm::Module& M) {
+    std::vector<std::string> Units;
+    if (llvm::NamedMDNode* Source = M.getNamedMetadata(SourceMetadata)) {
+        for (llvm::MDNode* Unit : Source->operands()) {
+            if (Unit->getNumOperands() == 1) {
+                if (auto* Text = llvm::dyn_cast<llvm::MDString>(Unit->getOperand(0))) {
+                    Units.push_back(Text->getString().str());
+                }
+            }
+        }
+    }
+    return Units;
+}
+
+// parses the stored units without compiling them => the script's own lexer position is put back afterwards
+static bool ParseLibrarySource(const std::vector<std::string>& Units, std::vector<std::unique_ptr<FunctionAST>>& Definitions, std::vector<std::unique_ptr<PrototypeAST>>& Declarations, std::vector<std::unique_ptr<RecordDeclaration>>& RecordDeclarations) {
+    LexerState Script = SaveLexer();
+    int ScriptTok = CurTok;
+    unsigned ErrorsBefore = NumErrors;
+
+    for (auto &Text : Units) {
+        std::istringstream Stream(Text);
+        input = &Stream;
+        ResetLexer();
+        getNextToken();
+        if (CurTok == tok_def) {
+            auto Definition = ParseDefinition();
+            if (!Definition) {
+                break;
+            }
+            if (Definition->getProto().isBinaryOp()) { // codegen normally registers it, but later units already need it to parse
+                BinOpPrecedence[Definition->getProto().getOperatorName()] = Definition->getProto().getBinaryPrecedence();
+            }
+            Definitions.push_back(std::move(Definition));
+        } else if (CurTok == tok_decl) {
+            auto Declaration = ParseDecl();
+            if (!Declaration) {
+                break;
+            }
+            Declarations.push_back(std::move(Declaration));
+        } else if (CurTok == tok_record) {
+            auto Declaration = ParseRecord();
+            if (!Declaration) {
+                break;
+            }
+            RecordDeclarations.push_back(std::move(Declaration));
+        }
+    }
+
+    RestoreLexer(std::move(Script));
+    CurTok = ScriptTok;
+    return NumErrors == ErrorsBefore;
+}
+
+bool ImportLibrary(const std::string& Path) {
+    llvm::SmallString<256> RealPath;
+    if (llvm::sys::fs::real_path(Path, RealPath)) {
+        LogError(("Library '" + Path + "' not found.").c_str());
+        return false;
+    }
+    if (ImportedPaths.count(RealPath.str().str())) {
+        return true;
+    }
+
+    auto Buffer = llvm::MemoryBuffer::getFile(RealPath);
+    if (!Buffer) {
+        LogError(("Could not read '" + Path + "': " + Buffer.getError().message()).c_str());
+        return false;
+    }
+    auto Loaded = llvm::parseBitcodeFile((*Buffer)->getMemBufferRef(), *TheContext);
+    if (!Loaded) {
+        LogError(("'" + Path + "' is not a bitcode library: " + llvm::toString(Loaded.takeError())).c_str());
+        return false;
+    }
+    std::unique_ptr<llvm::Module> Library = std::move(*Loaded);
+    if (llvm::Triple(Library->getTargetTriple()).getArch() != TheTM->getTargetTriple().getArch()) {
+        LogError(("'" + Path + "' was compiled for " + Library->getTargetTriple() + ".").c_str());
+        return false;
+    }
+
+    std::vector<std::string> Units = LibrarySource(*Library);
+    if (Units.empty()) {
+        LogError(("'" + Path + "' has no kaleidoscope source in it (it wasn't written by --emit-bc).").c_str());
+        return false;
+    }
+
+    // parse everything before touching the session => a library that doesn't fit leaves nothing half imported
+    std::map<char, int> Precedences = BinOpPrecedence;
+    std::vector<std::unique_ptr<FunctionAST>> Definitions;
+    std::vector<std::unique_ptr<PrototypeAST>> Declarations;
+    std::vector<std::unique_ptr<RecordDeclaration>> RecordDeclarations;
+    bool Parsed = ParseLibrarySource(Units, Definitions, Declarations, RecordDeclarations);
+    for (auto &Definition : Definitions) {
+        if (Parsed && FunctionDefs.count(Definition->getProto().getName())) { // the jit can't hold two bodies under one name
+            LogError(("'" + Definition->getProto().getName() + "' from '" + Path + "' is already defined.").c_str());
+            Parsed = false;
+        }
+    }
+    for (auto &Declaration : RecordDeclarations) { // the importer's own record of the same name has to have the same fields
+        Parsed = Parsed && DefineRecord(*Declaration);
+    }
+    if (!Parsed) {
+        BinOpPrecedence = Precedences;
+        return false;
+    }
+
+    Library->setDataLayout(TheModule->getDataLayout());
+    Library->setTargetTriple(TheModule->getTargetTriple());
+    if (EmittingObject()) { // part of the output => its source metadata comes along, so the output imports it again
+        if (llvm::Linker::linkModules(*TheModule, std::move(Library))) {
+            LogError(("Could not link '" + Path + "' into the output module.").c_str());
+            BinOpPrecedence = Precedences;
+            return false;
+        }
+    } else {
+        AddDefinitionModule(std::move(Library)); // every executor needs it
+    }
+
+    for (auto &Declaration : Declarations) {
+        std::string Name = Declaration->getName();
+        BindNativeSymbol(Name); // the library's code calls it too
+        FunctionProtos[Name] = std::move(Declaration);
+        NoteFunctionChanged(Name);
+    }
+    ImportedLibrary Imported;
+    for (auto &Definition : Definitions) {
+        std::string Name = Definition->getProto().getName();
+        FunctionProtos[Name] = std::make_unique<PrototypeAST>(Definition->getProto());
+        FunctionDefs[Name] = std::move(Definition); // the body is compiled already, the AST is the operator template (and the callee list)
+        NoteFunctionChanged(Name);
+        Imported.Definitions[Name] = FunctionVersions[Name];
+    }
+    if (!EmittingObject()) {
+        Imported.Bitcode = std::move(*Buffer);
+        Imports.push_back(std::move(Imported));
+    }
+    ImportedPaths.insert(RealPath.str().str());
+    fprintf(stderr, "Imported %zu definitions from '%s'.\n", Definitions.size(), Path.c_str());
+    return true;
+}
+
+void ResetImports() {
+    ImportedPaths.clear();
+    Imports.clear();
+}
+
+bool IsImportedDefinition(const std::string& Name) {
+    for (auto &Imported : Imports) {
+        auto DI = Imported.Definitions.find(Name);
+        if (DI != Imported.Definitions.end()) {
+            return DI->second == FunctionVersions[Name];
+        }
+    }
+    return false;
+}
+
+std::vector<std::unique_ptr<llvm::Module>> ReloadImports() {
+    std::vector<std::unique_ptr<llvm::Module>> Modules;
+    for (auto &Imported : Imports) {
+        std::unique_ptr<llvm::Module> Library = ExitOnErr(llvm::parseBitcodeFile(Imported.Bitcode->getMemBufferRef(), *TheContext)); // it was read fine before
+        Library->setDataLayout(TheModule->getDataLayout());
+        Library->setTargetTriple(TheModule->getTargetTriple());
+        for (auto &Definition : Imported.Definitions) { // the session's body of it is compiled with the rest of the definitions
+            if (!IsImportedDefinition(Definition.first)) {
+                if (llvm::Function* F = Library->getFunction(Definition.first)) {
+                    F->deleteBody();
+                }
+            }
+        }
+        Modules.push_back(std::move(Library));
+    }
+    return Modules;
+}
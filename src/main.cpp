@@ -1,45 +1,301 @@
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
 #include <iostream>
-#include "../include/kaleidoscope/AST.h"
-#include "../include/kaleidoscope/parser.h"
-#include "../include/kaleidoscope/lexer.h"
-#include "../include/kaleidoscope/codegen.h"
-#include "../include/kaleidoscope/expression_handler.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "../include/kaleidoscope/engine.h"
+#include "../include/kaleidoscope/server.h"
+
+// --batch=name:inputs.csv => evaluates name over every row of the csv (one column per parameter) and prints one result per line
+// also times the vectorized batch wrapper against calling the function once per element and reports elements/sec for both
+// (not in instrumented runs => the timing passes would be counted in the profile or call stats as well)
+static int RunBatch(kaleidoscope::Engine& Engine, const std::string& Spec, bool Instrumented) {
+    size_t Colon = Spec.find(':');
+    if (Colon == std::string::npos) {
+        fprintf(stderr, "Expected --batch=function:inputs.csv\n");
+        return 1;
+    }
+    std::string Name = Spec.substr(0, Colon);
+
+    std::ifstream Inputs(Spec.substr(Colon + 1));
+    if (!Inputs) {
+        fprintf(stderr, "File not found.\n");
+        return 1;
+    }
+
+    std::vector<std::vector<double>> Columns; // column major, which is what the batch wrapper wants
+    std::string Line;
+    for (size_t LineNumber = 1; std::getline(Inputs, Line); ++LineNumber) {
+        if (!Line.empty() && Line.back() == '\r') { // csv files written on windows
+            Line.pop_back();
+        }
+        if (Line.empty()) {
+            continue;
+        }
+        std::stringstream Row(Line);
+        std::string Field;
+        for (size_t c = 0; std::getline(Row, Field, ','); ++c) {
+            const char* Text = Field.c_str();
+            char* End = nullptr;
+            double Value = strtod(Text, &End);
+            bool Parsed = End != Text;
+            while (isspace((unsigned char)*End)) { // "1, 2" is fine
+                ++End;
+            }
+            if (!Parsed || *End != '\0') { // an empty field, a header row or trailing junk would silently become 0
+                fprintf(stderr, "Expected a number at line %zu, column %zu of the batch inputs, not '%s'.\n", LineNumber, c + 1, Field.c_str());
+                return 1;
+            }
+            if (Columns.size() <= c) {
+                Columns.resize(c + 1);
+            }
+            Columns[c].push_back(Value);
+        }
+    }
+
+    size_t Count = Columns.empty() ? 0 : Columns[0].size();
+    std::vector<const double*> ColumnPointers;
+    for (auto &Column : Columns) {
+        if (Column.size() != Count) {
+            fprintf(stderr, "Every row needs the same number of columns.\n");
+            return 1;
+        }
+        ColumnPointers.push_back(Column.data());
+    }
+
+    std::vector<double> Out(Count);
+    if (!Engine.evaluateBatch(Name, ColumnPointers, Out.data(), Count)) { // the first call also compiles the wrapper
+        return 1;
+    }
+
+    if (Instrumented) {
+        for (double Result : Out) {
+            printf("%f\n", Result);
+        }
+        return 0;
+    }
+
+    // time both ways of evaluating over the same inputs (compilation is already out of the way)
+    auto Start = std::chrono::steady_clock::now();
+    Engine.evaluateEach(Name, ColumnPointers, Out.data(), Count);
+    auto Middle = std::chrono::steady_clock::now();
+    Engine.evaluateBatch(Name, ColumnPointers, Out.data(), Count);
+    auto End = std::chrono::steady_clock::now();
+
+    double EachSeconds = std::chrono::duration<double>(Middle - Start).count();
+    double BatchSeconds = std::chrono::duration<double>(End - Middle).count();
+    if (Count > 0 && EachSeconds > 0 && BatchSeconds > 0) { // an empty (or too small to time) input has no meaningful rate
+        fprintf(stderr, "per element calls: %zu elements in %f s (%.0f elements/sec)\n", Count, EachSeconds, Count / EachSeconds);
+        fprintf(stderr, "batch wrapper:     %zu elements in %f s (%.0f elements/sec)\n", Count, BatchSeconds, Count / BatchSeconds);
+    } else {
+        fprintf(stderr, "%zu elements, too few to time.\n", Count);
+    }
+
+    for (double Result : Out) {
+        printf("%f\n", Result);
+    }
+    return 0;
+}
+
+// the N of --option=N => false (and a usage error) unless all of it is a number that fits
+static bool ParseCount(const std::string& Arg, size_t Prefix, unsigned& Count) {
+    const char* Text = Arg.c_str() + Prefix;
+    char* End = nullptr;
+    errno = 0;
+    unsigned long Value = std::strtoul(Text, &End, 10);
+    if (*Text < '0' || *Text > '9' || *End != '\0' || errno == ERANGE || Value > UINT_MAX) { // strtoul takes "-1" and leading spaces too
+        fprintf(stderr, "Expected a number in '%s'.\n", Arg.c_str());
+        return false;
+    }
+    Count = (unsigned)Value;
+    return true;
+}
+
+// ./main is just a thin client of the kaleidoscope engine library
 int main(int argc, char** argv) {
-    llvm::InitializeNativeTarget(); // checks the target architecture on the local host
-    llvm::InitializeNativeTargetAsmPrinter(); // initializes a native assembly printer
-    llvm::InitializeNativeTargetAsmParser(); // initializes a native assembly parser
-
-    // indicate our operator precedence
-    BinOpPrecedence['='] = 2;
-    BinOpPrecedence['<'] = 10;
-    BinOpPrecedence['+'] = 20;
-    BinOpPrecedence['-'] = 30;
-    BinOpPrecedence['*'] = 40;
-    BinOpPrecedence['/'] = 50;
+    kaleidoscope::EngineOptions Options; // filled in from the command line
+    const char* ScriptPath = nullptr; // the script to run (if any)
+    std::string BatchSpec; // --batch=function:inputs.csv
+    bool JITMemStats = false; // --jit-mem-stats
+    bool Watch = false; // --watch
+    std::string ServePath; // --serve=socket
+    std::string ClientPath; // --client=socket
+    bool ServerStats = false; // --stats
+    std::string Self = argv[0];
+    size_t Slash = Self.find_last_of("/\\");
+    Options.ExecutorPath = (Slash == std::string::npos ? std::string(".") : Self.substr(0, Slash)) + "/kaleidoscope_executor"; // built next to ./main
+    for (int i = 1; i < argc; ++i) { // options start with "--", anything else is the script
+        std::string Arg = argv[i];
+        if (Arg.rfind("--output=", 0) == 0) { // where putchard/printd output goes => stdout, stderr, or a file
+            Options.Output = Arg.substr(9);
+        } else if (Arg.rfind("--profile-generate=", 0) == 0) { // instrumented run => counters are written to this file at exit
+            Options.ProfileGeneratePath = Arg.substr(19);
+        } else if (Arg.rfind("--profile-use=", 0) == 0) { // optimize using a profile from an earlier instrumented run
+            Options.ProfileUsePath = Arg.substr(14);
+        } else if (Arg == "--profile") { // sample the run and print which functions the time went to
+            Options.SampleProfile = true;
+        } else if (Arg.rfind("--profile=", 0) == 0) { // ... and write the samples as collapsed stacks for flamegraph.pl
+            Options.SampleProfile = true;
+            Options.SampleStacksPath = Arg.substr(10);
+        } else if (Arg == "--instrument-calls") { // exact call counts and time per function, printed at exit ('stats' prints them at the prompt)
+            Options.InstrumentCalls = true;
+        } else if (Arg.rfind("--instrument-calls=", 0) == 0) { // ... and written as json to this file
+            Options.InstrumentCalls = true;
+            Options.CallStatsPath = Arg.substr(19);
+        } else if (Arg.rfind("--load=", 0) == 0) { // a shared library 'decl' may bind native functions from (repeatable, searched in order)
+            Options.Libraries.push_back(Arg.substr(7));
+        } else if (Arg == "--load" && i + 1 < argc) { // same, as "--load libfoo.so"
+            Options.Libraries.push_back(argv[++i]);
+        } else if (Arg.rfind("--batch=", 0) == 0) { // evaluate a function over a csv of inputs once the script is loaded
+            BatchSpec = Arg.substr(8);
+        } else if (Arg == "--parallel") { // run independent top level expressions of a script on every core
+            Options.ParallelThreads = std::max(1u, std::thread::hardware_concurrency());
+        } else if (Arg.rfind("--parallel=", 0) == 0) { // ... or on this many worker threads
+            if (!ParseCount(Arg, 11, Options.ParallelThreads)) {
+                return 1;
+            }
+        } else if (Arg.rfind("--workers=", 0) == 0) { // worker threads for async calls (one per core by default)
+            if (!ParseCount(Arg, 10, Options.TaskWorkers)) {
+                return 1;
+            }
+        } else if (Arg == "--jit-mem-stats") { // report how much memory the compiled code occupies once the session is over
+            JITMemStats = true;
+        } else if (Arg.rfind("--tier=", 0) == 0) { // how top level expressions run => auto, interp or jit
+            Options.Tier = Arg.substr(7);
+        } else if (Arg == "--no-expr-cache") { // compile every top level expression from scratch, even if it was seen before
+            Options.CacheExpressions = false;
+        } else if (Arg == "--no-specialize") { // always call the generic version of a definition, even with constant arguments
+            Options.Specialize = false;
+        } else if (Arg == "--no-bounds-check") { // index soa collections without checking against their size
+            Options.CheckBounds = false;
+        } else if (Arg == "--watch") { // keep running and reload the script (only what changed) every time it is saved
+            Watch = true;
+        } else if (Arg.rfind("--executors=", 0) == 0) { // run the jitted code in N executor processes (a crashing script only takes an executor down)
+            if (!ParseCount(Arg, 12, Options.Executors)) {
+                return 1;
+            }
+        } else if (Arg.rfind("--executor-path=", 0) == 0) { // the executor binary, if it isn't next to ./main
+            Options.ExecutorPath = Arg.substr(16);
+        } else if (Arg.rfind("--serve=", 0) == 0) { // keep running as a compile server on this unix socket (the script, if any, is the prelude)
+            ServePath = Arg.substr(8);
+        } else if (Arg == "--serve" && i + 1 < argc) {
+            ServePath = argv[++i];
+        } else if (Arg.rfind("--client=", 0) == 0) { // run the script on the compile server behind this socket instead of in this process
+            ClientPath = Arg.substr(9);
+        } else if (Arg == "--client" && i + 1 < argc) {
+            ClientPath = argv[++i];
+        } else if (Arg == "--stats") { // with --client => print the server's latency percentiles
+            ServerStats = true;
+        } else if (Arg.rfind("--emit-obj=", 0) == 0) { // compile the script's definitions into an object file instead of running it
+            Options.ObjectPath = Arg.substr(11);
+        } else if (Arg.rfind("--emit-bc=", 0) == 0) { // compile the script's definitions into a bitcode library for 'import "lib.bc"'
+            Options.BitcodePath = Arg.substr(10);
+        } else if (Arg.rfind("--target=", 0) == 0) { // target triple of the object file (e.g. aarch64-linux-gnu)
+            Options.TargetTriple = Arg.substr(9);
+        } else if (Arg.rfind("--cpu=", 0) == 0) { // cpu of the object file (e.g. cortex-a72)
+            Options.TargetCPU = Arg.substr(6);
+        } else if (Arg.rfind("--features=", 0) == 0) { // extra target features of the object file (e.g. +neon)
+            Options.TargetFeatures = Arg.substr(11);
+        } else if (Arg.rfind("--", 0) == 0) {
+            fprintf(stderr, "Unknown option '%s'.\n", Arg.c_str());
+            return 1;
+        } else {
+            ScriptPath = argv[i];
+        }
+    }
+
+    if (!ClientPath.empty()) { // the client never needs llvm => no engine at all
+        if (ServerStats) {
+            return RequestServerStats(ClientPath);
+        }
+        if (!ScriptPath) {
+            fprintf(stderr, "--client needs a script to submit (or --stats).\n");
+            return 1;
+        }
+        return SubmitScript(ClientPath, ScriptPath);
+    }
+    if (ServerStats) {
+        fprintf(stderr, "--stats only applies to --client.\n");
+        return 1;
+    }
+
+    bool AheadOfTime = !Options.ObjectPath.empty() || !Options.BitcodePath.empty();
+    if (!AheadOfTime && (!Options.TargetTriple.empty() || !Options.TargetCPU.empty() || !Options.TargetFeatures.empty())) {
+        fprintf(stderr, "--target, --cpu and --features only apply to --emit-obj and --emit-bc.\n");
+        return 1;
+    }
+    if (Watch && (!ScriptPath || AheadOfTime)) {
+        fprintf(stderr, "--watch needs a script to watch, and the jit (it can't be combined with --emit-obj or --emit-bc).\n");
+        return 1;
+    }
+    if (AheadOfTime && !BatchSpec.empty()) {
+        fprintf(stderr, "--batch needs the jit, it can't be combined with --emit-obj or --emit-bc.\n");
+        return 1;
+    }
+
+    if (!ServePath.empty() && (Watch || AheadOfTime || !BatchSpec.empty() || Options.SampleProfile || Options.Executors > 0)) {
+        fprintf(stderr, "--serve can't be combined with --watch, --emit-obj, --emit-bc, --batch, --profile or --executors.\n");
+        return 1;
+    }
+    if (Options.Executors > 0 && (Watch || AheadOfTime || !BatchSpec.empty())) {
+        fprintf(stderr, "--executors can't be combined with --watch, --batch (they call the code from this process), --emit-obj or --emit-bc.\n");
+        return 1;
+    }
 
     std::fstream file;
-    if (argc > 1) {
-        file.open(argv[1]);
+    if (ScriptPath) {
+        file.open(ScriptPath);
         if (!file) {
             fprintf(stderr, "File not found.\n");
             return 0;
         }
-        input = &file;
-    } else {
-        fprintf(stderr, ">> "); // prime the inital token
-        input = &std::cin;
     }
 
-    getNextToken(); // go the the next one...
-
-    TheJIT = ExitOnErr(llvm::orc::KaleidoscopeJIT::Create());
+    kaleidoscope::Engine Engine(Options); // sets up llvm and the jit
+    if (!Engine.ok()) { // the error was reported already
+        return 1;
+    }
 
-    InitializeModuleAndManagers();
+    int Result = -1; // set once a batch run decides the exit code
+    if (!ServePath.empty()) {
+        if (ScriptPath) {
+            Engine.loadStream(file); // the prelude every request starts from
+        }
+        return Engine.serve(ServePath);
+    }
+    if (ScriptPath && Watch) {
+        Engine.watchFile(ScriptPath); // run the script, then again (incrementally) after every save
+    } else if (ScriptPath) {
+        Engine.loadStream(file); // run the script
+        if (!BatchSpec.empty()) {
+            Result = RunBatch(Engine, BatchSpec, !Options.ProfileGeneratePath.empty() || Options.InstrumentCalls);
+        }
+    } else {
+        Engine.loadStream(std::cin); // run the interactive prompt
+    }
 
-    MainLoop(); // run the maininterpreter loop
+    if (!Options.ObjectPath.empty() && !Engine.emitObject()) { // everything is loaded => write it out
+        Result = 1;
+    }
+    if (!Options.BitcodePath.empty() && !Engine.emitBitcode()) {
+        Result = 1;
+    }
 
-    TheModule->print(llvm::errs(), nullptr);
+    if (Result < 0) {
+        Engine.dumpModule();
+        Result = 0;
+    }
+    if (JITMemStats) {
+        Engine.printJITMemoryStats();
+    }
 
-    return 0;
-}
\ No newline at end of file
+    return Result;
+}
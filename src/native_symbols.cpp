@@ -0,0 +1,153 @@
+#include "../include/kaleidoscope/native_symbols.h"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "llvm/Support/DynamicLibrary.h"
+
+#include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/tasks.h"
+#include "../include/kaleidoscope/call_stats.h"
+#include "../include/kaleidoscope/remote.h"
+#include "../include/kaleidoscope/records.h"
+
+extern "C" double putchard(double X); // expression_handler.cpp
+extern "C" double printd(double X);
+extern "C" double flushd();
+
+typedef double (*UnaryMath)(double);
+typedef double (*BinaryMath)(double, double);
+
+// name => address of everything jitted code may call without a --load library
+static const std::map<std::string, void*>& BuiltinTable() {
+    static const std::map<std::string, void*> Table = {
+        { "putchard", (void*)&putchard },
+        { "printd", (void*)&printd },
+        { "flushd", (void*)&flushd },
+        { "kaleidoscope_async", (void*)&kaleidoscope_async },
+        { "kaleidoscope_await", (void*)&kaleidoscope_await },
+        { "kaleidoscope_enter", (void*)&kaleidoscope_enter },
+        { "kaleidoscope_exit", (void*)&kaleidoscope_exit },
+        { "kaleidoscope_soa_alloc", (void*)&kaleidoscope_soa_alloc },
+        { "kaleidoscope_soa_free", (void*)&kaleidoscope_soa_free },
+        { "kaleidoscope_soa_out_of_bounds", (void*)&kaleidoscope_soa_out_of_bounds },
+
+        // the math builtins are intrinsics, which the backend turns into calls to these when there is no instruction for them
+        { "sin", (void*)(UnaryMath)&::sin },
+        { "cos", (void*)(UnaryMath)&::cos },
+        { "tan", (void*)(UnaryMath)&::tan },
+        { "exp", (void*)(UnaryMath)&::exp },
+        { "exp2", (void*)(UnaryMath)&::exp2 },
+        { "log", (void*)(UnaryMath)&::log },
+        { "log2", (void*)(UnaryMath)&::log2 },
+        { "log10", (void*)(UnaryMath)&::log10 },
+        { "sqrt", (void*)(UnaryMath)&::sqrt },
+        { "fabs", (void*)(UnaryMath)&::fabs },
+        { "floor", (void*)(UnaryMath)&::floor },
+        { "ceil", (void*)(UnaryMath)&::ceil },
+        { "trunc", (void*)(UnaryMath)&::trunc },
+        { "round", (void*)(UnaryMath)&::round },
+        { "rint", (void*)(UnaryMath)&::rint },
+        { "nearbyint", (void*)(UnaryMath)&::nearbyint },
+        { "pow", (void*)(BinaryMath)&::pow },
+        { "fmod", (void*)(BinaryMath)&::fmod },
+        { "fmin", (void*)(BinaryMath)&::fmin },
+        { "fmax", (void*)(BinaryMath)&::fmax },
+        { "copysign", (void*)(BinaryMath)&::copysign },
+        { "fma", (void*)(double (*)(double, double, double))&::fma },
+
+        // loops the optimizer turns into memory intrinsics
+        { "memcpy", (void*)(void* (*)(void*, const void*, size_t))&::memcpy },
+        { "memmove", (void*)(void* (*)(void*, const void*, size_t))&::memmove },
+        { "memset", (void*)(void* (*)(void*, int, size_t))&::memset },
+    };
+    return Table;
+}
+
+// platform helpers the backend may also call (sin and cos of the same value become sincos, big frames probe the stack, ...)
+// => not declared portably, so they are looked up by name once, and only these names
+static const char* const PlatformHelpers[] = { "sincos", "__sincos_stret", "exp10", "__exp10", "__bzero", "__chkstk", "___chkstk_darwin", "__chkstk_darwin" };
+
+static std::vector<llvm::sys::DynamicLibrary> Libraries; // --load, in load order
+static std::map<std::string, void*> Bound; // every native name defined in the jit so far
+
+static bool Define(const std::string& Name, void* Address) {
+    if (auto Err = TheJIT->defineNative(Name, llvm::orc::ExecutorAddr::fromPtr(Address))) {
+        LogError(llvm::toString(std::move(Err)).c_str());
+        return false;
+    }
+    Bound[Name] = Address;
+    return true;
+}
+
+std::vector<std::pair<std::string, void*>> BuiltinSymbols() {
+    std::vector<std::pair<std::string, void*>> Symbols(BuiltinTable().begin(), BuiltinTable().end());
+    llvm::sys::DynamicLibrary Process = llvm::sys::DynamicLibrary::getPermanentLibrary(nullptr);
+    for (const char* Name : PlatformHelpers) {
+        if (void* Address = Process.getAddressOfSymbol(Name)) {
+            Symbols.emplace_back(Name, Address);
+        }
+    }
+    return Symbols;
+}
+
+void RegisterBuiltinSymbols() {
+    for (auto &Entry : BuiltinSymbols()) {
+        Define(Entry.first, Entry.second);
+    }
+}
+
+bool LoadNativeLibrary(const std::string& Path) {
+    if (RemoteExecution()) { // the code that calls into it runs in the executors
+        return LoadRemoteLibrary(Path);
+    }
+    std::string Error;
+    llvm::sys::DynamicLibrary Library = llvm::sys::DynamicLibrary::getLibrary(Path.c_str(), &Error); // not added to the process wide search
+    if (!Library.isValid()) {
+        LogError(("Could not load '" + Path + "': " + Error).c_str());
+        return false;
+    }
+    Libraries.push_back(Library);
+    return true;
+}
+
+bool DefineNativeSymbol(const std::string& Name, void* Address) {
+    if (RemoteExecution()) {
+        LogError(("'" + Name + "' is a function of this process, code running in an executor can't call it.").c_str());
+        return false;
+    }
+    auto BI = Bound.find(Name);
+    if (BI != Bound.end()) {
+        if (BI->second == Address) {
+            return true;
+        }
+        LogError(("'" + Name + "' is already bound to another native function.").c_str());
+        return false;
+    }
+    return Define(Name, Address);
+}
+
+bool BindNativeSymbol(const std::string& Name) {
+    if (RemoteExecution()) {
+        return BindRemoteSymbol(Name);
+    }
+    if (EmittingObject() || Bound.count(Name)) { // the object's linker resolves it / bound already
+        return true;
+    }
+    for (auto &Library : Libraries) {
+        if (void* Address = Library.getAddressOfSymbol(Name.c_str())) {
+            return Define(Name, Address);
+        }
+    }
+    return false;
+}
+
+void ResetNativeSymbols() {
+    Bound.clear();
+    for (auto &Library : Libraries) {
+        llvm::sys::DynamicLibrary::closeLibrary(Library);
+    }
+    Libraries.clear();
+}
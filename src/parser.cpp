@@ -1,6 +1,7 @@
 #include "../include/kaleidoscope/parser.h"
 
 int CurTok;
+unsigned NumErrors = 0; // how many errors have been reported so far (lets embedders tell whether a load succeeded)
 
 std::map<char, int> BinOpPrecedence;
 
@@ -13,9 +14,14 @@ int getNextToken() {
 
 std::unique_ptr<ExprAST> LogError(const char* Str) {
     fprintf(stderr, "Error: %s\n", Str); // writes the error message to the filestream
+    NumErrors++;
     return nullptr; // returns a null pointer
 }
 
+void LogWarning(const char* Str) {
+    fprintf(stderr, "Warning: %s\n", Str); // not an error => doesn't count towards NumErrors
+}
+
 std::unique_ptr<PrototypeAST> LogErrorP(const char* Str) {
     LogError(Str); // calls the LogError function on the passes string
     return nullptr; // returns a null pointer
@@ -48,6 +54,7 @@ std::unique_ptr<ExprAST> ParseParenExpr() {
 
 // parses identifiers (VARIABLES AND FUNCTION CALLS!!!)
 std::unique_ptr<ExprAST> ParseIdentifierExpr() {
+    SourceLocation IdLoc = CurLoc; // remember where the identifier started
     std::string IdName = IdentifierStr; // gets the value stored in identifier string, which is a byproduct of the lexer (buffer for the identifier in the current token...)
     getNextToken(); // consume the identifier as we have now stored it in IdName
 
@@ -75,13 +82,59 @@ std::unique_ptr<ExprAST> ParseIdentifierExpr() {
 
     getNextToken(); //consume the closing ')'
 
-    return std::make_unique<CallExprAST>(IdName, std::move(Args)); // create and return a unique pointer to a Call Expression with the IdName and parsed collection of arguments
+    return std::make_unique<CallExprAST>(IdLoc, IdName, std::move(Args)); // create and return a unique pointer to a Call Expression with the IdName and parsed collection of arguments
+}
+
+// ': complex' or ': soa complex' => the type of a parameter, a variable or a field (see records.h)
+static bool ParseTypeAnnotation(std::string& Type) {
+    getNextToken(); // consume the ':'
+    std::string Prefix;
+    if (CurTok == tok_soa) {
+        Prefix = "soa ";
+        getNextToken(); // consume the "soa" keyword
+    }
+    if (CurTok != tok_identifier) {
+        LogError("Expected a record name after ':'.");
+        return false;
+    }
+    Type = Prefix + IdentifierStr;
+    getNextToken(); // consume the record name
+    return true;
+}
+
+// soa particle(n) => the size is any expression
+std::unique_ptr<ExprAST> ParseSoaExpr() {
+    SourceLocation SoaLoc = CurLoc;
+    getNextToken(); // consume the "soa" keyword
+
+    if (CurTok != tok_identifier) {
+        return LogError("Expected a record name after 'soa'.");
+    }
+    std::string Record = IdentifierStr;
+    getNextToken(); // consume the record name
+
+    if (CurTok != '(') {
+        return LogError("Expected '(' and the number of records after 'soa'.");
+    }
+    getNextToken(); // consume the '('
+    auto Size = ParseExpression();
+    if (!Size) {
+        return nullptr;
+    }
+    if (CurTok != ')') {
+        return LogError("Expected ')' after the number of records.");
+    }
+    getNextToken(); // consume the ')'
+
+    return std::make_unique<SoaExprAST>(SoaLoc, Record, std::move(Size));
 }
 
 std::unique_ptr<ExprAST> ParseVarExpr() {
     getNextToken(); // consume the "spawn" keyword
 
     std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames; // a vector of pairs of variable names, as well as their evaluation before assignment
+    std::vector<std::string> VarTypes; // the optional ': record' of each one
+    bool Typed = false;
 
     if (CurTok != tok_identifier) { // if there is not at least one identifier after the var keyword, pass back a nullptr
         LogErrorP("Expected at least one identifier after 'spawn'.");
@@ -91,10 +144,18 @@ std::unique_ptr<ExprAST> ParseVarExpr() {
     while(true) {
         std::string Name = IdentifierStr; // hold the name of the current identifier
         getNextToken(); // consume the identifier name
+        std::string Type;
+        if (CurTok == ':') {
+            if (!ParseTypeAnnotation(Type)) {
+                return nullptr;
+            }
+            Typed = true;
+        }
+        VarTypes.push_back(Type);
         std::unique_ptr<ExprAST> InitialVal; // declares a pointer which may or may not hold an initial value
         if (CurTok == '=') { // if we are declaring an initial value...
             getNextToken(); // consume the '='
-            InitialVal = ParseExpression(); // parse the initial value
+            InitialVal = CurTok == tok_soa ? ParseSoaExpr() : ParseExpression(); // parse the initial value (the only place a collection can be created)
             if (!InitialVal) { // return a nullptr if we didn't parse the expression properly
                 return nullptr;
             }
@@ -123,10 +184,45 @@ std::unique_ptr<ExprAST> ParseVarExpr() {
         return nullptr; // if the body isn't parsed, throw back a nullptr
     }
 
-    return std::make_unique<VarExprAST>(std::move(VarNames), std::move(Body));
+    if (!Typed) {
+        VarTypes.clear(); // untyped => the canonical form (and the interpreter) see the same tree as before records existed
+    }
+    return std::make_unique<VarExprAST>(std::move(VarNames), std::move(Body), std::move(VarTypes));
 }
 
 
+// async f(args) => the same syntax as a call, with the keyword in front
+std::unique_ptr<ExprAST> ParseAsyncExpr() {
+    SourceLocation AsyncLoc = CurLoc;
+    getNextToken(); // consume the "async" keyword
+
+    if (CurTok != tok_identifier) {
+        return LogError("Expected a function call after 'async'.");
+    }
+    auto Expression = ParseIdentifierExpr();
+    if (!Expression) {
+        return nullptr;
+    }
+    if (!dynamic_cast<CallExprAST*>(Expression.get())) { // a plain variable, not a call
+        return LogError("Expected a function call after 'async'.");
+    }
+
+    std::unique_ptr<CallExprAST> Call(static_cast<CallExprAST*>(Expression.release()));
+    return std::make_unique<AsyncExprAST>(AsyncLoc, std::move(Call));
+}
+
+// await h => binds like a unary operator, so 'await a + await b' adds the two results
+std::unique_ptr<ExprAST> ParseAwaitExpr() {
+    SourceLocation AwaitLoc = CurLoc;
+    getNextToken(); // consume the "await" keyword
+
+    auto Handle = ParseUnaryExpr();
+    if (!Handle) {
+        return nullptr;
+    }
+    return std::make_unique<AwaitExprAST>(AwaitLoc, std::move(Handle));
+}
+
 // Helper function that parses primary expressions (NUMERIC, IDENTIFIERS, PARENTHETICAL)
 std::unique_ptr<ExprAST> ParsePrimary() {
     switch (CurTok) { // based on the type of token we are parsing...
@@ -145,7 +241,43 @@ std::unique_ptr<ExprAST> ParsePrimary() {
             return ParseForExpr(); // parses for loop expressions in their totality
         case tok_var:
             return ParseVarExpr(); // parse local variable declaration expressions
+        case tok_async:
+            return ParseAsyncExpr(); // parse a call that runs on the task runtime
+        case tok_await:
+            return ParseAwaitExpr(); // parse waiting for one
+        case tok_soa:
+            getNextToken();
+            return LogError("A 'soa' collection can only be created as the initial value of a 'spawn' variable (which owns it).");
+    }
+}
+
+// field accesses and indexing after a primary expression => z.re, ps[i].pos.x, ps.size
+std::unique_ptr<ExprAST> ParsePostfix(std::unique_ptr<ExprAST> Base) {
+    while (Base) {
+        SourceLocation PostfixLoc = CurLoc;
+        if (CurTok == '.') {
+            getNextToken(); // consume the '.'
+            if (CurTok != tok_identifier) {
+                return LogError("Expected a field name after '.'.");
+            }
+            Base = std::make_unique<FieldExprAST>(PostfixLoc, std::move(Base), IdentifierStr);
+            getNextToken(); // consume the field name
+        } else if (CurTok == '[') {
+            getNextToken(); // consume the '['
+            auto Index = ParseExpression();
+            if (!Index) {
+                return nullptr;
+            }
+            if (CurTok != ']') {
+                return LogError("Expected ']' after an index.");
+            }
+            getNextToken(); // consume the ']'
+            Base = std::make_unique<IndexExprAST>(PostfixLoc, std::move(Base), std::move(Index));
+        } else {
+            break;
+        }
     }
+    return Base;
 }
 
 
@@ -249,6 +381,8 @@ std::unique_ptr<PrototypeAST> ParsePrototype() {
     }
 
     std::vector<std::string> ArgNames; // initialize a vectore that will hold the name of the arguments
+    std::vector<std::string> ArgTypes;
+    bool Typed = false;
     while (true) {
         getNextToken(); // consumes the '(' or ','
         if (CurTok == ')') { // if we immediately get a closing brace...
@@ -263,6 +397,13 @@ std::unique_ptr<PrototypeAST> ParsePrototype() {
 
         getNextToken(); // go to the next token
 
+        std::string Type; // 'z: complex' => a record parameter
+        if (CurTok == ':' && !ParseTypeAnnotation(Type)) {
+            return nullptr;
+        }
+        ArgTypes.push_back(Type);
+        Typed |= !Type.empty();
+
         if (CurTok == ',') { // if it's a comma, we expect another argument, so we proceed with the loop
             continue;
         } else if (CurTok == ')') { // if it's a closing bracket, we break out of the loop
@@ -275,11 +416,24 @@ std::unique_ptr<PrototypeAST> ParsePrototype() {
 
     getNextToken(); // consume the ')'
 
+    std::string ReturnType; // '): complex' => returns a record
+    if (CurTok == ':') {
+        if (!ParseTypeAnnotation(ReturnType)) {
+            return nullptr;
+        }
+        if (ReturnType.rfind("soa ", 0) == 0) { // the callee's collection would be freed when its 'spawn' ends
+            return LogErrorP("A definition can't return a 'soa' collection.");
+        }
+    }
+
     if (KindOfProto && ArgNames.size() != KindOfProto) { // if KindOfProto is non-zero (NORMAL PROTOTYPE), and the number of args doesn't match a unary or binary expression...
         return LogErrorP("Invalid number of operands for desired operator type...");
     }
 
-    return std::make_unique<PrototypeAST>(FunctionName, std::move(ArgNames), KindOfProto != 0 /* gives a boolean => NORMAL PROTOS ARE 0 */, BinaryPrecedence); // return a pointer to a PrototypeAST node with the name and arguments defined
+    if (!Typed) {
+        ArgTypes.clear(); // all numbers
+    }
+    return std::make_unique<PrototypeAST>(FunctionName, std::move(ArgNames), KindOfProto != 0 /* gives a boolean => NORMAL PROTOS ARE 0 */, BinaryPrecedence, std::move(ArgTypes), ReturnType); // return a pointer to a PrototypeAST node with the name and arguments defined
 }
 
 // parse function definitions
@@ -297,6 +451,50 @@ std::unique_ptr<FunctionAST> ParseDefinition() {
     return nullptr; 
 }
 
+// record complex(re, im) => record particle(pos: vec, vel: vec, mass)
+std::unique_ptr<RecordDeclaration> ParseRecord() {
+    getNextToken(); // eat the 'record' keyword
+    if (CurTok != tok_identifier) {
+        LogError("Expected a record name after 'record'.");
+        return nullptr;
+    }
+    auto Declaration = std::make_unique<RecordDeclaration>();
+    Declaration->Name = IdentifierStr;
+    getNextToken(); // consume the name
+
+    if (CurTok != '(') {
+        LogError("Expected '(' and a list of fields after the record name.");
+        return nullptr;
+    }
+    getNextToken(); // consume the '('
+    while (CurTok != ')') {
+        if (CurTok != tok_identifier) {
+            LogError("Expected a field name in the record.");
+            return nullptr;
+        }
+        RecordField Field;
+        Field.Name = IdentifierStr;
+        getNextToken(); // consume the field name
+        if (CurTok == ':' && !ParseTypeAnnotation(Field.Type)) {
+            return nullptr;
+        }
+        if (Field.Type.rfind("soa ", 0) == 0) { // a record is a value => it can't own memory
+            LogError("A record can't hold a 'soa' collection.");
+            return nullptr;
+        }
+        Declaration->Fields.push_back(Field);
+
+        if (CurTok == ',') {
+            getNextToken(); // consume the ','
+        } else if (CurTok != ')') {
+            LogError("Expected ',' or ')' in the field list.");
+            return nullptr;
+        }
+    }
+    getNextToken(); // consume the ')'
+    return Declaration;
+}
+
 // parse function declarations with no definitions
 std::unique_ptr<PrototypeAST> ParseDecl() {
     getNextToken(); // eat the 'decl' keyword
@@ -305,6 +503,7 @@ std::unique_ptr<PrototypeAST> ParseDecl() {
 
 // parse conditional expressions
 std::unique_ptr<ExprAST> ParseIfExpr() {
+    SourceLocation IfLoc = CurLoc; // remember where the conditional started
     getNextToken(); // consume the "if" token
 
     auto Condition  = ParseExpression();  // parse the expression conditional corresponding to the if statement
@@ -334,10 +533,11 @@ std::unique_ptr<ExprAST> ParseIfExpr() {
         return nullptr; // pass a nullptr back up
     }
 
-    return std::make_unique<IfExprAST>(std::move(Condition), std::move(Then), std::move(Else)); // transfer ownership of the parsed expression nodes into a new IfExprAST node
+    return std::make_unique<IfExprAST>(IfLoc, std::move(Condition), std::move(Then), std::move(Else)); // transfer ownership of the parsed expression nodes into a new IfExprAST node
 }   
 // parsing for loop expressions
 std::unique_ptr<ExprAST> ParseForExpr() {
+    SourceLocation ForLoc = CurLoc; // remember where the loop started
     getNextToken(); // consume the "for" token
 
     if (CurTok != tok_identifier) {
@@ -377,6 +577,35 @@ std::unique_ptr<ExprAST> ParseForExpr() {
         }
     }
 
+    // optional loop hints => unroll(n) vectorize(n) interleave(n), in any order (the names are only special here)
+    LoopHints Hints;
+    while (CurTok == tok_identifier) {
+        std::string Hint = IdentifierStr;
+        unsigned* Slot = Hint == "unroll" ? &Hints.Unroll : Hint == "vectorize" ? &Hints.VectorizeWidth : Hint == "interleave" ? &Hints.Interleave : nullptr;
+        if (!Slot) {
+            return LogError(("Unknown loop hint '" + Hint + "', expected unroll, vectorize or interleave.").c_str());
+        }
+        getNextToken(); // consume the hint name
+
+        if (CurTok != '(') {
+            return LogError("Expected '(' after a loop hint.");
+        }
+        getNextToken(); // consume the '('
+        if (CurTok != tok_number || NumVal < 1 || NumVal > 1024 || NumVal != (unsigned)NumVal) {
+            return LogError("Loop hints take a whole number between 1 and 1024.");
+        }
+        unsigned Value = (unsigned)NumVal;
+        if (Slot != &Hints.Unroll && (Value & (Value - 1))) { // the vectorizer ignores anything else
+            return LogError("vectorize() and interleave() take a power of two.");
+        }
+        *Slot = Value;
+        getNextToken(); // consume the number
+        if (CurTok != ')') {
+            return LogError("Expected ')' after a loop hint.");
+        }
+        getNextToken(); // consume the ')'
+    }
+
     if (CurTok != tok_in) {
         return LogError("Expected 'in' token to close for-loop initialization");
     }
@@ -387,13 +616,13 @@ std::unique_ptr<ExprAST> ParseForExpr() {
         return nullptr;
     }
 
-    return std::make_unique<ForExprAST>(IdName, std::move(Start), std::move(End), std::move(Step), std::move(Body)); // transfer ownership of parsed components and initialize a for-loop AST node
+    return std::make_unique<ForExprAST>(ForLoc, IdName, std::move(Start), std::move(End), std::move(Step), std::move(Body), Hints); // transfer ownership of parsed components and initialize a for-loop AST node
 }
 
 // parsing of unary expressions
 std::unique_ptr<ExprAST> ParseUnaryExpr() {
     if (!isascii(CurTok) || CurTok == '(' || CurTok == ',') { // if its not an operator, it must just be a primary expression so parse it as such
-        return ParsePrimary();
+        return ParsePostfix(ParsePrimary());
     }
 
     int Operator = CurTok; // ascii value of the current user defined unary operator
@@ -405,9 +634,9 @@ std::unique_ptr<ExprAST> ParseUnaryExpr() {
 }
 
 // parsing top level expressions
-std::unique_ptr<FunctionAST> ParseTopLevelExpr() {
+std::unique_ptr<FunctionAST> ParseTopLevelExpr(const std::string& Name) {
     if (auto Expression = ParseExpression()) { // if we are able to parse the expression (non nullptr return...)
-        auto Proto = std::make_unique<PrototypeAST>("__anon_expr", /* FUNCTION NAME IS EMPTY */ std::vector<std::string>() /* pass an empty arguments list */);
+        auto Proto = std::make_unique<PrototypeAST>(Name, /* "__anon_expr" unless the caller needs a unique name */ std::vector<std::string>() /* pass an empty arguments list */);
         return std::make_unique<FunctionAST>(std::move(Proto), std::move(Expression)); // transfer ownership of the expression and prototype (delcaration) into a FunctionAST node
     }
 
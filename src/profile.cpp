@@ -0,0 +1,114 @@
+#include "../include/kaleidoscope/profile.h"
+#include "../include/kaleidoscope/codegen.h"
+
+#include <array>
+#include <fstream>
+#include <sstream>
+
+#include "llvm/IR/MDBuilder.h"
+
+std::string ProfileGeneratePath;
+std::string ProfileUsePath;
+
+static std::map<std::string, std::array<uint64_t, 2>> Counters; // live counters of the instrumented run (std::map never moves its nodes, so the jit can hold their addresses)
+static std::map<std::string, std::array<uint64_t, 2>> LoadedCounts; // counts read back from a previous run
+static uint64_t HottestEntryCount = 0; // the most calls any one function got in the loaded profile
+
+// every counter is keyed by what it counts, the function it lives in and where in the source it is
+static std::string ProfileKey(const char* Kind, llvm::Function* F, SourceLocation Loc) {
+    return std::string(Kind) + " " + F->getName().str() + " " + std::to_string(Loc.Line) + " " + std::to_string(Loc.Col);
+}
+
+bool ReadProfile(const std::string& Path) {
+    std::ifstream File(Path);
+    if (!File) {
+        return false;
+    }
+
+    std::string Line;
+    while (std::getline(File, Line)) {
+        if (Line.empty() || Line[0] == '#') { // skip the header and blank lines
+            continue;
+        }
+
+        std::istringstream Fields(Line);
+        std::string Kind, Function;
+        int SourceLine, SourceCol;
+        std::array<uint64_t, 2> Counts;
+        if (!(Fields >> Kind >> Function >> SourceLine >> SourceCol >> Counts[0] >> Counts[1])) {
+            fprintf(stderr, "Error: malformed profile line '%s'\n", Line.c_str());
+            continue;
+        }
+
+        LoadedCounts[Kind + " " + Function + " " + std::to_string(SourceLine) + " " + std::to_string(SourceCol)] = Counts;
+        if (Kind == "entry") {
+            HottestEntryCount = std::max(HottestEntryCount, Counts[0]);
+        }
+    }
+
+    ProfileUsePath = Path;
+    return true;
+}
+
+bool WriteProfile(const std::string& Path) {
+    std::ofstream File(Path);
+    if (!File) {
+        return false;
+    }
+
+    File << "# kaleidoscope profile v1 => kind function line column count0 count1\n";
+    for (auto &Entry : Counters) {
+        File << Entry.first << " " << Entry.second[0] << " " << Entry.second[1] << "\n";
+    }
+    return true;
+}
+
+void ResetProfile() {
+    Counters.clear();
+    LoadedCounts.clear();
+    HottestEntryCount = 0;
+    ProfileUsePath.clear();
+}
+
+uint64_t* ProfileCountersFor(const char* Kind, llvm::Function* F, SourceLocation Loc) {
+    if (ProfileGeneratePath.empty()) { // not instrumenting
+        return nullptr;
+    }
+    return Counters[ProfileKey(Kind, F, Loc)].data(); // zero initialized the first time we see the site
+}
+
+const uint64_t* ProfileCountsFor(const char* Kind, llvm::Function* F, SourceLocation Loc) {
+    auto CI = LoadedCounts.find(ProfileKey(Kind, F, Loc));
+    if (CI == LoadedCounts.end()) { // no profile, or this site never made it into it
+        return nullptr;
+    }
+    return CI->second.data();
+}
+
+void EmitProfileIncrement(uint64_t* Counter) {
+    // the counters live in the compiler's own memory, which the jit compiled code shares, so we just bake in the address
+    llvm::Value* Address = llvm::ConstantExpr::getIntToPtr(Builder->getInt64(reinterpret_cast<uintptr_t>(Counter)), Builder->getPtrTy());
+    Builder->CreateAtomicRMW(llvm::AtomicRMWInst::Add, Address, Builder->getInt64(1), llvm::MaybeAlign(8), llvm::AtomicOrdering::Monotonic); // atomic so threaded runs count correctly
+}
+
+llvm::MDNode* CreateProfileWeights(uint64_t Taken, uint64_t NotTaken) {
+    while (Taken > UINT32_MAX || NotTaken > UINT32_MAX) { // branch weights are 32 bit, so scale both down keeping the ratio
+        Taken >>= 1;
+        NotTaken >>= 1;
+    }
+    return llvm::MDBuilder(*TheContext).createBranchWeights(Taken, NotTaken);
+}
+
+void ApplyFunctionProfile(llvm::Function* F) {
+    const uint64_t* Counts = ProfileCountsFor("entry", F, {0, 0}); // function entries are keyed by name only
+    if (!Counts) {
+        return;
+    }
+
+    F->setEntryCount(llvm::Function::ProfileCount(Counts[0], llvm::Function::PCT_Real)); // lets the inliner and block placement weigh call sites
+    if (Counts[0] == 0) {
+        F->addFnAttr(llvm::Attribute::Cold); // never called in the profiled run => optimize for size, keep it out of the way
+    } else if (Counts[0] * 100 >= HottestEntryCount) {
+        F->addFnAttr(llvm::Attribute::Hot); // called at least 1% as often as the hottest function
+    }
+}
@@ -0,0 +1,165 @@
+#include "../include/kaleidoscope/records.h"
+#include "../include/kaleidoscope/codegen.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+std::map<std::string, RecordType> Records;
+bool CheckBounds = true;
+
+static bool SameDeclaration(const RecordDeclaration& A, const RecordDeclaration& B) {
+    if (A.Fields.size() != B.Fields.size()) {
+        return false;
+    }
+    for (size_t i = 0; i != A.Fields.size(); ++i) {
+        if (A.Fields[i].Name != B.Fields[i].Name || A.Fields[i].Type != B.Fields[i].Type) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// depth first => the numbers of a nested record end up next to each other, so a field path owns a contiguous run of columns
+static void CollectLeaves(const RecordDeclaration& Declaration, std::vector<unsigned>& Path, std::vector<std::vector<unsigned>>& Leaves) {
+    for (unsigned i = 0; i != Declaration.Fields.size(); ++i) {
+        Path.push_back(i);
+        const std::string& Type = Declaration.Fields[i].Type;
+        if (Type.empty()) {
+            Leaves.push_back(Path);
+        } else {
+            CollectLeaves(Records[Type].Declaration, Path, Leaves);
+        }
+        Path.pop_back();
+    }
+}
+
+bool DefineRecord(const RecordDeclaration& Declaration) {
+    auto RI = Records.find(Declaration.Name);
+    if (RI != Records.end()) { // the same declaration again (an imported library, a reloaded script) is fine
+        if (SameDeclaration(RI->second.Declaration, Declaration)) {
+            return true;
+        }
+        LogError(("Record '" + Declaration.Name + "' is already defined with other fields.").c_str());
+        return false;
+    }
+    if (FunctionProtos.count(Declaration.Name) || isMathBuiltin(Declaration.Name)) { // complex(1, 2) has to mean one thing
+        LogError(("'" + Declaration.Name + "' is already a function, it can't name a record too.").c_str());
+        return false;
+    }
+    if (Declaration.Fields.empty()) {
+        LogError(("Record '" + Declaration.Name + "' needs at least one field.").c_str());
+        return false;
+    }
+
+    std::set<std::string> Names;
+    std::vector<llvm::Type*> Elements;
+    for (auto &Field : Declaration.Fields) {
+        if (!Names.insert(Field.Name).second) {
+            LogError(("Record '" + Declaration.Name + "' has two fields called '" + Field.Name + "'.").c_str());
+            return false;
+        }
+        if (!Field.Type.empty() && !Records.count(Field.Type)) { // also rules out a record containing itself
+            LogError(("Unknown record '" + Field.Type + "' for field '" + Field.Name + "' of '" + Declaration.Name + "'.").c_str());
+            return false;
+        }
+        Elements.push_back(ResolveType(Field.Type));
+    }
+
+    RecordType Record;
+    Record.Declaration = Declaration;
+    Record.Struct = llvm::StructType::create(*TheContext, Elements, "record." + Declaration.Name);
+    std::vector<unsigned> Path;
+    CollectLeaves(Declaration, Path, Record.Leaves);
+    std::vector<llvm::Type*> Columns = { llvm::Type::getInt64Ty(*TheContext) };
+    Columns.insert(Columns.end(), Record.Leaves.size(), llvm::PointerType::get(*TheContext, 0));
+    Record.Soa = llvm::StructType::create(*TheContext, Columns, "soa." + Declaration.Name);
+    Records[Declaration.Name] = std::move(Record);
+    return true;
+}
+
+llvm::Type* ResolveType(const std::string& Type) {
+    if (Type.empty()) {
+        return llvm::Type::getDoubleTy(*TheContext);
+    }
+    bool Collection = Type.rfind("soa ", 0) == 0;
+    auto RI = Records.find(Collection ? Type.substr(4) : Type);
+    if (RI == Records.end()) {
+        LogError(("Unknown record '" + (Collection ? Type.substr(4) : Type) + "'.").c_str());
+        return nullptr;
+    }
+    return Collection ? RI->second.Soa : RI->second.Struct;
+}
+
+const RecordType* RecordOf(llvm::Type* Type) {
+    if (!Type->isStructTy()) {
+        return nullptr;
+    }
+    for (auto &Entry : Records) {
+        if (Entry.second.Struct == Type || Entry.second.Soa == Type) {
+            return &Entry.second;
+        }
+    }
+    return nullptr;
+}
+
+bool IsCollection(llvm::Type* Type) {
+    const RecordType* Record = RecordOf(Type);
+    return Record && Record->Soa == Type;
+}
+
+std::string TypeName(llvm::Type* Type) {
+    const RecordType* Record = RecordOf(Type);
+    if (!Record) {
+        return "number";
+    }
+    return (Record->Soa == Type ? "soa " : "") + Record->Declaration.Name;
+}
+
+unsigned FirstLeaf(const RecordType& Record, const std::vector<unsigned>& Path) {
+    for (unsigned i = 0; i != Record.Leaves.size(); ++i) {
+        const std::vector<unsigned>& Leaf = Record.Leaves[i];
+        if (Leaf.size() >= Path.size() && std::equal(Path.begin(), Path.end(), Leaf.begin())) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+void ResetRecords() {
+    Records.clear();
+}
+
+extern "C" void* kaleidoscope_soa_alloc(int64_t Bytes) {
+    size_t Size = Bytes > 0 ? (size_t)Bytes : 64; // the codegen rounds every column up to 64 bytes
+#ifdef _WIN32
+    void* Block = _aligned_malloc(Size, 64);
+#else
+    void* Block = aligned_alloc(64, Size);
+#endif
+    if (!Block) { // jitted code has no way to handle this
+        fprintf(stderr, "Error: out of memory allocating a soa collection of %lld bytes\n", (long long)Bytes);
+        abort();
+    }
+    memset(Block, 0, Size); // fields start at 0, like an uninitialized 'spawn' variable
+    return Block;
+}
+
+extern "C" void kaleidoscope_soa_out_of_bounds(int64_t Index, int64_t Size) {
+    fprintf(stderr, "Error: index %lld is outside a soa collection of %lld records\n", (long long)Index, (long long)Size);
+    abort(); // the write would have gone past the block
+}
+
+extern "C" void kaleidoscope_soa_free(void* Block) {
+#ifdef _WIN32
+    _aligned_free(Block);
+#else
+    free(Block);
+#endif
+}
@@ -0,0 +1,329 @@
+#include "../include/kaleidoscope/remote.h"
+#include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/library.h"
+#include "../include/kaleidoscope/specialize.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include "llvm/ADT/bit.h"
+#include "llvm/ExecutionEngine/Orc/SimpleRemoteEPC.h"
+#include "llvm/ExecutionEngine/Orc/TaskDispatch.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+std::string ExecutorPath;
+unsigned NumExecutors = 0;
+std::string ExecutorOutput = "stderr";
+
+struct Executor {
+    int Process = -1;
+    std::unique_ptr<llvm::orc::KaleidoscopeJIT> JIT; // executor 0's lives in TheJIT instead (codegen and everything else uses that one)
+    llvm::orc::ExecutorAddr Run; // its RunExpressionSymbol
+    std::vector<llvm::orc::tpctypes::DylibHandle> Libraries; // the --load libraries opened there, in load order
+    std::atomic<bool> Alive{false}; // cleared by whichever thread saw it die
+    bool Retired = false; // couldn't be restarted => left alone from then on
+};
+
+static std::vector<std::unique_ptr<Executor>> Executors;
+static std::set<std::string> BuiltinNames; // what every executor exports (they all run the same binary)
+static std::vector<std::string> LibraryPaths; // --load, in load order => opened again in a restarted executor
+static std::vector<std::string> BoundNames; // what 'decl' bound from those libraries => bound again too
+static std::atomic<unsigned> RoundRobin{0};
+
+// runs the executor binary on its ends of two pipes and connects to it
+static llvm::Expected<std::unique_ptr<llvm::orc::ExecutorProcessControl>> Spawn(int& Process) {
+#ifdef _WIN32
+    return llvm::make_error<llvm::StringError>("--executors needs fork and pipes", llvm::inconvertibleErrorCode());
+#else
+    int ToExecutor[2], FromExecutor[2];
+    if (pipe(ToExecutor) != 0) {
+        return llvm::errorCodeToError(std::error_code(errno, std::generic_category()));
+    }
+    if (pipe(FromExecutor) != 0) {
+        close(ToExecutor[0]);
+        close(ToExecutor[1]);
+        return llvm::errorCodeToError(std::error_code(errno, std::generic_category()));
+    }
+    fcntl(ToExecutor[1], F_SETFD, FD_CLOEXEC); // our ends => executors started later mustn't hold this connection open
+    fcntl(FromExecutor[0], F_SETFD, FD_CLOEXEC);
+
+    Process = fork();
+    if (Process == 0) {
+        std::string In = std::to_string(ToExecutor[0]), Out = std::to_string(FromExecutor[1]);
+        execl(ExecutorPath.c_str(), ExecutorPath.c_str(), In.c_str(), Out.c_str(), ExecutorOutput.c_str(), (char*)nullptr);
+        fprintf(stderr, "Could not run '%s': %s\n", ExecutorPath.c_str(), strerror(errno));
+        _exit(127);
+    }
+    close(ToExecutor[0]);
+    close(FromExecutor[1]);
+    if (Process < 0) {
+        close(ToExecutor[1]);
+        close(FromExecutor[0]);
+        return llvm::make_error<llvm::StringError>("fork failed", llvm::inconvertibleErrorCode());
+    }
+
+    auto EPC = llvm::orc::SimpleRemoteEPC::Create<llvm::orc::FDSimpleRemoteEPCTransport>(
+        std::make_unique<llvm::orc::DynamicThreadPoolTaskDispatcher>(), llvm::orc::SimpleRemoteEPC::Setup(), FromExecutor[0], ToExecutor[1]);
+    if (!EPC) {
+        return EPC.takeError();
+    }
+    return std::unique_ptr<llvm::orc::ExecutorProcessControl>(std::move(*EPC));
+#endif
+}
+
+// waits for a disconnected executor => says so if a signal killed it (the script crashed it)
+static void Reap(Executor& E, unsigned Index) {
+#ifndef _WIN32
+    int Status = 0;
+    if (E.Process > 0 && waitpid(E.Process, &Status, 0) == E.Process && WIFSIGNALED(Status)) {
+        fprintf(stderr, "Executor %u was killed by signal %d (%s).\n", Index, WTERMSIG(Status), strsignal(WTERMSIG(Status)));
+    }
+#endif
+    E.Process = -1;
+}
+
+// starts executor Index and defines its builtins in a fresh jit session for it
+static bool Connect(Executor& E, unsigned Index) {
+    auto EPC = Spawn(E.Process);
+    if (!EPC) {
+        LogError(("Could not start executor " + std::to_string(Index) + ": " + llvm::toString(EPC.takeError())).c_str());
+        Reap(E, Index);
+        return false;
+    }
+    auto JIT = llvm::orc::KaleidoscopeJIT::Create(std::move(*EPC), true);
+    if (!JIT) {
+        LogError(("Could not start executor " + std::to_string(Index) + ": " + llvm::toString(JIT.takeError())).c_str());
+        Reap(E, Index);
+        return false;
+    }
+
+    auto &Control = (*JIT)->getExecutorProcessControl();
+    for (auto &Symbol : Control.getBootstrapSymbolsMap()) {
+        llvm::StringRef Name = Symbol.first();
+        if (Name.consume_front(NativeSymbolPrefix)) {
+            ExitOnErr((*JIT)->defineNative(Name, Symbol.second));
+            BuiltinNames.insert(Name.str());
+        }
+    }
+    if (auto Err = Control.getBootstrapSymbols({ { E.Run, RunExpressionSymbol } })) {
+        LogError(("'" + ExecutorPath + "' is not a kaleidoscope executor: " + llvm::toString(std::move(Err))).c_str());
+        (*JIT).reset();
+        Reap(E, Index);
+        return false;
+    }
+
+    if (Index == 0) {
+        TheJIT = std::move(*JIT);
+    } else {
+        E.JIT = std::move(*JIT);
+    }
+    E.Libraries.clear();
+    E.Alive = true;
+    return true;
+}
+
+bool StartExecutors() {
+    Executors.clear();
+    for (unsigned i = 0; i != NumExecutors; ++i) {
+        Executors.push_back(std::make_unique<Executor>());
+        if (!Connect(*Executors.back(), i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void StopExecutors() {
+    for (unsigned i = 0; i != Executors.size(); ++i) {
+        if (i == 0) {
+            TheJIT.reset(); // disconnecting => the executor sees the end of its pipe and exits
+        } else {
+            Executors[i]->JIT.reset();
+        }
+        Reap(*Executors[i], i);
+    }
+    Executors.clear();
+    BuiltinNames.clear();
+    LibraryPaths.clear();
+    BoundNames.clear();
+    RoundRobin = 0;
+}
+
+llvm::orc::KaleidoscopeJIT& ExecutorJIT(unsigned Executor) {
+    return Executor == 0 ? *TheJIT : *Executors[Executor]->JIT;
+}
+
+unsigned NextExecutor() {
+    for (size_t Tries = 0; Tries < Executors.size(); ++Tries) {
+        unsigned i = RoundRobin++ % Executors.size();
+        if (Executors[i]->Alive) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+bool ExecutorAlive(unsigned Executor) {
+    return !RemoteExecution() || Executors[Executor]->Alive;
+}
+
+void AddDefinitionModule(std::unique_ptr<llvm::Module> M) {
+    for (unsigned i = 1; i < Executors.size(); ++i) { // a session consumes the module it compiles => the others get copies
+        if (Executors[i]->Alive) {
+            ExitOnErr(Executors[i]->JIT->addModule(llvm::orc::ThreadSafeModule(llvm::CloneModule(*M), TheTSC)));
+        }
+    }
+    ExitOnErr(TheJIT->addModule(llvm::orc::ThreadSafeModule(std::move(M), TheTSC)));
+}
+
+bool RunExpression(unsigned Index, llvm::orc::ExecutorAddr Address, double& Result) {
+    if (!RemoteExecution()) {
+        Result = Address.toPtr<double (*)()>()(); // FUNCTIONALLY NO DIFFERENCE BETWEEN JIT COMPILED CODE AND NATIVE MACHINE CODE STATICALLY LINKED
+        return true;
+    }
+
+    Executor& E = *Executors[Index];
+    std::pair<uint64_t, std::string> Returned; // the result's bits and the expression's output
+    if (auto Err = ExecutorJIT(Index).getExecutorProcessControl().callSPSWrapper<RunExpressionSignature>(E.Run, Returned, Address)) {
+        E.Alive = false; // restarted once the statement is over (see RestartDeadExecutors)
+        LogError(("Executor " + std::to_string(Index) + " died running the expression: " + llvm::toString(std::move(Err))).c_str());
+        return false;
+    }
+    RuntimeWrite(Returned.second.data(), Returned.second.size()); // through our own buffer (or a parallel batch's capture), so it stays in order
+    Result = llvm::bit_cast<double>(Returned.first);
+    return true;
+}
+
+static bool OpenLibrary(unsigned Index, const std::string& Path) {
+    auto Handle = ExecutorJIT(Index).getExecutorProcessControl().loadDylib(Path.c_str());
+    if (!Handle) {
+        LogError(("Could not load '" + Path + "' in executor " + std::to_string(Index) + ": " + llvm::toString(Handle.takeError())).c_str());
+        return false;
+    }
+    Executors[Index]->Libraries.push_back(*Handle);
+    return true;
+}
+
+bool LoadRemoteLibrary(const std::string& Path) {
+    bool Loaded = true;
+    for (unsigned i = 0; i != Executors.size(); ++i) {
+        if (Executors[i]->Alive) {
+            Loaded = OpenLibrary(i, Path) && Loaded;
+        }
+    }
+    if (Loaded) {
+        LibraryPaths.push_back(Path);
+    }
+    return Loaded;
+}
+
+// lookupSymbols hands back plain addresses in older orc versions
+static llvm::orc::ExecutorAddr AddressOf(const llvm::orc::ExecutorAddr& Address) {
+    return Address;
+}
+
+static llvm::orc::ExecutorAddr AddressOf(const llvm::orc::ExecutorSymbolDef& Symbol) {
+    return Symbol.getAddress();
+}
+
+// the first library of executor Index that has Name => defined in that executor's session
+static bool BindIn(unsigned Index, const std::string& Name) {
+    auto &JIT = ExecutorJIT(Index);
+    for (auto &Handle : Executors[Index]->Libraries) {
+        llvm::orc::SymbolLookupSet Symbols(JIT.mangle(Name), llvm::orc::SymbolLookupFlags::WeaklyReferencedSymbol); // missing => a null address, not an error
+        auto Found = JIT.getExecutorProcessControl().lookupSymbols({ { Handle, Symbols } });
+        if (!Found) {
+            LogError(llvm::toString(Found.takeError()).c_str());
+            return false;
+        }
+        if (llvm::orc::ExecutorAddr Address = AddressOf(Found->front().front())) {
+            if (auto Err = JIT.defineNative(Name, Address)) {
+                LogError(llvm::toString(std::move(Err)).c_str());
+                return false;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BindRemoteSymbol(const std::string& Name) {
+    if (EmittingObject() || BuiltinNames.count(Name) || std::count(BoundNames.begin(), BoundNames.end(), Name)) {
+        return true;
+    }
+    bool Bound = false;
+    for (unsigned i = 0; i != Executors.size(); ++i) {
+        if (Executors[i]->Alive) {
+            Bound = BindIn(i, Name) || Bound;
+        }
+    }
+    if (Bound) {
+        BoundNames.push_back(Name);
+    }
+    return Bound;
+}
+
+// brings a restarted executor back to where the session is => libraries, bindings, imported bitcode as it is, then every other definition
+// compiled again from its AST
+static void Replay(unsigned Index) {
+    for (auto &Path : LibraryPaths) {
+        OpenLibrary(Index, Path);
+    }
+    for (auto &Name : BoundNames) {
+        BindIn(Index, Name);
+    }
+    for (auto &Library : ReloadImports()) { // already optimized code => nothing of an import is compiled again
+        ExitOnErr(ExecutorJIT(Index).addModule(llvm::orc::ThreadSafeModule(std::move(Library), TheTSC)));
+    }
+    if (FunctionDefs.empty()) {
+        return;
+    }
+
+    std::unique_ptr<llvm::Module> Current = std::move(TheModule); // the unit being compiled (nothing, between statements)
+    InitializeModule();
+    for (auto &Definition : FunctionDefs) { // one module => a definition whose callee comes later just gets a declaration first
+        if (!IsImportedDefinition(Definition.first)) {
+            Definition.second->codegen();
+        }
+    }
+    ExitOnErr(ExecutorJIT(Index).addModule(llvm::orc::ThreadSafeModule(std::move(TheModule), TheTSC)));
+    TheModule = std::move(Current);
+}
+
+void RestartDeadExecutors() {
+    for (unsigned i = 0; i != Executors.size(); ++i) {
+        Executor& E = *Executors[i];
+        if (E.Alive || E.Retired) {
+            continue;
+        }
+        if (i == 0) {
+            DropExpressionCache(); // their code died with the process
+            TheJIT.reset();
+        } else {
+            E.JIT.reset();
+        }
+        Reap(E, i);
+
+        if (!Connect(E, i)) {
+            if (i == 0) { // everything is compiled against executor 0's session
+                LogError("Executor 0 could not be restarted, giving up.");
+                exit(1);
+            }
+            LogError(("Executor " + std::to_string(i) + " could not be restarted, carrying on without it.").c_str());
+            E.Retired = true;
+            continue;
+        }
+        ClearSpecializations(); // the restarted executor doesn't have them => the replay (and later calls) make new ones for every executor
+        Replay(i);
+        fprintf(stderr, "Restarted executor %u.\n", i);
+    }
+}
@@ -0,0 +1,129 @@
+#include "../include/kaleidoscope/runtime_io.h"
+
+#include <cerrno>
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+#ifdef _WIN32 // if we're on windows
+#include <io.h>
+#include <fcntl.h>
+#define write _write
+#define open _open
+#define close _close
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static int OutputFD = 2; // where the buffers get written (stderr unless told otherwise, which matches the old fputc/fprintf behavior)
+static constexpr size_t BufferCapacity = 1 << 16; // 64 KiB per thread
+
+// write out a whole chunk, retrying on partial writes and interrupts
+static void WriteAll(const char* Data, size_t Size) {
+    while (Size > 0) {
+        auto Written = write(OutputFD, Data, Size);
+        if (Written < 0) {
+            if (errno == EINTR) {
+                continue; // interrupted by a signal, just try again
+            }
+            return; // nothing sensible to do if the output is gone
+        }
+        Data += Written;
+        Size -= Written;
+    }
+}
+
+// the per thread buffer => flushed when it fills up, and again when the thread (or the process) exits
+struct OutputBuffer {
+    std::unique_ptr<char[]> Data; // allocated on first use so threads that never print don't pay for it
+    size_t Size = 0;
+
+    ~OutputBuffer() { flush(); }
+
+    void flush() {
+        if (Size > 0) {
+            WriteAll(Data.get(), Size);
+            Size = 0;
+        }
+    }
+};
+
+static thread_local OutputBuffer Buffer;
+static thread_local std::string* CaptureTarget = nullptr; // set while the thread's output is being captured
+
+static void FlushAtExit() { RuntimeFlush(); } // the main thread's buffer is also flushed on exit()
+
+bool SetRuntimeOutput(const std::string& Target) {
+    RuntimeFlush(); // whatever is already buffered still belongs to the old stream
+
+    int NewFD;
+    if (Target == "stdout") {
+        NewFD = 1;
+    } else if (Target == "stderr") {
+        NewFD = 2;
+    } else {
+        NewFD = open(Target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644); // otherwise it is a file path
+        if (NewFD < 0) {
+            return false;
+        }
+    }
+
+    if (OutputFD > 2) {
+        close(OutputFD); // close a previously opened output file
+    }
+    OutputFD = NewFD;
+    return true;
+}
+
+void RuntimeWrite(const char* Data, size_t Size) {
+    if (CaptureTarget) { // captured output never touches the real stream
+        CaptureTarget->append(Data, Size);
+        return;
+    }
+
+    if (!Buffer.Data) { // first write on this thread => allocate the buffer
+        Buffer.Data = std::make_unique<char[]>(BufferCapacity);
+        static std::once_flag Registered;
+        std::call_once(Registered, [] { std::atexit(FlushAtExit); });
+    }
+
+    if (Buffer.Size + Size > BufferCapacity) { // not enough room => write out what we have first
+        Buffer.flush();
+        if (Size > BufferCapacity) { // huge writes skip the buffer entirely
+            WriteAll(Data, Size);
+            return;
+        }
+    }
+
+    std::copy(Data, Data + Size, Buffer.Data.get() + Buffer.Size);
+    Buffer.Size += Size;
+}
+
+void RuntimeFlush() {
+    Buffer.flush(); // (a capture has nothing to flush, and the thread's buffer is untouched while capturing)
+}
+
+void BeginOutputCapture(std::string* Capture) {
+    CaptureTarget = Capture;
+}
+
+void EndOutputCapture() {
+    CaptureTarget = nullptr;
+}
+
+std::string* CurrentOutputCapture() {
+    return CaptureTarget;
+}
+
+size_t FormatDouble(double X, char* Out) {
+    // std::to_chars never looks at the locale and rounds exactly like printf's "%f"
+    auto Result = std::to_chars(Out, Out + RuntimeDoubleChars, X, std::chars_format::fixed, 6);
+    if (Result.ec != std::errc()) { // can't happen with a big enough buffer, but fall back to printf just in case
+        return snprintf(Out, RuntimeDoubleChars, "%f", X);
+    }
+    return Result.ptr - Out;
+}
@@ -0,0 +1,393 @@
+#include "../include/kaleidoscope/sampler.h"
+#include "../include/kaleidoscope/parser.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#if (defined(__linux__) || defined(__APPLE__)) && (defined(__x86_64__) || defined(__aarch64__))
+#define KALEIDOSCOPE_SAMPLER_SUPPORTED
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/Object/SymbolSize.h"
+
+// one function the jit loaded => it lived at [Start, End) from LoadEpoch until FreeEpoch
+struct CodeRange {
+    uintptr_t Start, End;
+    std::string Name;
+    uint64_t LoadEpoch;
+    uint64_t FreeEpoch;
+};
+
+static std::mutex RangesMutex; // the jit can load objects on any thread (the signal handler never touches these)
+static std::vector<CodeRange> Ranges;
+static std::multimap<uint64_t, size_t> ObjectRanges; // the jit's key for a loaded object => its entries in Ranges
+static std::atomic<uint64_t> CodeEpoch{0}; // bumped on every load and free, stamped on every sample
+
+// the sample buffer => records of [number of frames, epoch, pc, return address, return address, ...], the frame count is written last
+static constexpr unsigned MaxFrames = 64;
+static constexpr size_t SampleWords = size_t(2) << 20; // 16 MiB of address space, only touched as samples come in
+static uint64_t* Samples = nullptr;
+static std::atomic<size_t> SamplesUsed{0};
+static std::atomic<uint64_t> SamplesDropped{0};
+static unsigned SampleInterval = 0; // microseconds of cpu time between samples
+static bool Running = false;
+
+// jitted symbols are named after the kaleidoscope function => version suffixes (__anon_expr.3, --watch's foo.7) are dropped,
+// so all top level expressions report as one and a reloaded function keeps its name
+static std::string DisplayName(std::string Name) {
+#ifdef __APPLE__
+    if (!Name.empty() && Name[0] == '_') { // mach-o global prefix
+        Name.erase(0, 1);
+    }
+#endif
+    return Name.substr(0, Name.find('.'));
+}
+
+class SymbolListener : public llvm::JITEventListener {
+public:
+    void notifyObjectLoaded(ObjectKey Key, const llvm::object::ObjectFile& Obj, const llvm::RuntimeDyld::LoadedObjectInfo& Info) override {
+        std::vector<CodeRange> Loaded;
+        for (auto &SymbolAndSize : llvm::object::computeSymbolSizes(Obj)) {
+            const llvm::object::SymbolRef& Symbol = SymbolAndSize.first;
+            auto Type = Symbol.getType();
+            if (!Type || *Type != llvm::object::SymbolRef::ST_Function || !SymbolAndSize.second) {
+                llvm::consumeError(Type.takeError());
+                continue;
+            }
+            auto Name = Symbol.getName();
+            auto Address = Symbol.getAddress();
+            auto Section = Symbol.getSection();
+            if (!Name || !Address || !Section || *Section == Obj.section_end()) {
+                llvm::consumeError(Name.takeError());
+                llvm::consumeError(Address.takeError());
+                llvm::consumeError(Section.takeError());
+                continue;
+            }
+
+            uint64_t SectionAddress = Info.getSectionLoadAddress(**Section); // where the jit put the section (0 => not loaded)
+            if (!SectionAddress) {
+                continue;
+            }
+            uintptr_t Start = SectionAddress + (*Address - (*Section)->getAddress());
+            Loaded.push_back({ Start, Start + SymbolAndSize.second, DisplayName(Name->str()), 0, UINT64_MAX });
+        }
+
+        std::lock_guard<std::mutex> Lock(RangesMutex);
+        uint64_t Epoch = ++CodeEpoch; // nothing in the object can run before this
+        for (auto &Range : Loaded) {
+            Range.LoadEpoch = Epoch;
+            ObjectRanges.insert({ Key, Ranges.size() });
+            Ranges.push_back(std::move(Range));
+        }
+    }
+
+    void notifyFreeingObject(ObjectKey Key) override {
+        std::lock_guard<std::mutex> Lock(RangesMutex);
+        uint64_t Epoch = ++CodeEpoch; // samples from now on can't be in the object anymore
+        auto Found = ObjectRanges.equal_range(Key);
+        for (auto It = Found.first; It != Found.second; ++It) {
+            Ranges[It->second].FreeEpoch = Epoch;
+        }
+        ObjectRanges.erase(Found.first, Found.second); // the key may come back for a different object
+    }
+};
+
+llvm::JITEventListener& SamplerSymbolListener() {
+    static SymbolListener Listener; // outlives every jit, which still reports frees while it's torn down
+    return Listener;
+}
+
+#ifdef KALEIDOSCOPE_SAMPLER_SUPPORTED
+
+static int ProbePipe[2] = { -1, -1 }; // never closed => a late signal on another thread can't write into a reused descriptor
+
+// a frame pointer chain through code without frame pointers leads anywhere => write() fails with EFAULT instead of crashing on bad memory
+static bool Readable(uintptr_t Address, size_t Size) {
+    ssize_t Written = write(ProbePipe[1], reinterpret_cast<const void*>(Address), Size);
+    if (Written <= 0) {
+        return false;
+    }
+    char Scratch[16];
+    (void)!read(ProbePipe[0], Scratch, sizeof(Scratch)); // both ends are non blocking, and whose bytes we drain doesn't matter
+    return (size_t)Written == Size;
+}
+
+static bool InterruptedRegisters(void* Context, uintptr_t& PC, uintptr_t& FP) {
+    auto* UC = static_cast<ucontext_t*>(Context);
+#if defined(__linux__) && defined(__x86_64__)
+    PC = UC->uc_mcontext.gregs[REG_RIP];
+    FP = UC->uc_mcontext.gregs[REG_RBP];
+#elif defined(__linux__) && defined(__aarch64__)
+    PC = UC->uc_mcontext.pc;
+    FP = UC->uc_mcontext.regs[29];
+#elif defined(__APPLE__) && defined(__x86_64__)
+    PC = UC->uc_mcontext->__ss.__rip;
+    FP = UC->uc_mcontext->__ss.__rbp;
+#else
+    PC = __darwin_arm_thread_state64_get_pc(UC->uc_mcontext->__ss);
+    FP = __darwin_arm_thread_state64_get_fp(UC->uc_mcontext->__ss);
+#endif
+    return PC != 0;
+}
+
+// runs in signal context => no locks, no allocation, only the preallocated buffer and async signal safe calls
+static void HandleSample(int, siginfo_t*, void* Context) {
+    int SavedErrno = errno;
+    uintptr_t PC, FP;
+    if (!InterruptedRegisters(Context, PC, FP)) {
+        errno = SavedErrno;
+        return;
+    }
+
+    uint64_t Frames[MaxFrames];
+    unsigned Depth = 0;
+    Frames[Depth++] = PC;
+
+    const uintptr_t PageMask = ~uintptr_t(4095);
+    uintptr_t CheckedPage = 0; // consecutive frames are usually on the same stack page => one probe for all of them
+    while (Depth != MaxFrames && FP && FP % sizeof(uintptr_t) == 0) {
+        bool SamePage = (FP & PageMask) == ((FP + sizeof(uintptr_t)) & PageMask);
+        if (!SamePage || (FP & PageMask) != CheckedPage) {
+            if (!Readable(FP, 2 * sizeof(uintptr_t))) {
+                break;
+            }
+            CheckedPage = SamePage ? FP & PageMask : 0;
+        }
+
+        const uintptr_t* Frame = reinterpret_cast<const uintptr_t*>(FP); // [caller's frame pointer, return address]
+        uintptr_t Next = Frame[0], Return = Frame[1];
+        if (!Return) {
+            break;
+        }
+        Frames[Depth++] = Return - 1; // inside the call instruction, so it symbolizes to the caller even when the call ends the function
+        if (Next <= FP) { // the stack grows down => callers live at higher addresses
+            break;
+        }
+        FP = Next;
+    }
+
+    size_t Slot = SamplesUsed.fetch_add(2 + Depth, std::memory_order_relaxed);
+    if (Slot + 2 + Depth > SampleWords) {
+        SamplesDropped.fetch_add(1, std::memory_order_relaxed);
+        errno = SavedErrno;
+        return;
+    }
+    Samples[Slot + 1] = CodeEpoch.load(std::memory_order_relaxed);
+    std::copy(Frames, Frames + Depth, Samples + Slot + 2);
+    __atomic_store_n(&Samples[Slot], (uint64_t)Depth, __ATOMIC_RELEASE); // the record is complete
+    errno = SavedErrno;
+}
+
+bool StartSampler(unsigned SamplesPerSecond) {
+    if (Running) {
+        return true;
+    }
+
+    std::free(Samples); // a fresh buffer => calloc gets zeroed pages straight from the os
+    Samples = static_cast<uint64_t*>(std::calloc(SampleWords, sizeof(uint64_t)));
+    if (!Samples) {
+        LogError("Could not allocate the sample buffer.");
+        return false;
+    }
+    SamplesUsed = 0;
+    SamplesDropped = 0;
+    {
+        std::lock_guard<std::mutex> Lock(RangesMutex); // whatever an earlier jit loaded is gone
+        Ranges.clear();
+        ObjectRanges.clear();
+    }
+
+    if (ProbePipe[0] < 0) {
+        if (pipe(ProbePipe) != 0) {
+            LogError("Could not create the profiler's pipe.");
+            return false;
+        }
+        fcntl(ProbePipe[0], F_SETFL, fcntl(ProbePipe[0], F_GETFL) | O_NONBLOCK);
+        fcntl(ProbePipe[1], F_SETFL, fcntl(ProbePipe[1], F_GETFL) | O_NONBLOCK);
+    }
+
+    struct sigaction Action = {};
+    Action.sa_sigaction = HandleSample;
+    Action.sa_flags = SA_SIGINFO | SA_RESTART; // interrupted reads and writes of the script just carry on
+    sigemptyset(&Action.sa_mask);
+    if (sigaction(SIGPROF, &Action, nullptr) != 0) {
+        LogError("Could not install the SIGPROF handler.");
+        return false;
+    }
+
+    SampleInterval = std::max(1u, 1000000 / std::max(1u, SamplesPerSecond));
+    struct itimerval Timer = {};
+    Timer.it_interval.tv_sec = SampleInterval / 1000000;
+    Timer.it_interval.tv_usec = SampleInterval % 1000000;
+    Timer.it_value = Timer.it_interval;
+    if (setitimer(ITIMER_PROF, &Timer, nullptr) != 0) { // counts cpu time of every thread in the process
+        LogError("Could not start the profiling timer.");
+        signal(SIGPROF, SIG_IGN);
+        return false;
+    }
+
+    Running = true;
+    return true;
+}
+
+void StopSampler() {
+    if (!Running) {
+        return;
+    }
+    struct itimerval Off = {};
+    setitimer(ITIMER_PROF, &Off, nullptr);
+    signal(SIGPROF, SIG_IGN); // a tick that is already pending goes nowhere
+    Running = false;
+}
+
+static std::string NativeName(uintptr_t Address) {
+    Dl_info Info;
+    if (dladdr(reinterpret_cast<void*>(Address), &Info) && Info.dli_sname) {
+        return llvm::demangle(Info.dli_sname);
+    }
+    return "[native]";
+}
+
+#else
+
+bool StartSampler(unsigned SamplesPerSecond) {
+    LogError("--profile is not supported on this platform.");
+    return false;
+}
+
+void StopSampler() {}
+
+static std::string NativeName(uintptr_t Address) {
+    return "[native]";
+}
+
+#endif
+
+bool SamplerRunning() {
+    return Running;
+}
+
+// every sample as function names, leaf first => the jitted frames (plus the builtins they called), or one "[outside jitted code]" entry for
+// everything else (compiling, parsing, ...) since frame pointers through the host can't be trusted
+static std::vector<std::vector<std::string>> SymbolizeSamples() {
+    std::vector<CodeRange> Sorted;
+    {
+        std::lock_guard<std::mutex> Lock(RangesMutex);
+        Sorted = Ranges;
+    }
+    std::sort(Sorted.begin(), Sorted.end(), [](const CodeRange& A, const CodeRange& B) { return A.Start < B.Start; });
+    uintptr_t Longest = 0;
+    for (auto &Range : Sorted) {
+        Longest = std::max(Longest, Range.End - Range.Start);
+    }
+
+    auto JITName = [&](uintptr_t Address, uint64_t Epoch) -> const std::string* { // the function that lived at Address when the sample was taken
+        auto It = std::upper_bound(Sorted.begin(), Sorted.end(), Address, [](uintptr_t A, const CodeRange& R) { return A < R.Start; });
+        while (It != Sorted.begin()) {
+            --It;
+            if (It->Start + Longest <= Address) {
+                break;
+            }
+            if (Address < It->End && It->LoadEpoch <= Epoch && Epoch < It->FreeEpoch) {
+                return &It->Name;
+            }
+        }
+        return nullptr;
+    };
+
+    std::vector<std::vector<std::string>> Stacks;
+    size_t Used = std::min<size_t>(SamplesUsed.load(), Samples ? SampleWords : 0);
+    for (size_t i = 0; i + 2 <= Used;) {
+        uint64_t Depth = __atomic_load_n(&Samples[i], __ATOMIC_ACQUIRE);
+        if (Depth == 0 || i + 2 + Depth > Used) { // still being written when the timer stopped
+            break;
+        }
+        uint64_t Epoch = Samples[i + 1];
+        const uint64_t* Frames = &Samples[i + 2];
+
+        std::vector<std::string> Stack;
+        bool SeenJIT = false;
+        for (uint64_t f = 0; f != Depth; ++f) {
+            if (const std::string* Name = JITName(Frames[f], Epoch)) {
+                Stack.push_back(*Name);
+                SeenJIT = true;
+            } else if (SeenJIT) { // back in the host that called into the jit
+                break;
+            } else {
+                Stack.push_back(NativeName(Frames[f])); // a builtin (sin, printd, ...) on top of jitted code
+            }
+        }
+        if (!SeenJIT) {
+            Stack = { "[outside jitted code]" };
+        }
+        Stacks.push_back(std::move(Stack));
+        i += 2 + Depth;
+    }
+    return Stacks;
+}
+
+void PrintFlatProfile(FILE* Out) {
+    auto Stacks = SymbolizeSamples();
+    if (Stacks.empty()) {
+        fprintf(Out, "Sampling profile: no samples (the run was shorter than one sampling interval).\n");
+        return;
+    }
+
+    std::map<std::string, size_t> Self, Total;
+    for (auto &Stack : Stacks) {
+        Self[Stack.front()]++;
+        std::set<std::string> Seen(Stack.begin(), Stack.end()); // recursion still counts once per sample
+        for (auto &Name : Seen) {
+            Total[Name]++;
+        }
+    }
+
+    std::vector<std::string> Names;
+    for (auto &Entry : Total) {
+        Names.push_back(Entry.first);
+    }
+    std::sort(Names.begin(), Names.end(), [&](const std::string& A, const std::string& B) {
+        return Self[A] != Self[B] ? Self[A] > Self[B] : Total[A] > Total[B];
+    });
+
+    double Percent = 100.0 / Stacks.size();
+    fprintf(Out, "Sampling profile: %zu samples, one every %u us of cpu time (%llu dropped)\n", Stacks.size(), SampleInterval, (unsigned long long)SamplesDropped.load());
+    fprintf(Out, "   self    total  function\n");
+    for (auto &Name : Names) {
+        fprintf(Out, "%6.1f%%  %6.1f%%  %s\n", Self[Name] * Percent, Total[Name] * Percent, Name.c_str());
+    }
+}
+
+bool WriteCollapsedStacks(const std::string& Path) {
+    std::ofstream File(Path);
+    if (!File) {
+        return false;
+    }
+
+    std::map<std::string, size_t> Counts;
+    for (auto &Stack : SymbolizeSamples()) {
+        std::string Line;
+        for (auto It = Stack.rbegin(); It != Stack.rend(); ++It) { // outermost caller first
+            Line += (Line.empty() ? "" : ";") + *It;
+        }
+        Counts[Line]++;
+    }
+    for (auto &Entry : Counts) {
+        File << Entry.first << " " << Entry.second << "\n";
+    }
+    return true;
+}
@@ -0,0 +1,342 @@
+#include "../include/kaleidoscope/server.h"
+#include "../include/kaleidoscope/engine.h"
+#include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/tasks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+static constexpr uint32_t RequestMagic = 0x4b4c4453; // "KLDS"
+
+enum RequestKind : uint32_t {
+    RunScript = 1, // Size bytes of script follow, stdout and stderr come along as SCM_RIGHTS
+    Stats = 2, // the latency percentiles as text
+};
+
+struct RequestHeader {
+    uint32_t Magic;
+    uint32_t Kind;
+    uint64_t Size;
+};
+
+static volatile std::sig_atomic_t StopServing = 0;
+
+static void OnStopSignal(int) {
+    StopServing = 1;
+}
+
+static bool WriteAll(int FD, const char* Data, size_t Size) {
+    while (Size > 0) {
+        ssize_t Written = write(FD, Data, Size);
+        if (Written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (Written <= 0) {
+            return false;
+        }
+        Data += Written;
+        Size -= Written;
+    }
+    return true;
+}
+
+static bool ReadAll(int FD, char* Data, size_t Size) {
+    while (Size > 0) {
+        ssize_t Read = read(FD, Data, Size);
+        if (Read < 0 && errno == EINTR) {
+            continue;
+        }
+        if (Read <= 0) {
+            return false;
+        }
+        Data += Read;
+        Size -= Read;
+    }
+    return true;
+}
+
+// the header, plus the client's stdout and stderr when PassOutput
+static bool SendRequest(int Socket, const RequestHeader& Header, bool PassOutput) {
+    iovec Data = { const_cast<RequestHeader*>(&Header), sizeof(Header) };
+    msghdr Message{};
+    Message.msg_iov = &Data;
+    Message.msg_iovlen = 1;
+
+    alignas(cmsghdr) char Control[CMSG_SPACE(2 * sizeof(int))];
+    if (PassOutput) {
+        Message.msg_control = Control;
+        Message.msg_controllen = sizeof(Control);
+        cmsghdr* Rights = CMSG_FIRSTHDR(&Message);
+        Rights->cmsg_level = SOL_SOCKET;
+        Rights->cmsg_type = SCM_RIGHTS;
+        Rights->cmsg_len = CMSG_LEN(2 * sizeof(int));
+        int Output[2] = { STDOUT_FILENO, STDERR_FILENO };
+        memcpy(CMSG_DATA(Rights), Output, sizeof(Output));
+    }
+    return sendmsg(Socket, &Message, 0) == (ssize_t)sizeof(Header);
+}
+
+static bool ReceiveRequest(int Socket, RequestHeader& Header, int Output[2]) {
+    iovec Data = { &Header, sizeof(Header) };
+    msghdr Message{};
+    Message.msg_iov = &Data;
+    Message.msg_iovlen = 1;
+    alignas(cmsghdr) char Control[CMSG_SPACE(2 * sizeof(int))];
+    Message.msg_control = Control;
+    Message.msg_controllen = sizeof(Control);
+
+    Output[0] = Output[1] = -1;
+    if (recvmsg(Socket, &Message, 0) != (ssize_t)sizeof(Header) || Header.Magic != RequestMagic) {
+        return false;
+    }
+    for (cmsghdr* C = CMSG_FIRSTHDR(&Message); C; C = CMSG_NXTHDR(&Message, C)) {
+        if (C->cmsg_level == SOL_SOCKET && C->cmsg_type == SCM_RIGHTS && C->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+            memcpy(Output, CMSG_DATA(C), 2 * sizeof(int));
+        }
+    }
+    return true;
+}
+
+// nearest rank percentiles of the request latencies so far
+static std::string FormatLatencies(std::vector<double> Samples) {
+    if (Samples.empty()) {
+        return "no requests served yet\n";
+    }
+    std::sort(Samples.begin(), Samples.end());
+    auto Percentile = [&](double P) {
+        size_t Rank = (size_t)std::ceil(P / 100 * Samples.size());
+        return Samples[std::min(Samples.size(), std::max<size_t>(Rank, 1)) - 1];
+    };
+    char Line[256];
+    snprintf(Line, sizeof(Line), "%zu requests  p50 %.3f ms  p90 %.3f ms  p99 %.3f ms  max %.3f ms\n", Samples.size(), Percentile(50), Percentile(90), Percentile(99), Samples.back());
+    return Line;
+}
+
+// in the forked child => read the script, point stdout/stderr at the client's, run it, report back
+[[noreturn]] static void RunRequest(kaleidoscope::Engine& Engine, int Connection, const RequestHeader& Header, int Output[2], int LatencyPipe, std::chrono::steady_clock::time_point Accepted) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    std::string Script(Header.Size, '\0');
+    if (Output[0] < 0 || Output[1] < 0 || !ReadAll(Connection, Script.data(), Script.size())) {
+        _exit(1);
+    }
+    dup2(Output[0], STDOUT_FILENO); // the runtime output and the compiler's messages go straight to the client
+    dup2(Output[1], STDERR_FILENO);
+    close(Output[0]);
+    close(Output[1]);
+
+    bool Ok = Engine.loadSource(Script);
+    RuntimeFlush();
+    fflush(stdout);
+    fflush(stderr);
+
+    char Status = Ok ? 0 : 1;
+    WriteAll(Connection, &Status, 1);
+    double Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Accepted).count();
+    WriteAll(LatencyPipe, reinterpret_cast<const char*>(&Milliseconds), sizeof(Milliseconds)); // small enough to be atomic
+    _exit(Ok ? 0 : 1); // no destructors => the daemon's engine state isn't torn down (or reported) once per request
+}
+
+int ServeScripts(kaleidoscope::Engine& Engine, const std::string& SocketPath) {
+    // warm up => the prelude's definitions become machine code now, so every child inherits them compiled
+    for (auto &Definition : FunctionDefs) {
+        if (auto Symbol = TheJIT->lookup(Definition.first); !Symbol) {
+            LogError(llvm::toString(Symbol.takeError()).c_str());
+        }
+    }
+    StopTaskRuntime(); // a forked child only gets the forking thread => each one starts its own workers if it needs them
+    RuntimeFlush(); // and nothing buffered may be written twice
+    fflush(stdout);
+    fflush(stderr);
+
+    sockaddr_un Address{};
+    Address.sun_family = AF_UNIX;
+    if (SocketPath.size() >= sizeof(Address.sun_path)) {
+        LogError(("Socket path '" + SocketPath + "' is too long.").c_str());
+        return 1;
+    }
+    strcpy(Address.sun_path, SocketPath.c_str());
+
+    int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(SocketPath.c_str()); // a stale socket left behind by an earlier daemon
+    if (Listener < 0 || bind(Listener, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0 || listen(Listener, 128) != 0) {
+        LogError(("Could not listen on '" + SocketPath + "': " + strerror(errno)).c_str());
+        return 1;
+    }
+
+    int Latencies[2]; // children write their request latency here
+    if (pipe(Latencies) != 0) {
+        LogError("Could not create the latency pipe.");
+        return 1;
+    }
+    fcntl(Latencies[0], F_SETFL, O_NONBLOCK);
+
+    struct sigaction Stop{};
+    Stop.sa_handler = OnStopSignal; // no SA_RESTART => poll returns and the loop sees the flag
+    sigaction(SIGINT, &Stop, nullptr);
+    sigaction(SIGTERM, &Stop, nullptr);
+    signal(SIGPIPE, SIG_IGN); // a client that went away mustn't take the daemon with it
+
+    std::vector<double> Samples;
+    auto DrainLatencies = [&] {
+        double Milliseconds;
+        while (read(Latencies[0], &Milliseconds, sizeof(Milliseconds)) == sizeof(Milliseconds)) {
+            Samples.push_back(Milliseconds);
+        }
+    };
+
+    fprintf(stderr, "Serving on '%s' (Ctrl-C stops).\n", SocketPath.c_str());
+    while (!StopServing) {
+        pollfd Watched[2] = { { Listener, POLLIN, 0 }, { Latencies[0], POLLIN, 0 } };
+        if (poll(Watched, 2, 500) < 0 && errno != EINTR) {
+            break;
+        }
+        DrainLatencies();
+        while (waitpid(-1, nullptr, WNOHANG) > 0) {} // reap finished requests
+        if (!(Watched[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int Connection = accept(Listener, nullptr, nullptr);
+        if (Connection < 0) {
+            continue;
+        }
+        auto Accepted = std::chrono::steady_clock::now();
+        timeval Timeout = { 5, 0 }; // a client that connects but never sends must not block everyone else
+        setsockopt(Connection, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+
+        RequestHeader Header;
+        int Output[2];
+        if (ReceiveRequest(Connection, Header, Output)) {
+            if (Header.Kind == Stats) {
+                std::string Text = FormatLatencies(Samples);
+                WriteAll(Connection, Text.data(), Text.size());
+            } else if (Header.Kind == RunScript) {
+                pid_t Child = fork();
+                if (Child == 0) {
+                    close(Listener);
+                    close(Latencies[0]);
+                    RunRequest(Engine, Connection, Header, Output, Latencies[1], Accepted);
+                }
+                if (Child < 0) {
+                    LogError("fork failed, dropping a request.");
+                }
+            }
+        }
+        for (int FD : Output) {
+            if (FD >= 0) {
+                close(FD);
+            }
+        }
+        close(Connection); // the child has its own copy
+    }
+
+    while (wait(nullptr) > 0) {} // let the running requests finish
+    DrainLatencies();
+    fprintf(stderr, "%s", FormatLatencies(Samples).c_str());
+    close(Listener);
+    close(Latencies[0]);
+    close(Latencies[1]);
+    unlink(SocketPath.c_str());
+    return 0;
+}
+
+static int Connect(const std::string& SocketPath) {
+    sockaddr_un Address{};
+    Address.sun_family = AF_UNIX;
+    if (SocketPath.size() >= sizeof(Address.sun_path)) {
+        fprintf(stderr, "Socket path '%s' is too long.\n", SocketPath.c_str());
+        return -1;
+    }
+    strcpy(Address.sun_path, SocketPath.c_str());
+    int Socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Socket < 0 || connect(Socket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0) {
+        fprintf(stderr, "Could not connect to '%s': %s\n", SocketPath.c_str(), strerror(errno));
+        if (Socket >= 0) {
+            close(Socket);
+        }
+        return -1;
+    }
+    return Socket;
+}
+
+int SubmitScript(const std::string& SocketPath, const std::string& ScriptPath) {
+    std::ifstream File(ScriptPath);
+    if (!File) {
+        fprintf(stderr, "File not found.\n");
+        return 1;
+    }
+    std::stringstream Contents;
+    Contents << File.rdbuf();
+    std::string Script = Contents.str();
+
+    int Socket = Connect(SocketPath);
+    if (Socket < 0) {
+        return 1;
+    }
+    char Status = 1;
+    RequestHeader Header = { RequestMagic, RunScript, Script.size() };
+    if (!SendRequest(Socket, Header, true) || !WriteAll(Socket, Script.data(), Script.size()) || read(Socket, &Status, 1) != 1) {
+        fprintf(stderr, "The server dropped the request.\n");
+        Status = 1;
+    }
+    close(Socket);
+    return Status;
+}
+
+int RequestServerStats(const std::string& SocketPath) {
+    int Socket = Connect(SocketPath);
+    if (Socket < 0) {
+        return 1;
+    }
+    RequestHeader Header = { RequestMagic, Stats, 0 };
+    if (!SendRequest(Socket, Header, false)) {
+        close(Socket);
+        return 1;
+    }
+    char Buffer[256];
+    ssize_t Read;
+    while ((Read = read(Socket, Buffer, sizeof(Buffer))) > 0) {
+        fwrite(Buffer, 1, Read, stdout);
+    }
+    close(Socket);
+    return 0;
+}
+
+#else // no unix domain sockets (or fork) => the daemon isn't available
+
+int ServeScripts(kaleidoscope::Engine& Engine, const std::string& SocketPath) {
+    LogError("--serve needs unix domain sockets and fork.");
+    return 1;
+}
+
+int SubmitScript(const std::string& SocketPath, const std::string& ScriptPath) {
+    fprintf(stderr, "--client needs unix domain sockets.\n");
+    return 1;
+}
+
+int RequestServerStats(const std::string& SocketPath) {
+    fprintf(stderr, "--client needs unix domain sockets.\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include "../include/kaleidoscope/specialize.h"
+#include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/remote.h"
+
+#include <cstdio>
+#include <set>
+
+bool SpecializeCalls = true;
+std::map<llvm::AllocaInst*, double> ConstantSlots;
+
+static std::map<std::string, std::string> Specializations; // key => the symbol of the copy
+static std::map<std::string, unsigned> NumSpecializations; // per version of a definition => capped, so a call in a loop of an interpreted
+                                                           // driver (or a sweep over many constants) can't flood the jit with copies
+static constexpr unsigned MaxSpecializations = 8;
+static unsigned NextSpecialization = 0; // symbols stay unique across redefinitions and restarts (old copies live on in the jit)
+
+static unsigned Nesting = 0; // copies being compiled right now (a copy's body specializes its own calls)
+static std::string Outermost; // the function whose codegen started it all
+
+// the declaration of a copy in the module being compiled => the arguments it still takes, and what the definition returns
+static llvm::Function* SpecializationDeclaration(const std::string& Name, const std::vector<llvm::Value*>& Args, llvm::Type* ReturnType) {
+    if (llvm::Function* F = TheModule->getFunction(Name)) {
+        return F;
+    }
+    std::vector<llvm::Type*> Params; // numbers, or records (see records.h)
+    for (auto* Arg : Args) {
+        Params.push_back(Arg->getType());
+    }
+    llvm::FunctionType* FT = llvm::FunctionType::get(ReturnType, Params, false);
+    return llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Name, TheModule.get());
+}
+
+bool ShouldSpecialize(const std::string& Callee) {
+    if (!SpecializeCalls || !ProfileGeneratePath.empty()) { // instrumented runs count the generic functions (that's what the profile describes)
+        return false;
+    }
+    auto DI = FunctionDefs.find(Callee);
+    if (DI == FunctionDefs.end() || DI->second->getProto().isUnaryOp() || DI->second->getProto().isBinaryOp()) { // operators are expanded in place already
+        return false;
+    }
+
+    std::set<std::string> Reaches = ReachableFunctions(*DI->second->getBody());
+    Reaches.insert(Callee);
+    for (auto &Name : Reaches) { // without a loop there is little to gain over the generic version that llvm can't already inline
+        auto RI = FunctionDefs.find(Name);
+        if (RI == FunctionDefs.end()) {
+            continue;
+        }
+        std::string Canonical;
+        RI->second->getBody()->canonicalize(Canonical);
+        if (Canonical.find("(for ") != std::string::npos) { // 'for' is a keyword, so no name can produce this
+            return true;
+        }
+    }
+    return false;
+}
+
+// the body of Definition with the constant arguments stored into their parameters => the other parameters stay parameters of the copy
+static llvm::Function* EmitSpecialization(const FunctionAST& Definition, const std::string& Name, const std::vector<llvm::Value*>& Args, const std::vector<llvm::Value*>& Remaining, llvm::Type* ReturnType) {
+    const PrototypeAST& P = Definition.getProto();
+    llvm::Function* F = SpecializationDeclaration(Name, Remaining, ReturnType);
+    llvm::BasicBlock* Entry = llvm::BasicBlock::Create(*TheContext, "entry", F);
+    Builder->SetInsertPoint(Entry);
+
+    std::set<std::string> Assigned; // a parameter the body assigns is just a variable with a constant start
+    Definition.getBody()->collectAssigned(Assigned);
+
+    auto Param = F->arg_begin();
+    for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+        const std::string& ParamName = P.getArgs()[i];
+        llvm::AllocaInst* Allocation = CreateEntryBlockAllocation(F, ParamName, Args[i]->getType());
+        if (auto* Constant = llvm::dyn_cast<llvm::ConstantFP>(Args[i])) {
+            Builder->CreateStore(Constant, Allocation);
+            if (!Assigned.count(ParamName)) {
+                ConstantSlots[Allocation] = Constant->getValueAPF().convertToDouble(); // reads of it fold (see VariableExprAST::codegen)
+            }
+        } else {
+            Param->setName(ParamName);
+            Builder->CreateStore(&*Param++, Allocation);
+        }
+        NamedValues[ParamName] = Allocation;
+    }
+
+    if (SamplerRunning()) {
+        F->addFnAttr("frame-pointer", "all");
+    }
+    int StatsId = InstrumentCalls ? CallStatsId(P.getName()) : -1; // time spent in a copy is time spent in the function
+    llvm::FunctionType* HookType = llvm::FunctionType::get(Builder->getVoidTy(), { Builder->getInt32Ty() }, false);
+    if (StatsId >= 0) {
+        Builder->CreateCall(TheModule->getOrInsertFunction("kaleidoscope_enter", HookType), { Builder->getInt32(StatsId) });
+    }
+
+    llvm::Value* ReturnVal = Definition.getBody()->codegen();
+    if (!ReturnVal || ReturnVal->getType() != ReturnType) { // the generic version compiled, so this only happens after an error
+        F->eraseFromParent();
+        return nullptr;
+    }
+    if (StatsId >= 0) {
+        Builder->CreateCall(TheModule->getOrInsertFunction("kaleidoscope_exit", HookType), { Builder->getInt32(StatsId) });
+    }
+    Builder->CreateRet(ReturnVal);
+    llvm::verifyFunction(*F);
+    TheFPM->run(*F, *TheFAM);
+    return F;
+}
+
+llvm::Function* SpecializeCall(const std::string& Callee, std::vector<llvm::Value*>& Args) {
+    bool AnyConstant = false;
+    for (auto* Arg : Args) {
+        AnyConstant |= llvm::isa<llvm::ConstantFP>(Arg);
+    }
+    if (!AnyConstant || !ShouldSpecialize(Callee)) {
+        return nullptr;
+    }
+    if (Nesting == 0) {
+        Outermost = Builder->GetInsertBlock()->getParent()->getName().str();
+    }
+
+    const FunctionAST& Definition = *FunctionDefs[Callee];
+    std::set<std::string> Reaches = ReachableFunctions(*Definition.getBody());
+    // the outermost function is being (re)defined right now => FunctionDefs still holds its previous body (or none), so a copy of it, or of
+    // anything that reaches it (mutual recursion), would be compiled against code that is about to be replaced
+    if (Callee == Outermost || Reaches.count(Outermost)) {
+        return nullptr;
+    }
+
+    llvm::Type* ReturnType = ResolveType(Definition.getProto().getReturnType());
+    if (!ReturnType) {
+        return nullptr;
+    }
+    std::string Version = Callee + "@" + std::to_string(FunctionVersions[Callee]);
+    std::string Key = Version;
+    for (auto &Name : Reaches) { // a copy inlines or calls what it reaches as it was when it was made
+        Key += " " + Name + "@" + std::to_string(FunctionVersions[Name]);
+    }
+    Key += " |";
+    std::vector<llvm::Value*> Remaining; // what the call still passes
+    for (auto* Arg : Args) {
+        if (auto* Constant = llvm::dyn_cast<llvm::ConstantFP>(Arg)) {
+            char Text[32];
+            snprintf(Text, sizeof(Text), " %a", Constant->getValueAPF().convertToDouble()); // exact, like canonicalize()
+            Key += Text;
+        } else {
+            Key += " _";
+            Remaining.push_back(Arg);
+        }
+    }
+
+    auto SI = Specializations.find(Key);
+    if (SI != Specializations.end()) {
+        Args = std::move(Remaining);
+        return SpecializationDeclaration(SI->second, Args, ReturnType);
+    }
+    if (NumSpecializations[Version] >= MaxSpecializations) {
+        return nullptr;
+    }
+    NumSpecializations[Version]++;
+
+    std::string Name = Callee + ".spec." + std::to_string(NextSpecialization++);
+    Specializations[Key] = Name; // before the body => a recursive call with the same constants calls the copy itself
+
+    // the caller's state => the copy is compiled from scratch in the middle of the caller's body
+    llvm::IRBuilderBase::InsertPoint CallerPoint = Builder->saveIP();
+    std::map<std::string, llvm::AllocaInst*> CallerValues = std::move(NamedValues);
+    std::map<llvm::AllocaInst*, double> CallerSlots = std::move(ConstantSlots);
+    NamedValues.clear();
+    ConstantSlots.clear();
+
+    // in the jit the copy gets a module of its own => the caller may be a top level expression whose code is freed after it ran
+    std::unique_ptr<llvm::Module> CallerModule;
+    if (!EmittingObject()) {
+        CallerModule = std::move(TheModule);
+        TheModule = std::make_unique<llvm::Module>(Name, *TheContext);
+        TheModule->setDataLayout(CallerModule->getDataLayout());
+        TheModule->setTargetTriple(CallerModule->getTargetTriple());
+    }
+
+    ++Nesting;
+    llvm::Function* F = EmitSpecialization(Definition, Name, Args, Remaining, ReturnType);
+    --Nesting;
+
+    if (CallerModule) {
+        if (F) {
+            AddDefinitionModule(std::move(TheModule)); // every executor gets it, like a definition
+            TheLAM->clear(); // the analyses of the copy point into a module the jit owns now (see InitializeModule)
+            TheFAM->clear();
+            TheMAM->clear();
+        }
+        TheModule = std::move(CallerModule);
+    }
+    NamedValues = std::move(CallerValues);
+    ConstantSlots = std::move(CallerSlots);
+    Builder->restoreIP(CallerPoint);
+
+    if (!F) {
+        Specializations.erase(Key);
+        return nullptr;
+    }
+    Args = std::move(Remaining);
+    return SpecializationDeclaration(Name, Args, ReturnType);
+}
+
+void ClearSpecializations() {
+    Specializations.clear();
+    NumSpecializations.clear();
+    ConstantSlots.clear();
+}
@@ -0,0 +1,220 @@
+#include "../include/kaleidoscope/tasks.h"
+#include "../include/kaleidoscope/batch.h"
+#include "../include/kaleidoscope/runtime_io.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+unsigned TaskWorkers = 0;
+
+// one queued (or running, or finished but not yet awaited) async call
+struct Task {
+    void* Function;
+    double Args[MaxTaskArgs];
+    unsigned NumArgs;
+    double Result = 0.0;
+    std::string Output; // what the call printed => handed to whoever awaits it
+    std::atomic<bool> Done{false};
+};
+
+struct Worker {
+    std::mutex Mutex; // the owner and the thieves both touch the deque
+    std::deque<Task*> Tasks; // owner => back, thieves => front
+};
+
+static std::vector<std::unique_ptr<Worker>> Workers;
+static std::vector<std::thread> Threads;
+static std::mutex StartMutex; // guards starting and stopping the workers
+static std::atomic<bool> Started{false};
+static std::atomic<bool> Stopping{false};
+static std::atomic<size_t> Queued{0}; // tasks sitting in some deque (idle workers sleep while this is 0)
+static std::atomic<size_t> NextVictim{0}; // spreads tasks from outside threads (and steal attempts) over the workers
+static std::mutex SleepMutex;
+static std::condition_variable WakeUp;
+
+// handle => task, for every task that hasn't been awaited yet => a handle that isn't in here (never issued, or awaited already) is refused
+static std::mutex HandlesMutex;
+static std::unordered_map<uint64_t, Task*> LiveHandles;
+static uint64_t NextHandle = uint64_t(1) << 40; // far from the small numbers a script uses for anything else (and exact in a double up to 2^53)
+
+static thread_local int WorkerIndex = -1; // the deque this thread owns (-1 => not a worker, like the main thread)
+
+static Task* PopOwn() {
+    if (WorkerIndex < 0) {
+        return nullptr;
+    }
+    Worker& W = *Workers[WorkerIndex];
+    std::lock_guard<std::mutex> Lock(W.Mutex);
+    if (W.Tasks.empty()) {
+        return nullptr;
+    }
+    Task* T = W.Tasks.back(); // newest first => stays close to what this thread was just doing
+    W.Tasks.pop_back();
+    Queued--;
+    return T;
+}
+
+static Task* Steal() {
+    size_t Start = NextVictim++;
+    for (size_t i = 0; i != Workers.size(); ++i) {
+        size_t Victim = (Start + i) % Workers.size();
+        if ((int)Victim == WorkerIndex) {
+            continue;
+        }
+        Worker& W = *Workers[Victim];
+        std::lock_guard<std::mutex> Lock(W.Mutex);
+        if (!W.Tasks.empty()) {
+            Task* T = W.Tasks.front(); // oldest first => usually the biggest chunk of work left
+            W.Tasks.pop_front();
+            Queued--;
+            return T;
+        }
+    }
+    return nullptr;
+}
+
+static Task* FindTask() {
+    if (Task* T = PopOwn()) {
+        return T;
+    }
+    return Steal();
+}
+
+// the output of the call is kept with the task => it shows up where the task is awaited, in the awaiting thread's buffer (or capture)
+static void Run(Task* T) {
+    std::string* Outer = CurrentOutputCapture(); // an awaiting thread runs other tasks in the middle of its own output
+    BeginOutputCapture(&T->Output);
+    CallNative(T->Function, T->Args, T->NumArgs, T->Result);
+    if (Outer) {
+        BeginOutputCapture(Outer);
+    } else {
+        EndOutputCapture();
+    }
+    T->Done.store(true, std::memory_order_release);
+}
+
+static void WorkerLoop(int Index) {
+    WorkerIndex = Index;
+    while (!Stopping) {
+        if (Task* T = FindTask()) {
+            Run(T);
+            continue;
+        }
+        std::unique_lock<std::mutex> Lock(SleepMutex);
+        WakeUp.wait(Lock, [] { return Queued > 0 || Stopping; });
+    }
+}
+
+static void StartTaskRuntime() {
+    std::lock_guard<std::mutex> Lock(StartMutex);
+    if (Started) {
+        return;
+    }
+
+    unsigned N = TaskWorkers ? TaskWorkers : std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i != N; ++i) { // every deque exists before any thread can try to steal from it
+        Workers.push_back(std::make_unique<Worker>());
+    }
+    for (unsigned i = 0; i != N; ++i) {
+        Threads.emplace_back(WorkerLoop, (int)i);
+    }
+    Started = true;
+}
+
+void StopTaskRuntime() {
+    std::lock_guard<std::mutex> Lock(StartMutex);
+    if (!Started) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> SleepLock(SleepMutex);
+        Stopping = true;
+    }
+    WakeUp.notify_all();
+    for (auto &Thread : Threads) {
+        Thread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> HandlesLock(HandlesMutex);
+        for (auto &Live : LiveHandles) { // nobody can await these anymore (queued, or finished and never awaited)
+            delete Live.second;
+        }
+        LiveHandles.clear();
+    }
+    Threads.clear();
+    Workers.clear();
+    Queued = 0;
+    Stopping = false;
+    Started = false;
+}
+
+extern "C" double kaleidoscope_async(void* Function, const double* Args, int32_t NumArgs) {
+    if (!Started) {
+        StartTaskRuntime();
+    }
+
+    Task* T = new Task();
+    T->Function = Function;
+    T->NumArgs = NumArgs;
+    std::copy(Args, Args + NumArgs, T->Args);
+    uint64_t Handle;
+    {
+        std::lock_guard<std::mutex> HandlesLock(HandlesMutex);
+        Handle = NextHandle++;
+        LiveHandles[Handle] = T;
+    }
+
+    Worker& W = *Workers[WorkerIndex >= 0 ? WorkerIndex : NextVictim++ % Workers.size()]; // workers push onto their own deque, everyone else spreads the work
+    {
+        std::lock_guard<std::mutex> Lock(W.Mutex);
+        W.Tasks.push_back(T);
+        Queued++;
+    }
+    {
+        std::lock_guard<std::mutex> SleepLock(SleepMutex); // so a worker can't miss the wake up between checking Queued and going to sleep
+    }
+    WakeUp.notify_one();
+
+    return static_cast<double>(Handle);
+}
+
+extern "C" double kaleidoscope_await(double Handle) {
+    Task* T = nullptr;
+    if (Handle >= 0 && Handle < 9007199254740992.0 && Handle == std::trunc(Handle)) {
+        std::lock_guard<std::mutex> HandlesLock(HandlesMutex);
+        auto HI = LiveHandles.find(static_cast<uint64_t>(Handle));
+        if (HI != LiveHandles.end()) {
+            T = HI->second;
+            LiveHandles.erase(HI); // awaited once => a second await of it is refused below
+        }
+    }
+    if (!T) { // jitted code has no way to handle an error => report it and give back NaN
+        fprintf(stderr, "Error: await of %f, which is not a handle from async (or was awaited already).\n", Handle);
+        return std::nan("");
+    }
+
+    while (!T->Done.load(std::memory_order_acquire)) { // help out instead of blocking => also keeps recursive async code from running out of threads
+        if (Task* Other = FindTask()) {
+            Run(Other);
+        } else {
+            std::this_thread::yield(); // whatever we wait for is running on another thread
+        }
+    }
+
+    RuntimeWrite(T->Output.data(), T->Output.size()); // in order with the awaiting thread's own output
+    double Result = T->Result;
+    delete T;
+    return Result;
+}
@@ -0,0 +1,378 @@
+#include "../include/kaleidoscope/watch.h"
+#include "../include/kaleidoscope/expression_handler.h"
+#include "../include/kaleidoscope/native_symbols.h"
+
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/TargetParser/Host.h"
+
+// one top level unit of the watched file
+struct SourceUnit {
+    enum { Definition, Declaration, Expression } Kind;
+    std::unique_ptr<FunctionAST> Function; // definitions and expressions
+    std::unique_ptr<PrototypeAST> Proto; // declarations
+    size_t Hash = 0; // of the normalized source text
+    std::set<std::string> Callees;
+};
+
+// a definition that is compiled into the session
+struct LiveDefinition {
+    size_t Hash = 0; // of the text it was compiled from (0 => its last compile failed, so it is retried)
+    llvm::orc::ResourceTrackerSP RT; // owns the current body
+};
+
+static std::unique_ptr<llvm::orc::IndirectStubsManager> Stubs; // one stub per defined name => the address everything links against
+static std::map<std::string, LiveDefinition> Live;
+static std::map<std::string, std::string> LiveSignatures; // every defined or declared name => its arity (and precedence for binary operators)
+static std::set<char> UserOperators; // precedences registered by the watched file
+static unsigned NumVersions = 0; // makes every compiled body's symbol unique
+
+static volatile std::sig_atomic_t StopWatching = 0;
+
+static void HandleInterrupt(int) {
+    StopWatching = 1;
+}
+
+// stubs of names that aren't defined anymore (or not yet) land here
+static double RemovedFunction() {
+    fprintf(stderr, "Error: called a function that is not defined in the current version of the script\n");
+    return 0;
+}
+
+// whitespace runs become one space and // comments disappear => reformatting or commenting a definition doesn't recompile it
+static std::string NormalizeSource(const std::string& Text) {
+    std::string Normal;
+    for (size_t i = 0; i < Text.size(); ++i) {
+        if (Text[i] == '/' && i + 1 < Text.size() && Text[i + 1] == '/') {
+            while (i < Text.size() && Text[i] != '\n' && Text[i] != '\r') {
+                ++i;
+            }
+        }
+        if (i < Text.size() && isspace(Text[i])) {
+            if (!Normal.empty() && Normal.back() != ' ') {
+                Normal += ' ';
+            }
+            continue;
+        }
+        if (i < Text.size()) {
+            Normal += Text[i];
+        }
+    }
+    while (!Normal.empty() && Normal.back() == ' ') {
+        Normal.pop_back();
+    }
+    return Normal;
+}
+
+static std::string Signature(const PrototypeAST& Proto) {
+    std::string Sig = std::to_string(Proto.getArgs().size());
+    for (size_t i = 0; i != Proto.getArgs().size(); ++i) { // a parameter that changes type changes how every caller passes it
+        Sig += " " + Proto.getArgType(i);
+    }
+    Sig += " : " + Proto.getReturnType();
+    if (Proto.isBinaryOp()) {
+        Sig += " prec " + std::to_string(Proto.getBinaryPrecedence());
+    }
+    return Sig;
+}
+
+// cuts the source into units and parses all of them => false (errors reported) if any unit doesn't parse
+static bool ParseUnits(const std::string& Source, std::vector<SourceUnit>& Units) {
+    std::istringstream Stream(Source);
+    input = &Stream;
+    ResetLexer();
+    unsigned ErrorsBefore = NumErrors;
+
+    getNextToken();
+    while (CurTok != tok_eof) {
+        if (CurTok == ';') {
+            getNextToken();
+            continue;
+        }
+
+        size_t Start = CurOffset;
+        SourceUnit Unit;
+        bool Parsed;
+        if (CurTok == tok_def) {
+            Unit.Kind = SourceUnit::Definition;
+            Unit.Function = ParseDefinition();
+            Parsed = Unit.Function != nullptr;
+            if (Parsed && Unit.Function->getProto().isBinaryOp()) { // codegen normally registers it, but later units already need it to parse
+                char Op = Unit.Function->getProto().getOperatorName();
+                BinOpPrecedence[Op] = Unit.Function->getProto().getBinaryPrecedence();
+                UserOperators.insert(Op);
+            }
+        } else if (CurTok == tok_import) { // an import can't be undone, so there's no reloading it
+            LogError("import isn't supported with --watch.");
+            input = nullptr;
+            return false;
+        } else if (CurTok == tok_record) { // defined right away (later units need it) => the compiled code depends on the layout, so its fields can't change while watching
+            auto Declaration = ParseRecord();
+            if (!Declaration || !DefineRecord(*Declaration)) {
+                input = nullptr;
+                return false;
+            }
+            continue;
+        } else if (CurTok == tok_decl) {
+            Unit.Kind = SourceUnit::Declaration;
+            Unit.Proto = ParseDecl();
+            Parsed = Unit.Proto != nullptr;
+        } else {
+            Unit.Kind = SourceUnit::Expression;
+            Unit.Function = ParseTopLevelExpr(TopLevelExpressionName());
+            Parsed = Unit.Function != nullptr;
+        }
+        if (!Parsed) {
+            input = nullptr;
+            return false;
+        }
+
+        Unit.Hash = std::hash<std::string>()(NormalizeSource(Source.substr(Start, CurOffset - Start)));
+        if (Unit.Function) {
+            Unit.Function->getBody()->collectCallees(Unit.Callees);
+        }
+        Units.push_back(std::move(Unit));
+    }
+
+    input = nullptr;
+    return NumErrors == ErrorsBefore;
+}
+
+// gives Name a stub (pointing at RemovedFunction until a body is compiled) and binds the plain name to it in the jit
+static void EnsureStub(const std::string& Name) {
+    if (!Stubs->findStub(Name, false).getAddress().isNull()) {
+        return;
+    }
+    ExitOnErr(Stubs->createStub(Name, llvm::orc::ExecutorAddr::fromPtr(&RemovedFunction), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable));
+    ExitOnErr(TheJIT->defineAbsolute(Name, Stubs->findStub(Name, false).getAddress()));
+}
+
+// compiles one definition into its own tracker and repoints its stub => false if codegen failed (the previous body stays in place)
+static bool CompileDefinition(std::unique_ptr<FunctionAST> FnAST) {
+    std::string Name = FnAST->getProto().getName();
+    llvm::Function* F = FnAST->codegen();
+    if (!F) {
+        return false;
+    }
+
+    std::string Versioned = Name + "." + std::to_string(++NumVersions);
+    F->setName(Versioned); // recursive calls inside the body keep calling F directly, everyone else goes through the stub
+    auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+    ExitOnErr(TheJIT->addModule(llvm::orc::ThreadSafeModule(std::move(TheModule), TheTSC), RT));
+    InitializeModule();
+
+    auto Symbol = TheJIT->lookup(Versioned); // compile it now, so a broken body can't replace a working one
+    if (!Symbol) {
+        LogError(llvm::toString(Symbol.takeError()).c_str());
+        ExitOnErr(RT->remove());
+        return false;
+    }
+
+    LiveDefinition& Def = Live[Name];
+    ExitOnErr(Stubs->updatePointer(Name, Symbol->getAddress()));
+    if (Def.RT) {
+        ExitOnErr(Def.RT->remove()); // nothing can reach the old body anymore
+    }
+    Def.RT = RT;
+    FunctionDefs[Name] = std::move(FnAST);
+    NoteFunctionChanged(Name);
+    return true;
+}
+
+static void Reload(const std::string& Source) {
+    auto Start = std::chrono::steady_clock::now();
+    for (char Op : UserOperators) { // the file registers them again while it is parsed
+        BinOpPrecedence.erase(Op);
+    }
+    UserOperators.clear();
+
+    std::vector<SourceUnit> Units;
+    if (!ParseUnits(Source, Units)) {
+        fprintf(stderr, "Not reloading => the previous version keeps running until the errors are fixed\n");
+        return;
+    }
+
+    // the new picture of every name
+    std::map<std::string, SourceUnit*> Defs;
+    std::map<std::string, std::string> Signatures;
+    for (auto &Unit : Units) {
+        if (Unit.Kind == SourceUnit::Expression) {
+            continue;
+        }
+        const PrototypeAST& Proto = Unit.Function ? Unit.Function->getProto() : *Unit.Proto;
+        if (Unit.Kind == SourceUnit::Definition && !Defs.emplace(Proto.getName(), &Unit).second) {
+            LogError(("'" + Proto.getName() + "' is defined twice => not reloading").c_str());
+            return;
+        }
+        Signatures[Proto.getName()] = Signature(Proto);
+    }
+
+    auto SignatureChanged = [&](const std::string& Name) {
+        auto Old = LiveSignatures.find(Name), New = Signatures.find(Name);
+        if (Old == LiveSignatures.end() || New == Signatures.end()) {
+            return (Old == LiveSignatures.end()) != (New == Signatures.end());
+        }
+        return Old->second != New->second;
+    };
+
+    // what has to be compiled again => new or edited text, or a callee whose signature changed
+    std::set<std::string> Dirty;
+    for (auto &Entry : Defs) {
+        auto LI = Live.find(Entry.first);
+        if (LI == Live.end() || LI->second.Hash != Entry.second->Hash) {
+            Dirty.insert(Entry.first);
+            continue;
+        }
+        for (auto &Callee : Entry.second->Callees) {
+            if (SignatureChanged(Callee)) {
+                Dirty.insert(Entry.first);
+                break;
+            }
+        }
+    }
+    // user defined operators are expanded into the code that uses them => a dirty operator dirties its users, transitively
+    for (bool Grew = true; Grew;) {
+        Grew = false;
+        for (auto &Entry : Defs) {
+            if (Dirty.count(Entry.first)) {
+                continue;
+            }
+            for (auto &Callee : Entry.second->Callees) {
+                auto DI = Defs.find(Callee);
+                if (Dirty.count(Callee) && DI != Defs.end() && (DI->second->Function->getProto().isBinaryOp() || DI->second->Function->getProto().isUnaryOp())) {
+                    Dirty.insert(Entry.first);
+                    Grew = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // names that disappeared => their stubs fall back to RemovedFunction (callers of them are dirty through their signature)
+    for (auto LI = Live.begin(); LI != Live.end();) {
+        if (Defs.count(LI->first)) {
+            ++LI;
+            continue;
+        }
+        ExitOnErr(Stubs->updatePointer(LI->first, llvm::orc::ExecutorAddr::fromPtr(&RemovedFunction)));
+        if (LI->second.RT) {
+            ExitOnErr(LI->second.RT->remove());
+        }
+        FunctionDefs.erase(LI->first);
+        FunctionProtos.erase(LI->first);
+        NoteFunctionChanged(LI->first);
+        LI = Live.erase(LI);
+    }
+
+    for (auto &Entry : LiveSignatures) { // declarations that disappeared
+        if (!Signatures.count(Entry.first) && !FunctionDefs.count(Entry.first)) {
+            FunctionProtos.erase(Entry.first);
+            NoteFunctionChanged(Entry.first);
+        }
+    }
+
+    // every prototype and stub up front => a definition may call anything in the file, in any order
+    for (auto &Unit : Units) {
+        if (Unit.Kind == SourceUnit::Declaration) {
+            if (SignatureChanged(Unit.Proto->getName())) {
+                NoteFunctionChanged(Unit.Proto->getName());
+            }
+            BindNativeSymbol(Unit.Proto->getName()); // a --load function (a no-op once bound, and a decl of a def in the file binds nothing)
+            FunctionProtos[Unit.Proto->getName()] = std::move(Unit.Proto);
+        } else if (Unit.Kind == SourceUnit::Definition) {
+            const std::string& Name = Unit.Function->getProto().getName();
+            FunctionProtos[Name] = std::make_unique<PrototypeAST>(Unit.Function->getProto());
+            EnsureStub(Name);
+            if (!Dirty.count(Name)) { // same text as the compiled body => just keep the fresh AST as the operator template
+                FunctionDefs[Name] = std::move(Unit.Function);
+            }
+        }
+    }
+    LiveSignatures = Signatures;
+
+    unsigned Compiled = 0, Failed = 0;
+    for (auto &Unit : Units) {
+        if (Unit.Kind != SourceUnit::Definition || !Unit.Function) {
+            continue;
+        }
+        std::string Name = Unit.Function->getProto().getName();
+        size_t Hash = Unit.Hash;
+        if (CompileDefinition(std::move(Unit.Function))) {
+            Live[Name].Hash = Hash;
+            Compiled++;
+        } else {
+            Live[Name].Hash = 0; // try again on the next save, even if it doesn't touch this definition
+            Failed++;
+        }
+    }
+    double CompileMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+    fprintf(stderr, "Reloaded: %u of %zu definitions recompiled%s in %.2f ms\n", Compiled, Defs.size(), Failed ? (" (" + std::to_string(Failed) + " failed)").c_str() : "", CompileMs);
+
+    for (auto &Unit : Units) { // everything is in place => run the expressions again, in source order
+        if (Unit.Kind == SourceUnit::Expression) {
+            EvaluateTopLevelExpression(std::move(Unit.Function));
+        }
+    }
+    RuntimeFlush();
+}
+
+static bool ReadFile(const std::string& Path, std::string& Source) {
+    std::ifstream File(Path, std::ios::binary);
+    if (!File) {
+        return false;
+    }
+    std::stringstream Buffer;
+    Buffer << File.rdbuf();
+    Source = Buffer.str();
+    return true;
+}
+
+bool WatchFile(const std::string& Path, unsigned PollMilliseconds) {
+    std::string Source;
+    if (!ReadFile(Path, Source)) {
+        LogError(("Could not open '" + Path + "'.").c_str());
+        return false;
+    }
+    if (!Stubs) {
+        Stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(llvm::Triple(llvm::sys::getProcessTriple()))();
+    }
+
+    StopWatching = 0;
+    auto PreviousHandler = std::signal(SIGINT, HandleInterrupt); // Ctrl-C ends the watch, and the engine shuts down normally
+    std::error_code EC;
+    auto LastWrite = std::filesystem::last_write_time(Path, EC);
+    Reload(Source);
+    fprintf(stderr, "Watching '%s' for changes (Ctrl-C to stop)\n", Path.c_str());
+
+    while (!StopWatching) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(PollMilliseconds));
+        auto Write = std::filesystem::last_write_time(Path, EC);
+        if (EC || Write == LastWrite) { // unchanged, or in the middle of being replaced by the editor
+            continue;
+        }
+        LastWrite = Write;
+
+        std::string Changed;
+        if (ReadFile(Path, Changed) && Changed != Source) {
+            Source = std::move(Changed);
+            Reload(Source);
+        }
+    }
+
+    std::signal(SIGINT, PreviousHandler);
+    return true;
+}
+
+void ResetWatchState() {
+    Live.clear();
+    LiveSignatures.clear();
+    UserOperators.clear();
+    Stubs.reset();
+}
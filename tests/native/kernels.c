@@ -0,0 +1,24 @@
+// native kernels for tests/native_load.k and tests/executor_restart.k => built as the test_kernels shared library and bound with --load
+// every kaleidoscope value is a double, so these only take and return doubles
+
+#ifdef _WIN32
+#define KERNEL __declspec(dllexport)
+#else
+#define KERNEL __attribute__((visibility("default")))
+#endif
+
+KERNEL double clamp01(double X) {
+    return X < 0 ? 0 : X > 1 ? 1 : X;
+}
+
+KERNEL double lerp(double A, double B, double T) {
+    return A + (B - A) * T;
+}
+
+#include <signal.h>
+
+// kills the process running it => tests/executor_restart.k checks that only the executor goes down
+KERNEL double crash(double X) {
+    raise(SIGSEGV);
+    return X;
+}